@@ -0,0 +1,391 @@
+/*
+ * Copyright © 2016 Pekka Paalanen <pq@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <math.h>
+
+#include "helpers.h"
+#include "oring-clock.h"
+#include "predictor.h"
+#include "repaint-scheduler.h"
+#include "sim-compositor.h"
+#include "timespec-util.h"
+#include "xalloc.h"
+
+/** Client side of the benchmark, mirroring struct window */
+struct bench {
+	struct oring_clock clock;
+	struct sim_compositor sim;
+	uint64_t rng; /* for the render cost */
+
+	struct predictor predictor;
+	struct repaint_offset repaint_offset;
+	struct cost_estimate render_cost;
+	struct frame_pacer pacer;
+	struct vrr_detector vrr;
+	double vrr_max_period; /* as in struct display, zero disables */
+	bool late_repaint;
+
+	double cost_mean; /* render cost at full quality, nsec */
+	double cost_dev;
+
+	uint64_t now;
+	uint64_t presented_time; /* of the previous frame, or INVALID_TIME */
+	uint32_t refresh;
+
+	double *errors; /* presented minus target of each presented frame */
+	uint64_t presented;
+	uint64_t discarded;
+	uint64_t missed; /* presented a half period or more late */
+	uint64_t early; /* presented a half period or more early */
+	uint64_t pacing_changes;
+	uint64_t vrr_changes;
+};
+
+static double
+bench_get_period(const struct bench *b)
+{
+	if (b->predictor.valid)
+		return b->predictor.period;
+
+	return b->sim.options.period;
+}
+
+/* The same as predict_next_frame_time_by_presented() in oring-cal */
+static uint64_t
+bench_predict_next(const struct bench *b)
+{
+	if (b->presented_time == INVALID_TIME)
+		return b->now + (uint64_t)bench_get_period(b);
+
+	if (b->predictor.valid)
+		return predictor_next_vblank(&b->predictor, b->presented_time);
+
+	if (b->refresh)
+		return b->presented_time + b->refresh;
+
+	return b->presented_time + (uint64_t)b->sim.options.period;
+}
+
+/* The same as window_get_max_period() in oring-cal */
+static double
+bench_get_max_period(const struct bench *b)
+{
+	return fmax(b->vrr_max_period, bench_get_period(b));
+}
+
+/* Cheaper quality levels draw less and at a lower resolution. */
+static double
+bench_render_cost(struct bench *b, int level)
+{
+	const struct frame_quality *q = frame_quality_get(level);
+	double cost;
+
+	cost = b->cost_mean + b->cost_dev * sim_random_normal(&b->rng);
+	cost *= q->scale * q->scale / (1 << q->detail_shift);
+
+	return fmax(cost, 0.0);
+}
+
+static void
+bench_frame(struct bench *b)
+{
+	struct predictor_sample sample;
+	struct sim_feedback fb;
+	struct timespec ts;
+	double period = bench_get_period(b);
+	double pacing_period = period;
+	double cost;
+	double ahead;
+	uint64_t target;
+	uint64_t start;
+	uint64_t commit;
+	uint64_t presented;
+	double error;
+	bool late;
+
+	ahead = repaint_offset_get(&b->repaint_offset, period) +
+		cost_estimate_budget(&b->render_cost);
+
+	/* As in window_pipeline_repaint() without commit timing */
+	if (b->vrr.active) {
+		pacing_period = bench_get_max_period(b);
+		target = repaint_target_vrr(b->now, ahead, b->presented_time,
+					    period, pacing_period);
+		late = true;
+	} else {
+		target = bench_predict_next(b) +
+			 (uint64_t)((b->pacer.interval - 1) * period);
+		target = repaint_target_earliest(target, b->now, ahead,
+						 period);
+		late = b->late_repaint || b->pacer.interval > 1;
+	}
+
+	start = b->now;
+	if (late && time_subtract(target, b->now) > ahead)
+		start = target - (uint64_t)ahead;
+
+	cost = bench_render_cost(b, b->pacer.level);
+	commit = start + (uint64_t)cost;
+
+	oring_clock_get_timespec(&b->clock, commit, &ts);
+	sim_compositor_commit(&b->sim, &ts, &fb);
+	presented = oring_clock_get_nsec(&b->clock, &fb.time);
+
+	cost_estimate_add(&b->render_cost, cost);
+
+	/* Feedback arrives at the vblank either way. */
+	b->now = MAX(commit, presented);
+
+	if (!fb.presented) {
+		b->discarded++;
+		return;
+	}
+
+	/* As in window_update_vrr(), the compositor always syncs. */
+	if (b->vrr_max_period > 0.0 &&
+	    vrr_detector_update(&b->vrr, fb.refresh, true)) {
+		predictor_reset(&b->predictor);
+		b->vrr_changes++;
+	}
+
+	/* There is no vblank grid to learn. */
+	if (!b->vrr.active) {
+		sample.commit_time = commit;
+		sample.frame_time = INVALID_TIME;
+		sample.presented_time = presented;
+		sample.refresh = fb.refresh;
+		sample.seq = fb.seq;
+		predictor_add_sample(&b->predictor, &sample);
+	}
+
+	repaint_offset_update(&b->repaint_offset, commit, target,
+			      oring_clock_get_nsec(&b->clock, &fb.frame_time),
+			      presented, period);
+
+	error = time_subtract(presented, target);
+	b->errors[b->presented++] = error;
+	if (error >= period / 2.0)
+		b->missed++;
+	else if (error <= -period / 2.0)
+		b->early++;
+
+	b->presented_time = presented;
+	b->refresh = fb.refresh;
+
+	/* With variable refresh the rate follows the cost, see
+	 * window_update_pacing(). */
+	if (b->vrr.active)
+		pacing_period = bench_get_max_period(b);
+
+	if (frame_pacer_update(&b->pacer,
+			       cost_estimate_budget(&b->render_cost),
+			       repaint_offset_get(&b->repaint_offset,
+						  pacing_period),
+			       pacing_period, 1))
+		b->pacing_changes++;
+}
+
+static int
+compare_double(const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+static double
+percentile(const double *sorted, uint64_t n, double p)
+{
+	uint64_t i = (uint64_t)ceil(p / 100.0 * n);
+
+	if (i == 0)
+		i = 1;
+
+	return sorted[MIN(i, n) - 1];
+}
+
+static void
+bench_report(struct bench *b, uint64_t frames)
+{
+	static const double ps[] = { 50.0, 90.0, 99.0, 99.9 };
+	unsigned i;
+
+	printf("%" PRIu64 " frames: %" PRIu64 " presented, %" PRIu64
+	       " discarded, %" PRIu64 " missed, %" PRIu64 " early\n",
+	       frames, b->presented, b->discarded, b->missed, b->early);
+	if (b->vrr.active)
+		printf("pacing: variable refresh, quality level %d, %" PRIu64
+		       " changes, %" PRIu64 " refresh mode changes\n",
+		       b->pacer.level, b->pacing_changes, b->vrr_changes);
+	else
+		printf("pacing: every %u vblank%s, quality level %d, %" PRIu64
+		       " changes, %" PRIu64 " refresh mode changes\n",
+		       b->pacer.interval, b->pacer.interval > 1 ? "s" : "",
+		       b->pacer.level, b->pacing_changes, b->vrr_changes);
+
+	if (b->presented == 0)
+		return;
+
+	qsort(b->errors, b->presented, sizeof b->errors[0], compare_double);
+
+	printf("target error:");
+	for (i = 0; i < ARRAY_LENGTH(ps); i++)
+		printf(" p%g %.1f us,", ps[i],
+		       percentile(b->errors, b->presented, ps[i]) * 1e-3);
+	printf(" min %.1f us, max %.1f us\n", b->errors[0] * 1e-3,
+	       b->errors[b->presented - 1] * 1e-3);
+}
+
+static void
+usage(int error_code)
+{
+	fprintf(stderr, "Usage: oring-bench [OPTIONS]\n\n"
+		"  -n N\tSimulate N frames (default 10000)\n"
+		"  -r HZ\tRefresh rate (default 60)\n"
+		"  -v MIN:MAX\tVariable refresh rate range in Hz\n"
+		"  -V HZ\tLowest rate the client paces a variable refresh\n"
+		"\toutput to, 0 to always pace to a fixed refresh "
+		"(default 40)\n"
+		"  -j USEC\tStandard deviation of presentation timestamps\n"
+		"  -p P\tProbability of a frame being discarded\n"
+		"  -d USEC\tCompositor repaint deadline before vblank "
+		"(default 1000)\n"
+		"  -c USEC\tMean render cost (default 2000)\n"
+		"  -C USEC\tRender cost standard deviation (default 500)\n"
+		"  -l\tStart rendering as late as possible before the deadline\n"
+		"  -q\tLower the drawing quality when frames do not fit\n"
+		"  -s SEED\tRandom seed (default 1)\n"
+		"  -m N\tFail if more than N frames miss their target\n"
+		"  -h\tThis help text\n\n");
+
+	exit(error_code);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct sim_options sim_opts = {
+		.period = millihz_to_nsec(60000),
+		.lead = 1000000.0,
+	};
+	struct timespec epoch;
+	struct bench b = {};
+	uint64_t frames = 10000;
+	uint64_t seed = 1;
+	long max_missed = -1;
+	bool degrade = false;
+	double hz, min_hz, max_hz;
+	double vrr_min_hz = 40.0;
+	uint64_t n;
+	int i;
+
+	b.cost_mean = 2000000.0;
+	b.cost_dev = 500000.0;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp("-n", argv[i]) == 0 && i + 1 < argc) {
+			frames = strtoull(argv[++i], NULL, 0);
+			if (frames == 0)
+				usage(EXIT_FAILURE);
+		}
+		else if (strcmp("-r", argv[i]) == 0 && i + 1 < argc) {
+			hz = atof(argv[++i]);
+			if (!isfinite(hz) || !(hz > 0.0))
+				usage(EXIT_FAILURE);
+			sim_opts.period = 1e9 / hz;
+		}
+		else if (strcmp("-v", argv[i]) == 0 && i + 1 < argc) {
+			if (sscanf(argv[++i], "%lf:%lf", &min_hz, &max_hz) != 2 ||
+			    !(min_hz > 0.0) || !isfinite(max_hz) ||
+			    max_hz < min_hz)
+				usage(EXIT_FAILURE);
+			sim_opts.vrr_min = 1e9 / max_hz;
+			sim_opts.vrr_max = 1e9 / min_hz;
+			sim_opts.period = sim_opts.vrr_min;
+		}
+		else if (strcmp("-V", argv[i]) == 0 && i + 1 < argc) {
+			hz = atof(argv[++i]);
+			if (!isfinite(hz) || hz < 0.0)
+				usage(EXIT_FAILURE);
+			vrr_min_hz = hz;
+		}
+		else if (strcmp("-j", argv[i]) == 0 && i + 1 < argc)
+			sim_opts.jitter = atof(argv[++i]) * 1e3;
+		else if (strcmp("-p", argv[i]) == 0 && i + 1 < argc)
+			sim_opts.drop_rate = atof(argv[++i]);
+		else if (strcmp("-d", argv[i]) == 0 && i + 1 < argc)
+			sim_opts.lead = atof(argv[++i]) * 1e3;
+		else if (strcmp("-c", argv[i]) == 0 && i + 1 < argc)
+			b.cost_mean = atof(argv[++i]) * 1e3;
+		else if (strcmp("-C", argv[i]) == 0 && i + 1 < argc)
+			b.cost_dev = atof(argv[++i]) * 1e3;
+		else if (strcmp("-l", argv[i]) == 0)
+			b.late_repaint = true;
+		else if (strcmp("-q", argv[i]) == 0)
+			degrade = true;
+		else if (strcmp("-s", argv[i]) == 0 && i + 1 < argc)
+			seed = strtoull(argv[++i], NULL, 0);
+		else if (strcmp("-m", argv[i]) == 0 && i + 1 < argc)
+			max_missed = atol(argv[++i]);
+		else if (strcmp("-h", argv[i]) == 0)
+			usage(EXIT_SUCCESS);
+		else
+			usage(EXIT_FAILURE);
+	}
+
+	sim_compositor_init(&b.sim, &sim_opts, seed);
+	sim_compositor_get_epoch(&b.sim, &epoch);
+	oring_clock_init(&b.clock, CLOCK_MONOTONIC, &epoch);
+	b.rng = seed * 2 + 1;
+
+	predictor_init(&b.predictor);
+	repaint_offset_init(&b.repaint_offset);
+	cost_estimate_init(&b.render_cost);
+	frame_pacer_init(&b.pacer, degrade ? 3 : 0);
+	vrr_detector_init(&b.vrr);
+	if (vrr_min_hz > 0.0)
+		b.vrr_max_period = 1e9 / vrr_min_hz;
+	b.now = 0;
+	b.presented_time = INVALID_TIME;
+	b.errors = xzalloc(frames * sizeof b.errors[0]);
+
+	for (n = 0; n < frames; n++)
+		bench_frame(&b);
+
+	bench_report(&b, frames);
+	free(b.errors);
+
+	if (max_missed >= 0 && b.missed > (uint64_t)max_missed)
+		return EXIT_FAILURE;
+
+	return EXIT_SUCCESS;
+}
@@ -33,13 +33,16 @@
 #include <signal.h>
 #include <time.h>
 #include <errno.h>
+#include <inttypes.h>
 
 #include <wayland-client.h>
 #include <wayland-cursor.h>
+#include <drm_fourcc.h>
 
 #include <sys/types.h>
 #include <unistd.h>
 #include <sys/epoll.h>
+#include <sys/timerfd.h>
 
 #include "cal.h"
 #include "helpers.h"
@@ -49,11 +52,22 @@
 #include "input.h"
 #include "output.h"
 #include "renderer.h"
+#include "render-thread.h"
+#include "scene.h"
+#include "soak.h"
 
 #include "presentation-time-client-protocol.h"
+#include "relative-pointer-unstable-v1-client-protocol.h"
+#include "viewporter-client-protocol.h"
+#include "xdg-shell-client-protocol.h"
+#include "linux-dmabuf-unstable-v1-client-protocol.h"
+#include "linux-explicit-synchronization-unstable-v1-client-protocol.h"
+#include "fifo-v1-client-protocol.h"
+#include "commit-timing-v1-client-protocol.h"
 
 #define TITLE PACKAGE_STRING " cal"
-#define MAX_EPOLL_WATCHES 6
+/* Initial room for ready fds, see mainloop() */
+#define MAX_EPOLL_WATCHES 16
 
 int running = 1;
 
@@ -80,6 +94,214 @@ format_nsec(double nsec, const char **unit)
 	return copysign(ret, nsec);
 }
 
+static int
+watch_ctl_(struct watch *w, int op, uint32_t events)
+{
+	struct epoll_event ee;
+
+	ee.events = events;
+	ee.data.ptr = w;
+	return epoll_ctl(w->display->epoll_fd, op, w->fd, &ee);
+}
+
+/** Initialize an fd watch
+ *
+ * \param w The uninitialized struct watch to overwrite.
+ * \param d The display where the epoll object is.
+ * \param fd The file descriptor to watch.
+ * \param priority When to call the handler relative to the other watches.
+ * \param cb The handler to call when the fd becomes operable.
+ * \return 0 on success, -1 on error with errno set from epoll_ctl().
+ *
+ * This makes the fd being watched for errors and hangups, but not for
+ * input or output. The display object must persist until watch_remove()
+ * is called for this watch.
+ */
+static int
+watch_init(struct watch *w, struct display *d, int fd,
+	   enum watch_priority priority, void (*cb)(struct watch *, uint32_t))
+{
+	w->display = d;
+	w->fd = fd;
+	w->priority = priority;
+	w->cb = cb;
+
+	if (watch_ctl_(w, EPOLL_CTL_ADD, 0) < 0)
+		return -1;
+
+	d->watch_count++;
+
+	return 0;
+}
+
+/** Remove an fd watch
+ *
+ * \param w The watch to remove.
+ *
+ * Remove the watch from the display. The watch becomes uninitialized.
+ * No calls to the callback will follow.
+ */
+static void
+watch_remove(struct watch *w)
+{
+	epoll_ctl(w->display->epoll_fd, EPOLL_CTL_DEL, w->fd, NULL);
+	w->display->watch_count--;
+}
+
+/** Watch for input and output
+ *
+ * \param w The watch.
+ * \return 0 on success, -1 on error with errno set from epoll_ctl().
+ *
+ * The watch will trigger for both readable and writable fd.
+ */
+static int
+watch_set_in_out(struct watch *w)
+{
+	return watch_ctl_(w, EPOLL_CTL_MOD, EPOLLIN | EPOLLOUT);
+}
+
+/** Watch for input
+ *
+ * \param w The watch.
+ * \return 0 on success, -1 on error with errno set from epoll_ctl().
+ *
+ * The watch will trigger for readable fd.
+ */
+static int
+watch_set_in(struct watch *w)
+{
+	return watch_ctl_(w, EPOLL_CTL_MOD, EPOLLIN);
+}
+
+static void
+timer_watch_handle(struct watch *w, uint32_t events)
+{
+	struct timer_watch *tw = wl_container_of(w, tw, watch);
+	uint64_t deadline = tw->armed;
+	uint64_t expirations;
+
+	if (read(w->fd, &expirations, sizeof expirations) < 0) {
+		if (errno != EAGAIN)
+			perror("Error reading timerfd");
+		return;
+	}
+
+	tw->armed = INVALID_TIME;
+	tw->cb(tw, deadline);
+}
+
+/** Initialize a timer watch
+ *
+ * \param tw The uninitialized struct timer_watch to overwrite.
+ * \param d The display, with its clock already set up.
+ * \param cb The handler to call when the deadline has passed, with the
+ * deadline.
+ * \return 0 on success, -1 on error with a message printed.
+ *
+ * The timer starts disarmed. On error the watch fd is -1, and
+ * timer_watch_remove() is still safe to call.
+ */
+static int
+timer_watch_init(struct timer_watch *tw, struct display *d,
+		 void (*cb)(struct timer_watch *, uint64_t))
+{
+	int fd;
+
+	tw->watch.fd = -1;
+	tw->armed = INVALID_TIME;
+	tw->cb = cb;
+	tw->clock_id = d->clock_id;
+
+	fd = timerfd_create(tw->clock_id, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (fd < 0 && errno == EINVAL) {
+		tw->clock_id = CLOCK_MONOTONIC;
+		fd = timerfd_create(tw->clock_id, TFD_CLOEXEC | TFD_NONBLOCK);
+	}
+	if (fd < 0) {
+		perror("Error creating timerfd");
+		return -1;
+	}
+
+	if (watch_init(&tw->watch, d, fd, WATCH_PRIORITY_TIMER,
+		       timer_watch_handle) < 0 ||
+	    watch_set_in(&tw->watch) < 0) {
+		perror("Error setting up timerfd epoll");
+		close(fd);
+		tw->watch.fd = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Remove and close a timer watch
+ *
+ * \param tw The timer watch.
+ */
+static void
+timer_watch_remove(struct timer_watch *tw)
+{
+	if (tw->watch.fd < 0)
+		return;
+
+	watch_remove(&tw->watch);
+	close(tw->watch.fd);
+	tw->watch.fd = -1;
+}
+
+/* The offset between the clocks is taken now, which is exact enough
+ * for deadlines that are less than a second away. */
+static void
+timer_watch_get_timespec(struct timer_watch *tw, uint64_t nsec,
+			 struct timespec *ts)
+{
+	struct oring_clock *gfx = &tw->watch.display->gfx_clock;
+	struct timespec now;
+
+	if (tw->clock_id == gfx->clock_id) {
+		oring_clock_get_timespec(gfx, nsec, ts);
+		return;
+	}
+
+	clock_gettime(tw->clock_id, &now);
+	timespec_add_nsec(ts, &now,
+			  time_subtract(nsec, oring_clock_get_nsec_now(gfx)));
+}
+
+/** Arm or disarm a timer watch
+ *
+ * \param tw The timer watch.
+ * \param nsec The deadline in display::gfx_clock nanoseconds, or
+ * INVALID_TIME to disarm.
+ * \return 0 on success, -1 on error with errno set from
+ * timerfd_settime().
+ *
+ * Setting the deadline that is already armed costs no syscall. A
+ * deadline in the past fires right away.
+ */
+static int
+timer_watch_set(struct timer_watch *tw, uint64_t nsec)
+{
+	struct itimerspec its = {};
+
+	if (nsec == tw->armed)
+		return 0;
+
+	if (nsec != INVALID_TIME)
+		timer_watch_get_timespec(tw, nsec, &its.it_value);
+
+	if (timerfd_settime(tw->watch.fd, TFD_TIMER_ABSTIME,
+			    &its, NULL) < 0) {
+		tw->armed = INVALID_TIME;
+		return -1;
+	}
+
+	tw->armed = nsec;
+
+	return 0;
+}
+
 /** Get one of the outputs the window is on
  *
  * \param window A window to identify the wl_surface.
@@ -123,6 +345,262 @@ window_schedule_repaint(struct window *window, uint64_t nsec)
 	window->target_time = nsec;
 }
 
+/** Get the output whose timing a window follows
+ *
+ * \param window The window.
+ * \return The sync output from the latest presentation feedback, or
+ * else an output the window is on, or NULL.
+ */
+static struct output *
+window_get_timing_output(struct window *window)
+{
+	if (window->scheduler->output)
+		return window->scheduler->output;
+
+	return window_get_output(window);
+}
+
+/** Get the refresh period of an output
+ *
+ * \param output The output, or NULL.
+ * \return The period in nanoseconds, the shortest one on variable
+ * refresh, and 60 Hz if nothing is known.
+ */
+static uint64_t
+output_get_period(const struct output *output)
+{
+	if (output && output->timing.vrr)
+		return output->timing.min_period;
+
+	if (!output || output->timing.period == 0)
+		return millihz_to_nsec(60000);
+
+	return output->timing.period;
+}
+
+/** Get the best known refresh period for a window
+ *
+ * \param window The window.
+ * \return Refresh period in nanoseconds.
+ */
+static double
+window_get_period(struct window *window)
+{
+	if (window->predictor.valid)
+		return window->predictor.period;
+
+	return output_get_period(window_get_timing_output(window));
+}
+
+/** Get the longest refresh period of a variable refresh window
+ *
+ * \param window The window.
+ * \return The period in nanoseconds.
+ *
+ * Outputs advertise only their highest rate, so the lowest one comes
+ * from the command line.
+ */
+static double
+window_get_max_period(struct window *window)
+{
+	return fmax(window->display->vrr_max_period, window_get_period(window));
+}
+
+/* Start a late repaint now instead of waiting for the timer. */
+static void
+window_start_late_repaint(struct window *window)
+{
+	uint64_t target = window->timer_target;
+
+	window->timer_target = INVALID_TIME;
+	window_schedule_repaint(window, target);
+}
+
+/** Arm the timer for the earliest start among the waiting windows
+ *
+ * \param sched The output scheduler.
+ *
+ * Call this whenever a window using the scheduler changes its late
+ * repaint. If the timer cannot be armed, the waiting windows start
+ * right away.
+ */
+static void
+output_scheduler_update(struct output_scheduler *sched)
+{
+	struct display *d = sched->display;
+	struct window *window;
+	uint64_t earliest = INVALID_TIME;
+
+	wl_list_for_each(window, &d->window_list, link) {
+		if (window->scheduler == sched &&
+		    window->timer_target != INVALID_TIME)
+			earliest = MIN(earliest, window->timer_start);
+	}
+
+	if (timer_watch_set(&sched->timer, earliest) < 0) {
+		perror("Error arming repaint timer");
+
+		wl_list_for_each(window, &d->window_list, link) {
+			if (window->scheduler == sched &&
+			    window->timer_target != INVALID_TIME)
+				window_start_late_repaint(window);
+		}
+	}
+}
+
+/** Start the windows whose late repaint is due
+ *
+ * Every window going for the same vblank as the most urgent one starts
+ * now, even if it could still wait a little. They are all submitted
+ * from the same main loop iteration.
+ */
+static void
+output_scheduler_handle_timer(struct timer_watch *tw, uint64_t deadline)
+{
+	struct output_scheduler *sched = wl_container_of(tw, sched, timer);
+	struct display *d = sched->display;
+	struct window *window;
+	uint64_t first = INVALID_TIME;
+	uint64_t now;
+	double batch = 0.0;
+	double late;
+
+	now = oring_clock_get_nsec_now(&d->gfx_clock);
+
+	/* Preemption of the event thread shows up here first. */
+	late = time_subtract(now, deadline);
+	sched->wakeups++;
+	sched->late_sum += late;
+	sched->late_max = fmax(sched->late_max, late);
+
+	wl_list_for_each(window, &d->window_list, link) {
+		if (window->scheduler != sched ||
+		    window->timer_target == INVALID_TIME ||
+		    window->timer_start > now ||
+		    window->timer_target >= first)
+			continue;
+
+		first = window->timer_target;
+		batch = window_get_period(window) / 2.0;
+	}
+
+	wl_list_for_each(window, &d->window_list, link) {
+		if (first != INVALID_TIME && window->scheduler == sched &&
+		    window->timer_target != INVALID_TIME &&
+		    time_subtract(window->timer_target, first) < batch)
+			window_start_late_repaint(window);
+	}
+
+	output_scheduler_update(sched);
+}
+
+/** Find or create the scheduler for an output
+ *
+ * \param d The display.
+ * \param output The output, or NULL for windows not synced to any.
+ * \return The scheduler, owned by the display.
+ */
+static struct output_scheduler *
+display_get_scheduler(struct display *d, struct output *output)
+{
+	struct output_scheduler *sched;
+
+	wl_list_for_each(sched, &d->scheduler_list, link) {
+		if (sched->output == output)
+			return sched;
+	}
+
+	sched = xzalloc(sizeof *sched);
+	sched->display = d;
+	sched->output = output ? output_ref(output) : NULL;
+	wl_list_insert(d->scheduler_list.prev, &sched->link);
+
+	if (timer_watch_init(&sched->timer, d,
+			     output_scheduler_handle_timer) < 0)
+		fprintf(stderr, "Warning: late repaint disabled.\n");
+
+	return sched;
+}
+
+static void
+output_scheduler_destroy(struct output_scheduler *sched)
+{
+	timer_watch_remove(&sched->timer);
+
+	if (sched->output)
+		output_unref(sched->output);
+
+	wl_list_remove(&sched->link);
+	free(sched);
+}
+
+/** Schedule repaint of the next frame as late as possible
+ *
+ * \param window The window to repaint.
+ * \param nsec The presentation time for the next frame.
+ *
+ * Like window_schedule_repaint(), but rendering is started only when
+ * there is just enough time left to render and commit before the
+ * compositor's learnt repaint deadline for the target. Calling this again
+ * before the timer fires replaces the target. The timer is shared with
+ * the other windows on the same output, see struct output_scheduler.
+ */
+static void
+window_schedule_repaint_late(struct window *window, uint64_t nsec)
+{
+	struct display *d = window->display;
+	struct output_scheduler *sched = window->scheduler;
+	double period;
+	double ahead;
+	uint64_t now;
+
+	period = window_get_period(window);
+	ahead = repaint_offset_get(&window->repaint_offset, period) +
+		cost_estimate_budget(&window->render_cost);
+
+	now = oring_clock_get_nsec_now(&d->gfx_clock);
+	if (sched->timer.watch.fd < 0 ||
+	    time_subtract(nsec, now) <= ahead) {
+		/* No time to spare, drop any wait and go. */
+		window->timer_target = INVALID_TIME;
+		if (sched->timer.watch.fd >= 0)
+			output_scheduler_update(sched);
+		window_schedule_repaint(window, nsec);
+		return;
+	}
+
+	window->timer_target = nsec;
+	window->timer_start = nsec - (uint64_t)ahead;
+	output_scheduler_update(sched);
+}
+
+/** Follow the output the compositor syncs the window to
+ *
+ * \param window The window.
+ * \param output The sync output from presentation feedback.
+ *
+ * A pending late repaint moves to the scheduler of the new output.
+ */
+static void
+window_set_sync_output(struct window *window, struct output *output)
+{
+	struct output_scheduler *old = window->scheduler;
+	uint64_t target = window->timer_target;
+
+	if (old->output == output)
+		return;
+
+	window->scheduler = display_get_scheduler(window->display, output);
+
+	if (target == INVALID_TIME)
+		return;
+
+	window->timer_target = INVALID_TIME;
+	if (old->timer.watch.fd >= 0)
+		output_scheduler_update(old);
+	window_schedule_repaint_late(window, target);
+}
+
 static void
 submission_destroy(struct submission *subm)
 {
@@ -132,92 +610,465 @@ submission_destroy(struct submission *subm)
 		wp_presentation_feedback_destroy(subm->feedback);
 	if (subm->sync_output)
 		output_unref(subm->sync_output);
+	if (subm->fence.fd >= 0) {
+		watch_remove(&subm->fence);
+		close(subm->fence.fd);
+	}
+
+	pool_free(&subm->window->display->submission_pool, subm);
+}
+
+static struct submission *
+submission_queue_get(struct submission_queue *q, unsigned i)
+{
+	return q->subm[(q->head + i) % SUBMISSION_QUEUE_SIZE];
+}
+
+static bool
+submission_queue_push(struct submission_queue *q, struct submission *subm)
+{
+	if (q->count == SUBMISSION_QUEUE_SIZE)
+		return false;
+
+	q->subm[(q->head + q->count) % SUBMISSION_QUEUE_SIZE] = subm;
+	q->count++;
+
+	return true;
+}
+
+static struct submission *
+submission_queue_drop_newest(struct submission_queue *q)
+{
+	assert(q->count > 0);
+
+	q->count--;
+
+	return submission_queue_get(q, q->count);
+}
+
+/** Destroy the oldest submissions that are completely done
+ *
+ * \param q The queue.
+ *
+ * Submissions are retired in order. A submission is done when the render
+ * thread has committed it, all its feedback has arrived, and its GPU
+ * timings are known.
+ */
+static void
+submission_queue_retire(struct submission_queue *q)
+{
+	struct submission *subm;
+
+	while (q->count > 0) {
+		subm = q->subm[q->head];
+		if (!subm->complete)
+			break;
 
-	free(subm);
+		submission_destroy(subm);
+		q->head = (q->head + 1) % SUBMISSION_QUEUE_SIZE;
+		q->count--;
+	}
+}
+
+static unsigned
+submission_queue_in_flight(struct submission_queue *q)
+{
+	unsigned i;
+	unsigned n = 0;
+
+	for (i = 0; i < q->count; i++) {
+		if (submission_queue_get(q, i)->in_flight)
+			n++;
+	}
+
+	return n;
 }
 
 static uint64_t
 predict_next_frame_time_by_presented(struct submission *subm)
 {
-	uint64_t period = subm->next_nsec;
-	struct output *output;
-
-	/* If the compositor didn't know, guess from the sync output rate */
-	if (period == 0) {
-		/* If we get here, we have already lost accuracy. */
-		output = subm->sync_output;
+	struct predictor *predictor = &subm->window->predictor;
+	uint64_t period = subm->next_nsec;
+	struct output *output;
+
+	if (predictor->valid)
+		return predictor_next_vblank(predictor, subm->presented_time);
+
+	/* If the compositor didn't know, guess from the sync output rate */
+	if (period == 0) {
+		/* If we get here, we have already lost accuracy. */
+		output = subm->sync_output;
+
+		/* If no sync output given, guess which output */
+		if (!output)
+			output = window_get_output(subm->window);
+
+		/* If window is on no output, it won't get shown, so...
+		 * whatever. If there is an output, guess from its rate.
+		 */
+		period = output_get_period(output);
+	}
+
+	return subm->presented_time + period;
+}
+
+static uint64_t
+predict_next_frame_time_by_framecb(struct submission *subm)
+{
+	struct window *window = subm->window;
+	struct predictor *predictor = &window->predictor;
+	struct output *output;
+	uint64_t now;
+	uint64_t period;
+	uint64_t vblank;
+
+	/* Don't have any better time reference. */
+	now = oring_clock_get_nsec_now(&window->display->gfx_clock);
+
+	/* Frame callbacks get sent when the compositor paints frame N,
+	 * which means it is too late to hit frame N, hence we aim for
+	 * frame N+1.
+	 *
+	 * If we have a vblank grid from earlier presentation feedback,
+	 * frame N is the next vblank on it.
+	 */
+	if (predictor->valid) {
+		return predictor_next_vblank(predictor, now) +
+		       (uint64_t)predictor->period;
+	}
+
+	/* guess which output */
+	output = window_get_timing_output(window);
+	period = output_get_period(output);
+
+	/* Another window may have seen the vblanks of the output. */
+	vblank = output ? output_timing_next_vblank(output, now) : INVALID_TIME;
+	if (vblank != INVALID_TIME)
+		return vblank + period;
+
+	/* Frame callbacks get sent before frame N is presented.
+	 *
+	 * Assuming frame callbacks get sent half a period before frame N
+	 * presentation, the latency to screen would be 1.5 periods.
+	 * But different compositors are different. Oh well.
+	 */
+
+	return now + period * 3 / 2;
+}
+
+/** Feed a presented submission to the window's predictor
+ *
+ * \param subm The submission, must have been presented.
+ *
+ * The history is restarted when the sync output changes, because the
+ * vblank grid of one output says nothing about another.
+ */
+static void
+window_update_predictor(struct submission *subm)
+{
+	struct window *window = subm->window;
+	struct predictor_sample sample;
+	uint32_t output_name = 0;
+
+	if (subm->sync_output)
+		output_name = subm->sync_output->name;
+
+	if (output_name != window->predictor_output) {
+		predictor_reset(&window->predictor);
+		window->predictor_output = output_name;
+	}
+
+	/* There is no vblank grid to learn. */
+	if (window->vrr.active)
+		return;
+
+	sample.commit_time = subm->commit_time;
+	sample.frame_time = subm->frame_time;
+	sample.presented_time = subm->presented_time;
+	sample.refresh = subm->next_nsec;
+	sample.seq = subm->seq;
+
+	predictor_add_sample(&window->predictor, &sample);
+}
+
+/** Learn render cost and repaint offset from a presented submission
+ *
+ * \param subm The submission, must have been presented.
+ */
+static void
+window_update_repaint_timing(struct submission *subm)
+{
+	struct window *window = subm->window;
+	uint64_t end = subm->commit_time;
+
+	/* The frame is ready when both the CPU and the GPU are done. */
+	if (subm->gpu_end_time != INVALID_TIME)
+		end = MAX(end, subm->gpu_end_time);
+	else if (subm->fence_time != INVALID_TIME)
+		end = MAX(end, subm->fence_time);
+
+	if (subm->render_start_time != INVALID_TIME &&
+	    subm->commit_time != INVALID_TIME) {
+		cost_estimate_add(&window->render_cost,
+				  time_subtract(end, subm->render_start_time));
+	}
+
+	repaint_offset_update(&window->repaint_offset, subm->commit_time,
+			      subm->target_time, subm->frame_time,
+			      subm->presented_time,
+			      window_get_period(window));
+}
+
+/** Adapt the frame pacing to the learnt render cost
+ *
+ * \param window The window.
+ */
+static void
+window_update_pacing(struct window *window)
+{
+	struct frame_pacer *fp = &window->pacer;
+	double period = window_get_period(window);
+
+	/* With variable refresh the frame rate simply follows the cost,
+	 * degrading is needed only below the lowest rate. */
+	if (window->vrr.active)
+		period = window_get_max_period(window);
+
+	if (!frame_pacer_update(fp, cost_estimate_budget(&window->render_cost),
+				repaint_offset_get(&window->repaint_offset,
+						   period),
+				period, window->queue.depth))
+		return;
+
+	trace_emit(window->display->trace_main, TRACE_PACING,
+		   oring_clock_get_nsec_now(&window->display->gfx_clock), 0, 0,
+		   fp->interval << 8 | fp->level);
+	printf("pacing: every %u vblank%s, quality level %d\n",
+	       fp->interval, fp->interval > 1 ? "s" : "", fp->level);
+}
+
+/** Move a target to the earliest vblank that can be made
+ *
+ * \param window The window.
+ * \param nsec The presentation time wished for, on the vblank grid.
+ * \return The presentation time to aim for.
+ *
+ * Starting now, the frame needs the render cost budget and the compositor
+ * repaint lead before its vblank.
+ */
+static uint64_t
+window_choose_target(struct window *window, uint64_t nsec)
+{
+	struct display *d = window->display;
+	double period = window_get_period(window);
+
+	return repaint_target_earliest(nsec,
+			oring_clock_get_nsec_now(&d->gfx_clock),
+			repaint_offset_get(&window->repaint_offset, period) +
+			cost_estimate_budget(&window->render_cost),
+			period);
+}
+
+/** Choose the target for a window on a variable refresh output
+ *
+ * \param window The window.
+ * \return The presentation time to aim for.
+ *
+ * The frame aims at when its rendering and the compositor repaint lead
+ * are done, but after the newest frame still on its way to the screen.
+ */
+static uint64_t
+window_choose_target_vrr(struct window *window)
+{
+	struct display *d = window->display;
+	double period = window_get_period(window);
+	uint64_t last = window->presented_time;
+	struct submission *subm;
+	unsigned i;
+
+	for (i = 0; i < window->queue.count; i++) {
+		subm = submission_queue_get(&window->queue, i);
+		if (!subm->finished && (last == INVALID_TIME ||
+					subm->target_time > last))
+			last = subm->target_time;
+	}
+
+	return repaint_target_vrr(oring_clock_get_nsec_now(&d->gfx_clock),
+			repaint_offset_get(&window->repaint_offset, period) +
+			cost_estimate_budget(&window->render_cost),
+			last, period, window_get_max_period(window));
+}
+
+/** Schedule the next frame if the pipeline has room
+ *
+ * \param window The window.
+ * \param nsec The presentation time to aim for if no frames were in flight.
+ *
+ * Each frame is aimed to stay on screen for frame_pacer::interval
+ * vblanks. With k frames in flight, the new frame aims k intervals after
+ * the one that would be next, so that each queued frame gets its vblanks
+ * of its own. A target already handed out for rendering is never
+ * overridden, but a pending late repaint timer gets the new target.
+ *
+ * A frame aimed more than one vblank ahead starts as late as possible,
+ * or it would be shown already on an earlier vblank. With commit timing
+ * the compositor holds it until its target, so it can start right away.
+ *
+ * On a variable refresh output nsec does not matter. The frame starts
+ * right away, or late enough to not come faster than the output can
+ * refresh.
+ */
+static void
+window_pipeline_repaint(struct window *window, uint64_t nsec)
+{
+	unsigned k = submission_queue_in_flight(&window->queue);
+	unsigned n = window->pacer.interval;
+	uint64_t target;
+
+	if (k >= window->queue.depth)
+		return;
+
+	if (window->target_time != INVALID_TIME)
+		return;
+
+	if (window->vrr.active) {
+		window_schedule_repaint_late(window,
+					     window_choose_target_vrr(window));
+		return;
+	}
+
+	target = nsec + (uint64_t)(((k + 1) * n - 1) *
+				   window_get_period(window));
+	target = window_choose_target(window, target);
+
+	if (window->display->late_repaint ||
+	    (n > 1 && !window->commit_timer))
+		window_schedule_repaint_late(window, target);
+	else
+		window_schedule_repaint(window, target);
+}
+
+/** Record the timings of a presented submission for the statistics
+ *
+ * \param subm The submission, must have been presented.
+ */
+static void
+window_record_stats(struct submission *subm)
+{
+	struct window *window = subm->window;
+	struct frame_stats_sample sample;
+
+	sample.seq = subm->seq;
+	sample.period = window_get_period(window);
+	sample.value[FRAME_STAT_LATENCY] = NAN;
+	sample.value[FRAME_STAT_TARGET_ERROR] =
+		time_subtract(subm->presented_time, subm->target_time);
+	sample.value[FRAME_STAT_RENDER_CPU] = NAN;
+	sample.value[FRAME_STAT_RENDER_GPU] = NAN;
+
+	if (subm->gpu_start_time != INVALID_TIME &&
+	    subm->gpu_end_time != INVALID_TIME) {
+		sample.value[FRAME_STAT_RENDER_GPU] =
+			time_subtract(subm->gpu_end_time,
+				      subm->gpu_start_time);
+	}
+
+	if (subm->commit_time != INVALID_TIME) {
+		sample.value[FRAME_STAT_LATENCY] =
+			time_subtract(subm->presented_time, subm->commit_time);
+	}
+
+	if (subm->render_start_time != INVALID_TIME &&
+	    subm->commit_time != INVALID_TIME) {
+		sample.value[FRAME_STAT_RENDER_CPU] =
+			time_subtract(subm->commit_time,
+				      subm->render_start_time);
+	}
+
+	frame_stats_record(&window->stats, &sample);
+}
+
+static void
+submission_trace(struct submission *subm, enum trace_event event,
+		 uint64_t time, uint64_t value)
+{
+	trace_emit(subm->window->display->trace_main, event, time, subm->id,
+		   subm->sync_output ? subm->sync_output->name : 0, value);
+}
+
+/** Learn from a submission once everything about it is known
+ *
+ * \param subm The submission.
+ *
+ * GPU timings and the fence may arrive before or after the presentation
+ * feedback. The statistics and the render cost wait for all of them, and
+ * the submission is retired only after this.
+ */
+static void
+submission_maybe_complete(struct submission *subm)
+{
+	if (subm->complete || !subm->committed || !subm->finished ||
+	    subm->gpu_pending || subm->fence.fd >= 0)
+		return;
 
-		/* If no sync output given, guess which output */
-		if (!output)
-			output = window_get_output(subm->window);
+	subm->complete = true;
 
-		/* If window is on no output, it won't get shown, so...
-		 * whatever. If there is an output, guess from its rate.
-		 */
-		if (!output)
-			period = millihz_to_nsec(60000);
-		else
-			period = millihz_to_nsec(output->current->millihz);
+	if (subm->presented_time != INVALID_TIME) {
+		if (subm->window->soak && subm->commit_time != INVALID_TIME)
+			soak_stats_record_latency(subm->window->soak,
+				time_subtract(subm->presented_time,
+					      subm->commit_time));
+		window_record_stats(subm);
+		window_update_repaint_timing(subm);
+		window_update_pacing(subm->window);
 	}
-
-	return subm->presented_time + period;
 }
 
-static uint64_t
-predict_next_frame_time_by_framecb(struct submission *subm)
+/* Frames without presentation feedback were discarded, main() makes
+ * sure wp_presentation is there. */
+static void
+window_record_soak(struct window *window, struct submission *subm)
 {
-	struct window *window = subm->window;
-	struct output *output;
-	uint64_t now;
-	uint64_t period;
-
-	/* guess which output */
-	output = window_get_output(window);
-	period = millihz_to_nsec(output->current->millihz);
+	uint64_t interval = INVALID_TIME;
 
-	/* Don't have any better time reference. */
-	now = oring_clock_get_nsec_now(&window->display->gfx_clock);
+	if (subm->presented_time == INVALID_TIME) {
+		soak_stats_record_discarded(window->soak);
+		return;
+	}
 
-	/* Frame callbacks get sent when the compositor paints frame N,
-	 * which means it is too late to hit frame N, hence we aim for
-	 * frame N+1. Frame callbacks get sent before frame N is presented.
-	 *
-	 * Assuming frame callbacks get sent half a period before frame N
-	 * presentation, the latency to screen would be 1.5 periods.
-	 * But different compositors are different. Oh well.
-	 */
+	if (window->presented_time != INVALID_TIME)
+		interval = subm->presented_time - window->presented_time;
 
-	return now + period * 3 / 2;
+	soak_stats_record_presented(window->soak,
+		time_subtract(subm->presented_time, subm->target_time),
+		interval, window_get_period(window));
 }
 
 static void
 submission_finish(struct submission *subm)
 {
 	struct window *window = subm->window;
-	uint32_t output_name = 9999;
-	double dt;
 	uint64_t target_time;
-	double dt_val;
-	const char *dt_unit;
-	double pres;
-	const char *pres_unit;
+
+	subm->finished = true;
+	subm->in_flight = false;
 
 	if (subm->sync_output)
-		output_name = subm->sync_output->name;
+		window_set_sync_output(window, subm->sync_output);
 
-	if (subm->presented_time != INVALID_TIME) {
-		dt = time_subtract(subm->presented_time, subm->target_time);
-		dt_val = format_nsec(dt, &dt_unit);
-		pres = format_nsec(subm->presented_time, &pres_unit);
-		printf("presented at %.3f %s on output-%d, %.1f %s from target\n",
-		       pres, pres_unit, output_name, dt_val, dt_unit);
+	if (window->soak)
+		window_record_soak(window, subm);
 
+	if (subm->presented_time != INVALID_TIME) {
+		window->presented_time = subm->presented_time;
+		window_update_predictor(subm);
 		target_time = predict_next_frame_time_by_presented(subm);
 	} else {
 		target_time = predict_next_frame_time_by_framecb(subm);
 	}
 
-	window_schedule_repaint(window, target_time);
+	window_pipeline_repaint(window, target_time);
+	submission_maybe_complete(subm);
 }
 
 static void
@@ -246,6 +1097,59 @@ static const struct warn_flag_item {
 	{ WP_PRESENTATION_FEEDBACK_KIND_HW_COMPLETION, "signalled by hardware" },
 };
 
+/** Switch pacing modes when the refresh turns out variable or fixed
+ *
+ * \param window The window.
+ * \param output The sync output of the presentation, or NULL.
+ * \param refresh The refresh from presentation feedback, nanoseconds.
+ * \param vsync Whether the presentation was synchronized to vblank.
+ */
+static void
+window_update_vrr(struct window *window, struct output *output,
+		  uint32_t refresh, bool vsync)
+{
+	if (window->display->vrr_max_period <= 0.0)
+		return;
+
+	if (!vrr_detector_update(&window->vrr, refresh, vsync))
+		return;
+
+	/* Either way the vblank history no longer applies. */
+	predictor_reset(&window->predictor);
+	if (output)
+		output_timing_set_vrr(output, window->vrr.active,
+				      window->display->vrr_max_period);
+
+	if (window->vrr.active)
+		printf("pacing: variable refresh, %.1f to %.1f Hz\n",
+		       1e9 / window_get_max_period(window),
+		       1e9 / window_get_period(window));
+	else
+		printf("pacing: fixed refresh\n");
+}
+
+/* The start time is taken before the presentation clock is known, so
+ * measure back from now in each clock instead of converting between
+ * them.
+ */
+static void
+display_report_startup(struct display *d, uint64_t presented)
+{
+	struct timespec now;
+	double since_start;
+	double since_presented;
+
+	d->first_presented = true;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	since_start = timespec_to_nsec(&now) - timespec_to_nsec(&d->start_time);
+	since_presented = time_subtract(oring_clock_get_nsec_now(&d->gfx_clock),
+					presented);
+
+	printf("first frame presented %.1f ms after start\n",
+	       (since_start - since_presented) * 1e-6);
+}
+
 static void
 feedback_handle_presented(void *data,
 			  struct wp_presentation_feedback *feedback,
@@ -269,8 +1173,12 @@ feedback_handle_presented(void *data,
 	subm->feedback = NULL;
 
 	timespec_from_proto(&tm, tv_sec_hi, tv_sec_lo, tv_nsec);
-	subm->presented_time = oring_clock_get_nsec(&d->gfx_clock, &tm);
+	subm->presented_time = oring_clock_batch_get_nsec(&d->wakeup, &tm);
 	subm->next_nsec = refresh;
+	subm->seq = ((uint64_t)seq_hi << 32) + seq_lo;
+	submission_trace(subm, TRACE_PRESENTED, subm->presented_time, refresh);
+	if (!d->first_presented)
+		display_report_startup(d, subm->presented_time);
 
 	for (i = 0; i < ARRAY_LENGTH(warn_flags); i++) {
 		if (flags & warn_flags[i].flag)
@@ -284,6 +1192,11 @@ feedback_handle_presented(void *data,
 		d->warned_flags |= warn_flags[i].flag;
 	}
 
+	window_update_vrr(subm->window, subm->sync_output, refresh,
+			  flags & WP_PRESENTATION_FEEDBACK_KIND_VSYNC);
+	if (subm->sync_output)
+		output_timing_presented(subm->sync_output,
+					subm->presented_time, refresh);
 	submission_finish(subm);
 }
 
@@ -292,13 +1205,15 @@ feedback_handle_discarded(void *data,
 			  struct wp_presentation_feedback *feedback)
 {
 	struct submission *subm = data;
+	struct display *d = subm->window->display;
 
 	assert(feedback == subm->feedback);
 
 	wp_presentation_feedback_destroy(subm->feedback);
 	subm->feedback = NULL;
 
-	fprintf(stderr, "Warning: frame discarded unexpectedly.\n");
+	frame_stats_record_discarded(&subm->window->stats);
+	submission_trace(subm, TRACE_DISCARDED, d->wakeup.now, 0);
 
 	submission_finish(subm);
 }
@@ -320,60 +1235,145 @@ frame_callback_handle_done(void *data, struct wl_callback *cb, uint32_t arg)
 
 	wl_callback_destroy(subm->frame);
 	subm->frame = NULL;
-	subm->frame_time = oring_clock_get_nsec_now(&display->gfx_clock);
+	subm->frame_time = display->wakeup.now;
+	submission_trace(subm, TRACE_FRAME_CALLBACK, subm->frame_time, 0);
 
-	if (!display->presentation)
+	if (!display->presentation) {
 		submission_finish(subm);
+		return;
+	}
+
+	/* The compositor is repainting now, so the frame no longer waits
+	 * in the pipeline. Arm the late repaint already, in case the render
+	 * budget needs the time before the presentation feedback arrives.
+	 * The feedback will refine the target.
+	 */
+	if (display->late_repaint) {
+		subm->in_flight = false;
+		window_pipeline_repaint(subm->window,
+				predict_next_frame_time_by_framecb(subm));
+	}
 }
 
 static const struct wl_callback_listener frame_callback_listener = {
 	frame_callback_handle_done,
 };
 
-struct submission *
+/** Create a submission for a frame
+ *
+ * \param window The window.
+ * \param target_time The presentation time the frame is aiming for.
+ * \return The submission, in flight.
+ *
+ * With commit timing the frame carries its target to the compositor, so
+ * it is never shown early however soon it gets committed. The timestamp
+ * is half a period before the target, so that the target vblank itself
+ * is not missed for a compositor predicting its repaint slightly late.
+ */
+static struct submission *
 submission_create(struct window *window, uint64_t target_time)
 {
-	struct submission *subm;
 	struct display *d = window->display;
+	struct submission *subm;
+	double half = window_get_period(window) / 2.0;
 
-	subm = xzalloc(sizeof *subm);
+	subm = pool_zalloc(&window->display->submission_pool);
 	subm->window = window;
+	subm->id = ++window->submission_count;
 	subm->target_time = target_time;
+	subm->render_start_time = INVALID_TIME;
 	subm->commit_time = INVALID_TIME;
 	subm->frame_time = INVALID_TIME;
 	subm->presented_time = INVALID_TIME;
+	subm->gpu_start_time = INVALID_TIME;
+	subm->gpu_end_time = INVALID_TIME;
+	subm->fence.fd = -1;
+	subm->fence_time = INVALID_TIME;
+	subm->in_flight = true;
+
+	if (window->commit_timer && target_time != INVALID_TIME &&
+	    target_time > half) {
+		oring_clock_get_timespec(&d->gfx_clock,
+					 target_time - (uint64_t)half,
+					 &subm->not_before);
+		subm->timed = true;
+	}
+
+	return subm;
+}
+
+/** Ask for feedback on the next commit
+ *
+ * \param subm The submission being rendered.
+ * \param rt The render thread of the window.
+ *
+ * Called by the render thread right before the commit, with its own
+ * wrappers. The new proxies are then moved to the main queue, so that
+ * their events are dispatched in the main thread. They cannot fire
+ * before the commit, which makes it safe to set the listeners and move
+ * them here. The commit timestamp goes with the same commit.
+ */
+void
+submission_request_feedback(struct submission *subm, struct render_thread *rt)
+{
+	uint32_t sec_hi, sec_lo, nsec;
 
-	subm->frame = wl_surface_frame(window->surface);
+	if (subm->timed && rt->commit_timer) {
+		timespec_to_proto(&subm->not_before, &sec_hi, &sec_lo, &nsec);
+		wp_commit_timer_v1_set_timestamp(rt->commit_timer,
+						 sec_hi, sec_lo, nsec);
+	}
+
+	subm->frame = wl_surface_frame(rt->surface);
 	wl_callback_add_listener(subm->frame, &frame_callback_listener, subm);
+	wl_proxy_set_queue((struct wl_proxy *)subm->frame, NULL);
 
-	if (d->presentation) {
-		subm->feedback = wp_presentation_feedback(d->presentation,
-							  window->surface);
+	if (rt->presentation) {
+		subm->feedback = wp_presentation_feedback(rt->presentation,
+							  rt->surface);
 		wp_presentation_feedback_add_listener(subm->feedback,
 						&presentation_feedback_listener,
 						subm);
+		wl_proxy_set_queue((struct wl_proxy *)subm->feedback, NULL);
 	}
+}
 
-	return subm;
+static void
+window_record_configure(struct window *window, int32_t width, int32_t height)
+{
+	window->configure.size.width = width;
+	window->configure.size.height = height;
 }
 
-void
-window_add_submission(struct window *window, struct submission *subm)
+/** Apply the latest configure, if any
+ *
+ * \param window The window.
+ * \param serial Returns the serial to ack before the next commit.
+ * \return True if the serial needs acking.
+ *
+ * Called when a frame is submitted, see struct window_configure.
+ */
+bool
+window_take_configure(struct window *window, uint32_t *serial)
 {
-	if (window->prev_sub)
-		submission_destroy(window->prev_sub);
+	struct window_configure *c = &window->configure;
 
-	window->prev_sub = window->cur_sub;
+	if (!c->pending)
+		return false;
 
-	window->cur_sub = subm;
-}
+	c->pending = false;
 
-void
-submission_set_commit_time(struct submission *subm)
-{
-	struct display *display = subm->window->display;
+	if (c->size.width > 0 && c->size.height > 0) {
+		if (!window->fullscreen)
+			window->window_size = c->size;
+		window->geometry = c->size;
+	} else if (!window->fullscreen) {
+		window->geometry = window->window_size;
+	}
+
+	*serial = c->serial;
 
-	subm->commit_time = oring_clock_get_nsec_now(&display->gfx_clock);
+	return window->xdg_surface != NULL;
 }
 
 static void
@@ -390,20 +1390,8 @@ handle_surface_configure(void *data, struct wl_shell_surface *shsurf,
 {
 	struct window *window = data;
 
-	if (width > 0 && height > 0) {
-		if (!window->fullscreen) {
-			window->window_size.width = width;
-			window->window_size.height = height;
-		}
-		window->geometry.width = width;
-		window->geometry.height = height;
-	} else if (!window->fullscreen) {
-		window->geometry = window->window_size;
-	}
-
-	renderer_window_resize(window->render_window,
-			       window->geometry.width,
-			       window->geometry.height);
+	window_record_configure(window, width, height);
+	window->configure.pending = true;
 }
 
 static void
@@ -418,9 +1406,66 @@ static const struct wl_shell_surface_listener shell_surface_listener = {
 	handle_surface_popup_done,
 };
 
+static void
+xdg_toplevel_handle_configure(void *data, struct xdg_toplevel *toplevel,
+			      int32_t width, int32_t height,
+			      struct wl_array *states)
+{
+	window_record_configure(data, width, height);
+}
+
+static void
+xdg_toplevel_handle_close(void *data, struct xdg_toplevel *toplevel)
+{
+	running = 0;
+}
+
+static const struct xdg_toplevel_listener xdg_toplevel_listener = {
+	xdg_toplevel_handle_configure,
+	xdg_toplevel_handle_close,
+};
+
+/* The toplevel events come first, this ends the configure sequence. */
+static void
+xdg_surface_handle_configure(void *data, struct xdg_surface *xdg_surface,
+			     uint32_t serial)
+{
+	struct window *window = data;
+
+	window->configure.serial = serial;
+	window->configure.pending = true;
+
+	/* Nothing may be attached before the first configure. */
+	if (!window->configured) {
+		window->configured = true;
+		window_schedule_repaint(window, 0);
+	}
+}
+
+static const struct xdg_surface_listener xdg_surface_listener = {
+	xdg_surface_handle_configure,
+};
+
 static void
 create_shell_surface(struct window *window, struct display *display)
 {
+	if (display->wm_base) {
+		window->xdg_surface =
+			xdg_wm_base_get_xdg_surface(display->wm_base,
+						    window->surface);
+		xdg_surface_add_listener(window->xdg_surface,
+					 &xdg_surface_listener, window);
+
+		window->xdg_toplevel =
+			xdg_surface_get_toplevel(window->xdg_surface);
+		xdg_toplevel_add_listener(window->xdg_toplevel,
+					  &xdg_toplevel_listener, window);
+
+		xdg_toplevel_set_title(window->xdg_toplevel, TITLE);
+		xdg_toplevel_set_app_id(window->xdg_toplevel, PACKAGE_NAME);
+		return;
+	}
+
 	window->shsurf = wl_shell_get_shell_surface(display->shell,
 						    window->surface);
 	wl_shell_surface_add_listener(window->shsurf,
@@ -428,11 +1473,28 @@ create_shell_surface(struct window *window, struct display *display)
 
 	wl_shell_surface_set_title(window->shsurf, TITLE);
 	wl_shell_surface_set_class(window->shsurf, PACKAGE_NAME);
+	window->configured = true;
 }
 
+/** Ask the shell for the window::fullscreen state
+ *
+ * With xdg-shell, the first call also makes the initial commit, which
+ * the compositor answers with the first configure.
+ */
 void
 shell_surface_set_state(struct window *window)
 {
+	if (window->xdg_toplevel) {
+		if (window->fullscreen)
+			xdg_toplevel_set_fullscreen(window->xdg_toplevel, NULL);
+		else
+			xdg_toplevel_unset_fullscreen(window->xdg_toplevel);
+
+		if (!window->configured)
+			wl_surface_commit(window->surface);
+		return;
+	}
+
 	if (window->fullscreen) {
 		wl_shell_surface_set_fullscreen(window->shsurf,
 				WL_SHELL_SURFACE_FULLSCREEN_METHOD_DEFAULT,
@@ -440,12 +1502,19 @@ shell_surface_set_state(struct window *window)
 	} else {
 		window->geometry = window->window_size;
 		wl_shell_surface_set_toplevel(window->shsurf);
-		renderer_window_resize(window->render_window,
-				window->geometry.width,
-				window->geometry.height);
 	}
 }
 
+void
+shell_surface_move(struct window *window, struct wl_seat *seat,
+		   uint32_t serial)
+{
+	if (window->xdg_toplevel)
+		xdg_toplevel_move(window->xdg_toplevel, seat, serial);
+	else
+		wl_shell_surface_move(window->shsurf, seat, serial);
+}
+
 static void
 window_output_destroy(struct window_output *wino)
 {
@@ -538,14 +1607,33 @@ window_create(struct display *display, const struct geometry *size,
 	window->opaque = opaque;
 	window->fullscreen = fullscreen;
 	window->target_time = INVALID_TIME;
+	predictor_init(&window->predictor);
+	window->scheduler = display_get_scheduler(display, NULL);
+	window->timer_target = INVALID_TIME;
+	repaint_offset_init(&window->repaint_offset);
+	cost_estimate_init(&window->render_cost);
+	frame_pacer_init(&window->pacer, 0);
+	vrr_detector_init(&window->vrr);
+	window->presented_time = INVALID_TIME;
+	window->queue.depth = 1;
+	frame_stats_init(&window->stats);
+	if (display->bench_path)
+		window->soak = soak_stats_create();
+	input_queue_init(&window->input);
 
 	wl_list_init(&window->on_output_list);
 
 	window->surface = wl_compositor_create_surface(display->compositor);
 	wl_surface_add_listener(window->surface, &surface_listener, window);
 
+	if (display->commit_timing)
+		window->commit_timer = wp_commit_timing_manager_v1_get_timer(
+				display->commit_timing, window->surface);
+
 	create_shell_surface(window, display);
 
+	wl_list_insert(display->window_list.prev, &window->link);
+
 	return window;
 }
 
@@ -577,25 +1665,39 @@ window_destroy(struct window *window)
 {
 	struct window_output *wino, *winotmp;
 
-	wl_shell_surface_destroy(window->shsurf);
+	wl_list_remove(&window->link);
+	if (window->timer_target != INVALID_TIME &&
+	    window->scheduler->timer.watch.fd >= 0)
+		output_scheduler_update(window->scheduler);
+
+	if (window->viewport)
+		wp_viewport_destroy(window->viewport);
+	if (window->fifo)
+		wp_fifo_v1_destroy(window->fifo);
+	if (window->commit_timer)
+		wp_commit_timer_v1_destroy(window->commit_timer);
+	if (window->xdg_toplevel)
+		xdg_toplevel_destroy(window->xdg_toplevel);
+	if (window->xdg_surface)
+		xdg_surface_destroy(window->xdg_surface);
+	if (window->shsurf)
+		wl_shell_surface_destroy(window->shsurf);
 	wl_surface_destroy(window->surface);
 
-	if (window->prev_sub)
-		submission_destroy(window->prev_sub);
-
-	if (window->cur_sub)
-		submission_destroy(window->cur_sub);
+	while (window->queue.count > 0)
+		submission_destroy(submission_queue_drop_newest(&window->queue));
 
 	wl_list_for_each_safe(wino, winotmp, &window->on_output_list, link)
 		window_output_destroy(wino);
 
+	frame_stats_release(&window->stats);
+	soak_stats_destroy(window->soak);
 	free(window);
 }
 
 static int
 register_wl_compositor(struct display *d, void *proxy, uint32_t name)
 {
-	assert(wl_proxy_get_version(proxy) == 1);
 	assert(!d->compositor);
 
 	d->compositor = proxy;
@@ -619,9 +1721,6 @@ register_wl_seat(struct display *d, void *proxy, uint32_t name)
 {
 	struct seat *seat;
 
-	/* XXX: implement support for wl_seat up to version 5 */
-	assert(wl_proxy_get_version(proxy) == 1);
-
 	seat = seat_create(d, proxy, name);
 	wl_list_insert(&d->seat_list, &seat->link);
 
@@ -636,19 +1735,64 @@ register_wl_shm(struct display *d, void *proxy, uint32_t name)
 
 	d->shm = proxy;
 
+	return 0;
+}
+
+/** Get the default cursor, loading the theme on first use
+ *
+ * \param d The display.
+ * \return The left_ptr cursor, or NULL if it could not be loaded.
+ *
+ * Reading the theme from disk is slow enough to show in startup time,
+ * and the cursor is not needed until the pointer first enters a window.
+ */
+struct wl_cursor *
+display_get_default_cursor(struct display *d)
+{
+	if (d->cursor_loaded)
+		return d->default_cursor;
+
+	d->cursor_loaded = true;
+
+	if (!d->shm)
+		return NULL;
+
 	d->cursor_theme = wl_cursor_theme_load(NULL, 32, d->shm);
 	if (!d->cursor_theme) {
 		fprintf(stderr, "unable to load default theme\n");
-		return -1;
+		return NULL;
 	}
 
 	d->default_cursor =
 		wl_cursor_theme_get_cursor(d->cursor_theme, "left_ptr");
 	if (!d->default_cursor) {
 		fprintf(stderr, "unable to load default left pointer\n");
-		// TODO: abort ?
+		return NULL;
 	}
 
+	d->cursor_surface = wl_compositor_create_surface(d->compositor);
+
+	return d->default_cursor;
+}
+
+static void
+wm_base_handle_ping(void *data, struct xdg_wm_base *wm_base, uint32_t serial)
+{
+	xdg_wm_base_pong(wm_base, serial);
+}
+
+static const struct xdg_wm_base_listener wm_base_listener = {
+	wm_base_handle_ping,
+};
+
+static int
+register_xdg_wm_base(struct display *d, void *proxy, uint32_t name)
+{
+	assert(!d->wm_base);
+
+	d->wm_base = proxy;
+	xdg_wm_base_add_listener(d->wm_base, &wm_base_listener, d);
+
 	return 0;
 }
 
@@ -670,24 +1814,140 @@ static void
 presentation_clock_id(void *data, struct wp_presentation *wp_presentation,
 		      uint32_t clk_id)
 {
-	struct display *d = data;
+	struct display *d = data;
+
+	d->clock_id = clk_id;
+}
+
+static const struct wp_presentation_listener presentation_listener = {
+	presentation_clock_id,
+};
+
+static int
+register_wp_presentation(struct display *d, void *proxy, uint32_t name)
+{
+	assert(wl_proxy_get_version(proxy) == 1);
+	assert(!d->presentation);
+
+	d->presentation = proxy;
+	wp_presentation_add_listener(d->presentation,
+				     &presentation_listener, d);
+
+	return 0;
+}
+
+static int
+register_zwp_relative_pointer_manager_v1(struct display *d, void *proxy,
+					 uint32_t name)
+{
+	struct seat *seat;
+
+	assert(!d->relative_pointer_manager);
+
+	d->relative_pointer_manager = proxy;
+
+	wl_list_for_each(seat, &d->seat_list, link)
+		seat_update_relative_pointer(seat);
+
+	return 0;
+}
+
+static int
+register_wp_viewporter(struct display *d, void *proxy, uint32_t name)
+{
+	assert(!d->viewporter);
+
+	d->viewporter = proxy;
+
+	return 0;
+}
+
+static void
+dmabuf_add_modifier(struct display *d, uint32_t format, uint64_t modifier)
+{
+	struct dmabuf_modifier *mod;
+
+	mod = wl_array_add(&d->dmabuf_modifiers, sizeof *mod);
+	if (!mod) {
+		fprintf(stderr, "Error: out of memory\n");
+		exit(1);
+	}
+	mod->format = format;
+	mod->modifier = modifier;
+}
+
+static void
+dmabuf_handle_format(void *data, struct zwp_linux_dmabuf_v1 *dmabuf,
+		     uint32_t format)
+{
+	struct display *d = data;
+
+	/* Version 3 sends the same formats again with modifiers. */
+	if (wl_proxy_get_version((struct wl_proxy *)dmabuf) < 3)
+		dmabuf_add_modifier(d, format, DRM_FORMAT_MOD_INVALID);
+}
+
+static void
+dmabuf_handle_modifier(void *data, struct zwp_linux_dmabuf_v1 *dmabuf,
+		       uint32_t format, uint32_t modifier_hi,
+		       uint32_t modifier_lo)
+{
+	struct display *d = data;
+
+	dmabuf_add_modifier(d, format,
+			    ((uint64_t)modifier_hi << 32) | modifier_lo);
+}
+
+static const struct zwp_linux_dmabuf_v1_listener dmabuf_listener = {
+	dmabuf_handle_format,
+	dmabuf_handle_modifier,
+};
+
+static int
+register_zwp_linux_dmabuf_v1(struct display *d, void *proxy, uint32_t name)
+{
+	assert(!d->dmabuf);
+
+	/* create_immed is new in version 2 */
+	if (wl_proxy_get_version(proxy) < 2) {
+		zwp_linux_dmabuf_v1_destroy(proxy);
+		return 0;
+	}
+
+	d->dmabuf = proxy;
+	zwp_linux_dmabuf_v1_add_listener(d->dmabuf, &dmabuf_listener, d);
+
+	return 0;
+}
+
+static int
+register_zwp_linux_explicit_synchronization_v1(struct display *d,
+					       void *proxy, uint32_t name)
+{
+	assert(!d->explicit_sync);
+
+	d->explicit_sync = proxy;
+
+	return 0;
+}
+
+static int
+register_wp_fifo_manager_v1(struct display *d, void *proxy, uint32_t name)
+{
+	assert(!d->fifo_manager);
 
-	d->clock_id = clk_id;
-}
+	d->fifo_manager = proxy;
 
-static const struct wp_presentation_listener presentation_listener = {
-	presentation_clock_id,
-};
+	return 0;
+}
 
 static int
-register_wp_presentation(struct display *d, void *proxy, uint32_t name)
+register_wp_commit_timing_manager_v1(struct display *d, void *proxy,
+				     uint32_t name)
 {
-	assert(wl_proxy_get_version(proxy) == 1);
-	assert(!d->presentation);
+	assert(!d->commit_timing);
 
-	d->presentation = proxy;
-	wp_presentation_add_listener(d->presentation,
-				     &presentation_listener, d);
+	d->commit_timing = proxy;
 
 	return 0;
 }
@@ -697,12 +1957,22 @@ static const struct global_binder {
 	int (*register_)(struct display *d, void *proxy, uint32_t name);
 	uint32_t supported_version;
 } global_binders[] = {
-	{ &wl_compositor_interface, register_wl_compositor, 1 },
+	{ &wl_compositor_interface, register_wl_compositor, 4 },
 	{ &wl_shell_interface, register_wl_shell, 1 },
-	{ &wl_seat_interface, register_wl_seat, 1 },
+	{ &xdg_wm_base_interface, register_xdg_wm_base, 1 },
+	{ &wl_seat_interface, register_wl_seat, 5 },
 	{ &wl_shm_interface, register_wl_shm, 1 },
 	{ &wl_output_interface, register_wl_output, 2 },
 	{ &wp_presentation_interface, register_wp_presentation, 1 },
+	{ &zwp_relative_pointer_manager_v1_interface,
+	  register_zwp_relative_pointer_manager_v1, 1 },
+	{ &wp_viewporter_interface, register_wp_viewporter, 1 },
+	{ &zwp_linux_dmabuf_v1_interface, register_zwp_linux_dmabuf_v1, 3 },
+	{ &zwp_linux_explicit_synchronization_v1_interface,
+	  register_zwp_linux_explicit_synchronization_v1, 1 },
+	{ &wp_fifo_manager_v1_interface, register_wp_fifo_manager_v1, 1 },
+	{ &wp_commit_timing_manager_v1_interface,
+	  register_wp_commit_timing_manager_v1, 1 },
 };
 
 static void
@@ -785,76 +2055,148 @@ static const struct wl_registry_listener registry_listener = {
 	registry_handle_global_remove
 };
 
-static int
-watch_ctl_(struct watch *w, int op, uint32_t events)
+static void
+submission_handle_fence(struct watch *w, uint32_t events)
 {
-	struct epoll_event ee;
+	struct submission *subm = wl_container_of(w, subm, fence);
+	struct display *d = subm->window->display;
 
-	ee.events = events;
-	ee.data.ptr = w;
-	return epoll_ctl(w->display->epoll_fd, op, w->fd, &ee);
+	subm->fence_time = d->wakeup.now;
+	submission_trace(subm, TRACE_FENCE, subm->fence_time, 0);
+
+	watch_remove(&subm->fence);
+	close(subm->fence.fd);
+	subm->fence.fd = -1;
+
+	submission_maybe_complete(subm);
 }
 
-/** Initialize an fd watch
- *
- * \param w The uninitialized struct watch to overwrite.
- * \param d The display where the epoll object is.
- * \param fd The file descriptor to watch.
- * \param cb The handler to call when the fd becomes operable.
- * \return 0 on success, -1 on error with errno set from epoll_ctl().
- *
- * This makes the fd being watched for errors and hangups, but not for
- * input or output. The display object must persist until watch_remove()
- * is called for this watch.
- */
-static int
-watch_init(struct watch *w, struct display *d, int fd,
-	   void (*cb)(struct watch *, uint32_t))
+static void
+submission_handle_commit(struct submission *subm,
+			 const struct render_done *done)
 {
-	w->display = d;
-	w->fd = fd;
-	w->cb = cb;
+	struct display *d = subm->window->display;
 
-	return watch_ctl_(w, EPOLL_CTL_ADD, 0);
+	subm->render_start_time = done->render_start_time;
+	subm->commit_time = done->commit_time;
+	subm->gpu_pending = done->gpu_timed;
+	subm->committed = true;
+
+	if (done->fence_fd < 0)
+		return;
+
+	/* A sync file polls readable once signalled. */
+	if (watch_init(&subm->fence, d, done->fence_fd,
+		       WATCH_PRIORITY_COMPLETION, submission_handle_fence) < 0 ||
+	    watch_set_in(&subm->fence) < 0) {
+		perror("Error watching render fence");
+		close(done->fence_fd);
+		subm->fence.fd = -1;
+	}
 }
 
-/** Remove an fd watch
- *
- * \param w The watch to remove.
- *
- * Remove the watch from the display. The watch becomes uninitialized.
- * No calls to the callback will follow.
- */
 static void
-watch_remove(struct watch *w)
+window_handle_render_done(struct watch *w, uint32_t events)
 {
-	epoll_ctl(w->display->epoll_fd, EPOLL_CTL_DEL, w->fd, NULL);
+	struct window *window = wl_container_of(w, window, render_done);
+	struct render_done done;
+	struct predictor *predictor = &window->predictor;
+	bool any = false;
+	uint64_t now;
+	uint64_t nsec;
+
+	while (render_thread_get_done(window->render_thread, &done)) {
+		switch (done.type) {
+		case RENDER_DONE_COMMIT:
+			submission_handle_commit(done.subm, &done);
+			any = true;
+			break;
+		case RENDER_DONE_GPU_TIMING:
+			done.subm->gpu_start_time = done.gpu_start_time;
+			done.subm->gpu_end_time = done.gpu_end_time;
+			done.subm->gpu_pending = false;
+			if (done.gpu_start_time != INVALID_TIME &&
+			    done.gpu_end_time != INVALID_TIME) {
+				submission_trace(done.subm, TRACE_GPU_BEGIN,
+						 done.gpu_start_time, 0);
+				submission_trace(done.subm, TRACE_GPU_END,
+						 done.gpu_end_time, 0);
+			}
+			break;
+		}
+
+		submission_maybe_complete(done.subm);
+	}
+
+	if (!any)
+		return;
+
+	/* Overlap rendering the next frame with this one in flight, if
+	 * the pipeline is deeper than one.
+	 */
+	now = oring_clock_get_nsec_now(&window->display->gfx_clock);
+	if (predictor->valid)
+		nsec = predictor_next_vblank(predictor, now);
+	else
+		nsec = now + (uint64_t)window_get_period(window);
+
+	window_pipeline_repaint(window, nsec);
 }
 
-/** Watch for input and output
+/** Set up the frame pacing
  *
- * \param w The watch.
- * \return 0 on success, -1 on error with errno set from epoll_ctl().
+ * \param window The window.
+ * \param degrade Whether lower quality levels are allowed.
  *
- * The watch will trigger for both readable and writable fd.
+ * Without degrading, only the interval is ever changed. The levels
+ * with a lower render resolution need wp_viewporter to scale the buffer
+ * back up to the window size in the compositor.
  */
-static int
-watch_set_in_out(struct watch *w)
+static void
+window_init_pacing(struct window *window, bool degrade)
 {
-	return watch_ctl_(w, EPOLL_CTL_MOD, EPOLLIN | EPOLLOUT);
+	struct display *d = window->display;
+	int max_level = 0;
+
+	if (degrade && d->viewporter) {
+		window->viewport = wp_viewporter_get_viewport(d->viewporter,
+							      window->surface);
+		max_level = 3;
+	} else if (degrade) {
+		fprintf(stderr, "Warning: wp_viewporter unavailable, "
+			"not lowering the resolution.\n");
+		max_level = 1;
+	}
+
+	frame_pacer_init(&window->pacer, max_level);
 }
 
-/** Watch for input
- *
- * \param w The watch.
- * \return 0 on success, -1 on error with errno set from epoll_ctl().
+/** Start the render thread for a window
  *
- * The watch will trigger for readable fd.
+ * \param window The window, with render_window already created.
  */
-static int
-watch_set_in(struct watch *w)
+static void
+window_start_render_thread(struct window *window)
 {
-	return watch_ctl_(w, EPOLL_CTL_MOD, EPOLLIN);
+	struct render_thread *rt;
+
+	rt = render_thread_create(window);
+	window->render_thread = rt;
+
+	if (watch_init(&window->render_done, window->display, rt->done_fd,
+		       WATCH_PRIORITY_COMPLETION, window_handle_render_done) < 0 ||
+	    watch_set_in(&window->render_done) < 0) {
+		perror("Error setting up render thread epoll");
+		exit(1);
+	}
+}
+
+static void
+window_stop_render_thread(struct window *window)
+{
+	watch_remove(&window->render_done);
+	render_thread_destroy(window->render_thread);
+	window->render_thread = NULL;
 }
 
 static void
@@ -902,14 +2244,19 @@ static struct display *
 display_connect(void)
 {
 	struct display *d;
-	const char *clockname;
 	int dpy_fd;
 
 	d = xzalloc(sizeof(*d));
+	clock_gettime(CLOCK_MONOTONIC, &d->start_time);
 
+	wl_list_init(&d->window_list);
+	wl_list_init(&d->scheduler_list);
 	wl_list_init(&d->output_list);
 	wl_list_init(&d->seat_list);
+	wl_array_init(&d->dmabuf_modifiers);
 	d->clock_id = INVALID_CLOCK_ID;
+	pool_init(&d->submission_pool, sizeof(struct submission),
+		  SUBMISSION_QUEUE_SIZE);
 
 	d->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
 	if (d->epoll_fd == -1) {
@@ -925,7 +2272,8 @@ display_connect(void)
 
 	d->must_read = false;
 	dpy_fd = wl_display_get_fd(d->display);
-	watch_init(&d->display_watch, d, dpy_fd, display_handle_data);
+	watch_init(&d->display_watch, d, dpy_fd, WATCH_PRIORITY_DISPLAY,
+		   display_handle_data);
 	if (watch_set_in(&d->display_watch) < 0) {
 		perror("Error setting up display epoll");
 		exit(1);
@@ -934,14 +2282,26 @@ display_connect(void)
 	d->registry = wl_display_get_registry(d->display);
 	wl_registry_add_listener(d->registry, &registry_listener, d);
 
+	return d;
+}
+
+/** Wait for the globals and their initial events
+ *
+ * Split from display_connect() so that the caller can start work that
+ * needs only the wl_display, like EGL initialization, before blocking
+ * on the roundtrips.
+ */
+static void
+display_bind_globals(struct display *d)
+{
+	const char *clockname;
+
 	/* Get globals */
 	wl_display_roundtrip(d->display);
 
 	/* Ensure initial events for bound globals */
 	wl_display_roundtrip(d->display);
 
-	d->cursor_surface = wl_compositor_create_surface(d->compositor);
-
 	if (!d->presentation) {
 		fprintf(stderr, "Warning: wp_presentation unavailable, "
 			"timings will suffer.\n");
@@ -959,28 +2319,35 @@ display_connect(void)
 	}
 
 	oring_clock_init_now(&d->gfx_clock, d->clock_id);
+	oring_clock_batch_init(&d->wakeup, &d->gfx_clock, &d->gfx_clock.base);
 
 	printf("Using %s, clock id %d (%s)\n", clockname, d->clock_id,
 	       clock_get_name(d->clock_id));
-
-	return d;
 }
 
 static void
 display_destroy(struct display *d)
 {
+	struct output_scheduler *sched, *schedtmp;
 	struct output *o, *otmp;
 	struct seat *s, *stmp;
 
 	watch_remove(&d->display_watch);
 
-	wl_surface_destroy(d->cursor_surface);
+	wl_list_for_each_safe(sched, schedtmp, &d->scheduler_list, link)
+		output_scheduler_destroy(sched);
+
+	if (d->cursor_surface)
+		wl_surface_destroy(d->cursor_surface);
 	if (d->cursor_theme)
 		wl_cursor_theme_destroy(d->cursor_theme);
 
 	if (d->shell)
 		wl_shell_destroy(d->shell);
 
+	if (d->wm_base)
+		xdg_wm_base_destroy(d->wm_base);
+
 	if (d->compositor)
 		wl_compositor_destroy(d->compositor);
 
@@ -989,6 +2356,26 @@ display_destroy(struct display *d)
 	wl_list_for_each_safe(s, stmp, &d->seat_list, link)
 		seat_destroy(s);
 
+	if (d->relative_pointer_manager)
+		zwp_relative_pointer_manager_v1_destroy(
+			d->relative_pointer_manager);
+
+	if (d->viewporter)
+		wp_viewporter_destroy(d->viewporter);
+
+	if (d->dmabuf)
+		zwp_linux_dmabuf_v1_destroy(d->dmabuf);
+	wl_array_release(&d->dmabuf_modifiers);
+
+	if (d->explicit_sync)
+		zwp_linux_explicit_synchronization_v1_destroy(d->explicit_sync);
+
+	if (d->fifo_manager)
+		wp_fifo_manager_v1_destroy(d->fifo_manager);
+
+	if (d->commit_timing)
+		wp_commit_timing_manager_v1_destroy(d->commit_timing);
+
 	wl_list_for_each_safe(o, otmp, &d->output_list, link) {
 		if (output_unref(o) != 0)
 			fprintf(stderr, "Warning: output leaked.\n");
@@ -999,18 +2386,64 @@ display_destroy(struct display *d)
 
 	close(d->epoll_fd);
 
+	pool_release(&d->submission_pool);
 	free(d);
 }
 
 static void
-display_run_idle_tasks(struct display *display)
+window_run_idle_tasks(struct window *window)
 {
-	struct window *window = display->window;
+	struct display *display = window->display;
+	struct submission *subm;
+
+	submission_queue_retire(&window->queue);
+
+	if (window->target_time == INVALID_TIME)
+		return;
+
+	subm = submission_create(window, window->target_time);
+	window->target_time = INVALID_TIME;
+	subm->level = window->pacer.level;
+	submission_trace(subm, TRACE_REPAINT,
+			 oring_clock_get_nsec_now(&display->gfx_clock),
+			 subm->target_time);
+
+	subm->input_count = window_collect_input(window, subm->input,
+						 ARRAY_LENGTH(subm->input));
+	subm->pointer_valid = display_predict_pointer(display, window,
+						      subm->target_time,
+						      &subm->pointer_x,
+						      &subm->pointer_y);
+
+	if (!submission_queue_push(&window->queue, subm)) {
+		fprintf(stderr, "Warning: submission queue full, "
+			"dropped a repaint.\n");
+		submission_destroy(subm);
+		return;
+	}
 
-	if (window->target_time != INVALID_TIME) {
-		redraw(window, window->target_time);
-		window->target_time = INVALID_TIME;
+	if (render_thread_submit(window->render_thread, subm) < 0) {
+		fprintf(stderr, "Warning: render thread is behind, "
+			"dropped a repaint.\n");
+		submission_destroy(submission_queue_drop_newest(&window->queue));
+		return;
 	}
+
+	display->loop_stats.frames++;
+}
+
+/* Submitting all windows in one go puts their commits into the flush
+ * at the end of the main loop iteration, together.
+ */
+static void
+display_run_idle_tasks(struct display *display)
+{
+	struct window *window;
+
+	display_dispatch_input(display);
+
+	wl_list_for_each(window, &display->window_list, link)
+		window_run_idle_tasks(window);
 }
 
 static const char * const output_transform_string[] = {
@@ -1058,41 +2491,283 @@ display_choose_output(struct display *d)
 	return wl_container_of(d->output_list.prev, output, link);
 }
 
+static void
+display_print_pool_stats(struct display *d)
+{
+	const struct pool_stats *st = pool_get_stats(&d->submission_pool);
+
+	printf("submission pool: %" PRIu64 " allocations, "
+	       "%" PRIu64 " chunks from heap, at most %u in use\n",
+	       st->allocs, st->heap_allocs, st->high_water);
+}
+
+/* How well the event thread kept its deadlines */
+static void
+display_print_sched_stats(struct display *d)
+{
+	struct output_scheduler *sched;
+	const char *mean_unit, *max_unit;
+	double mean, max;
+
+	printf("scheduling:\n");
+	realtime_status_print(&d->sched, "event");
+
+	wl_list_for_each(sched, &d->scheduler_list, link) {
+		if (sched->wakeups == 0)
+			continue;
+
+		mean = format_nsec(sched->late_sum / sched->wakeups,
+				   &mean_unit);
+		max = format_nsec(sched->late_max, &max_unit);
+		printf("\trepaint timer of output-%u: %" PRIu64 " wakeups, "
+		       "late mean %.1f %s, max %.1f %s\n",
+		       sched->output ? sched->output->name : 0,
+		       sched->wakeups, mean, mean_unit, max, max_unit);
+	}
+}
+
+/* Near one wakeup per frame is the goal at high refresh rates. */
+static void
+display_print_loop_stats(struct display *d)
+{
+	const struct loop_stats *st = &d->loop_stats;
+	double frames = st->frames ? st->frames : 1;
+
+	printf("main loop: %" PRIu64 " iterations, %" PRIu64 " wakeups, "
+	       "%" PRIu64 " frames\n", st->iterations, st->wakeups,
+	       st->frames);
+	printf("\tper frame: %.2f wakeups, %.2f syscalls, "
+	       "%.2f Wayland events\n", st->wakeups / frames,
+	       st->syscalls / frames, st->events / frames);
+}
+
 static void
 signal_int(int signum)
 {
 	running = 0;
 }
 
+static void
+bench_timer_handle(struct timer_watch *tw, uint64_t deadline)
+{
+	running = 0;
+}
+
+/** Start a soak run that ends the program after a while
+ *
+ * \param d The display, with display::bench_path set.
+ * \param seconds How long to run, finite and positive.
+ *
+ * The run is capped to what keeps the deadline within INT64_MAX
+ * nanoseconds, which is centuries.
+ */
+static void
+display_start_bench(struct display *d, double seconds)
+{
+	double limit;
+
+	if (timer_watch_init(&d->bench_timer, d, bench_timer_handle) < 0)
+		exit(1);
+
+	d->bench_start = oring_clock_get_nsec_now(&d->gfx_clock);
+	limit = (double)(INT64_MAX - d->bench_start) * 1e-9;
+	seconds = fmin(seconds, limit);
+
+	if (timer_watch_set(&d->bench_timer,
+			    d->bench_start + (uint64_t)(seconds * 1e9)) < 0) {
+		perror("Error arming the benchmark timer");
+		exit(1);
+	}
+
+	printf("benchmarking for %.0f s\n", seconds);
+}
+
+/** Write the JSON report of a soak run
+ *
+ * \param d The display, with display::bench_path set.
+ * \return 0 on success, -1 on error with a message printed.
+ *
+ * Call this after the main loop has stopped and before destroying the
+ * windows. The keys are meant to stay stable, so that the reports of
+ * different runs can be compared by scripts.
+ */
+static int
+display_write_bench_report(struct display *d)
+{
+	const struct loop_stats *st = &d->loop_stats;
+	struct window *window;
+	bool first = true;
+	FILE *fp;
+
+	fp = fopen(d->bench_path, "w");
+	if (!fp) {
+		fprintf(stderr, "Error: opening %s: %s\n", d->bench_path,
+			strerror(errno));
+		return -1;
+	}
+
+	fprintf(fp, "{\"version\":1,\"duration_ns\":%.0f,\"clock\":\"%s\",\n",
+		time_subtract(oring_clock_get_nsec_now(&d->gfx_clock),
+			      d->bench_start),
+		clock_get_name(d->clock_id));
+	fprintf(fp, "\"main_loop\":{\"iterations\":%" PRIu64
+		",\"wakeups\":%" PRIu64 ",\"syscalls\":%" PRIu64
+		",\"events\":%" PRIu64 ",\"frames\":%" PRIu64 "},\n",
+		st->iterations, st->wakeups, st->syscalls, st->events,
+		st->frames);
+
+	fprintf(fp, "\"windows\":[");
+	wl_list_for_each(window, &d->window_list, link) {
+		fprintf(fp, "%s\n\t{\"output\":%u,\"period_ns\":%.0f,"
+			"\"pacing_interval\":%u,\"quality_level\":%d,"
+			"\"vrr\":%s,\n\t\"stats\":", first ? "" : ",",
+			window->scheduler->output ?
+				window->scheduler->output->name : 0,
+			window_get_period(window), window->pacer.interval,
+			window->pacer.level,
+			window->vrr.active ? "true" : "false");
+		soak_stats_write_json(window->soak, fp);
+		fprintf(fp, "}");
+		first = false;
+	}
+	fprintf(fp, "\n]}\n");
+
+	if (fclose(fp) != 0) {
+		fprintf(stderr, "Error: writing %s: %s\n", d->bench_path,
+			strerror(errno));
+		return -1;
+	}
+
+	printf("benchmark report written to %s\n", d->bench_path);
+
+	return 0;
+}
+
+static void
+window_print_stats(struct window *window)
+{
+	static const char * const names[] = {
+		[FRAME_STAT_LATENCY] = "commit to present",
+		[FRAME_STAT_TARGET_ERROR] = "target error",
+		[FRAME_STAT_RENDER_CPU] = "render CPU time",
+		[FRAME_STAT_RENDER_GPU] = "render GPU time",
+	};
+	const struct frame_stats *stats = &window->stats;
+	const struct frame_stats_summary *sum;
+	const char *mean_unit, *min_unit, *max_unit;
+	double mean, min, max;
+	unsigned i;
+
+	printf("%" PRIu64 " frames presented, %" PRIu64 " discarded, "
+	       "%" PRIu64 " missed their target\n",
+	       stats->presented, stats->discarded, stats->missed);
+	realtime_status_print(&window->render_sched, "render");
+
+	for (i = 0; i < FRAME_STAT_COUNT; i++) {
+		sum = &stats->summary[i];
+		if (sum->count == 0)
+			continue;
+
+		mean = format_nsec(sum->sum / sum->count, &mean_unit);
+		min = format_nsec(sum->min, &min_unit);
+		max = format_nsec(sum->max, &max_unit);
+		printf("\t%s: mean %.1f %s, min %.1f %s, max %.1f %s\n",
+		       names[i], mean, mean_unit, min, min_unit,
+		       max, max_unit);
+	}
+}
+
 static void
 usage(int error_code)
 {
 	fprintf(stderr, "Usage: oring-cal [OPTIONS]\n\n"
 		"  -f\tRun in fullscreen mode\n"
 		"  -o\tCreate an opaque surface\n"
-		"  -s\tUse a 16 bpp EGL config\n"
-		"  -b\tset eglSwapInterval to 0 (default 1)\n"
-		"  -h\tThis help text\n\n");
+		"  -s\tRender in RGB565, the same as -F rgb565\n"
+		"  -F FORMAT\tRender in FORMAT: rgb565, xrgb8888 (default),\n"
+		"\targb2101010 or fp16. With -o the variant without alpha\n"
+		"\tis used, so the compositor need not blend\n"
+		"  -b\tset eglSwapInterval to 0 (default)\n"
+		"  -B\tset eglSwapInterval to 1, letting the driver throttle\n"
+		"  -l\tStart rendering as late as possible before the deadline\n"
+		"  -n N\tAllow up to N frames in flight (default 1, max %d)\n"
+		"  -i N\tDraw N instances of the mesh (default 1)\n"
+		"  -c N\tAdd N shader iterations per mesh fragment (default 0)\n"
+		"  -d N\tBlend N full-window layers on top (default 0)\n"
+		"  -g\tDraw graphs of frame timings\n"
+		"  -q\tLower the drawing quality when frames do not fit\n"
+		"  -t FILE\tRecord a binary timing trace to FILE\n"
+		"  -w N\tOpen N windows (default 1, max %d)\n"
+		"  -D N\tRender into N dmabufs of our own instead of an EGL\n"
+		"\twindow surface (2 to %d)\n"
+		"  -r POLICY[:PRIO]\tRun the event and render threads with\n"
+		"\tPOLICY fifo or rr (default priority 10)\n"
+		"  -a CPU[,CPU...]\tPin the event thread to the first CPU and\n"
+		"\tthe render threads to the others\n"
+		"  -m\tLock the memory of the program once set up\n"
+		"  -v HZ\tLowest rate of a variable refresh output, 0 to always\n"
+		"\tpace to a fixed refresh (default 40)\n"
+		"  --bench=SECONDS\tRun for SECONDS and write the distributions\n"
+		"\tof the frame timings as JSON\n"
+		"  --bench-report=FILE\tWrite the report to FILE\n"
+		"\t(default oring-cal-bench.json)\n"
+		"  -h\tThis help text\n\n", MAX_FRAMES_IN_FLIGHT, MAX_WINDOWS,
+		RENDERER_MAX_BUFFERS);
 
 	exit(error_code);
 }
 
+/* Handle the ready fds of one priority, see enum watch_priority. */
+static void
+mainloop_dispatch(struct display *display, const struct epoll_event *ee,
+		  int count, enum watch_priority priority)
+{
+	struct watch *w;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		w = ee[i].data.ptr;
+		if (w->priority != priority)
+			continue;
+
+		display->loop_stats.syscalls++;
+		w->cb(w, ee[i].events);
+	}
+}
+
+/** Run until told to quit
+ *
+ * \param display The display.
+ * \return 0 on normal exit, an errno on failure.
+ *
+ * Each iteration first dispatches the Wayland events, then starts the
+ * frames that are due, and flushes once after all that work. After a
+ * wakeup, the Wayland socket is read and dispatched before the render
+ * threads and fences are looked at, and the timers come last, so that
+ * presentation feedback and input are taken into account in everything
+ * started from this wakeup.
+ */
 static int
 mainloop(struct display *display)
 {
-	struct epoll_event ee[MAX_EPOLL_WATCHES];
+	struct epoll_event *ee;
+	unsigned ee_size = MAX_EPOLL_WATCHES;
+	struct loop_stats *stats = &display->loop_stats;
 	struct wl_display *dpy = display->display;
-	struct watch *w;
 	int count;
-	int i;
 	int ret;
 	int myret = 0;
 
 	running = 1;
+	ee = xmalloc(ee_size * sizeof *ee);
 
 	while (1) {
+		stats->iterations++;
+
 		/* The main dispatch of Wayland events */
-		wl_display_dispatch_pending(dpy);
+		ret = wl_display_dispatch_pending(dpy);
+		if (ret > 0)
+			stats->events += ret;
 
 		/* Do this before prepare_read to minize the time between
 		 * prepare_read and read_events/cancel_read to avoid stalling
@@ -1101,8 +2776,11 @@ mainloop(struct display *display)
 		display_run_idle_tasks(display);
 
 		/* Left-over dispatch to ensure prepare_read succeeds. */
-		while (wl_display_prepare_read(dpy) < 0)
-			wl_display_dispatch_pending(dpy);
+		while (wl_display_prepare_read(dpy) < 0) {
+			ret = wl_display_dispatch_pending(dpy);
+			if (ret > 0)
+				stats->events += ret;
+		}
 		display->must_read = true;
 
 		/* The normal exit condition. */
@@ -1112,6 +2790,7 @@ mainloop(struct display *display)
 		/* Flush out buffered requests. If the Wayland socket is
 		 * full, poll it for writable too, and continue flushing then.
 		 */
+		stats->syscalls++;
 		ret = wl_display_flush(display->display);
 		if (ret < 0 && errno == EAGAIN) {
 			watch_set_in_out(&display->display_watch);
@@ -1121,24 +2800,45 @@ mainloop(struct display *display)
 			break;
 		}
 
+		/* Room for every watch, so that one wakeup returns all the
+		 * ready fds and the priorities hold across all of them. */
+		if (display->watch_count > ee_size) {
+			ee_size = display->watch_count * 2;
+			ee = xrealloc(ee, ee_size * sizeof *ee);
+		}
+
 		/* Wait for events or signals */
-		count = epoll_wait(display->epoll_fd,
-				   ee, ARRAY_LENGTH(ee), -1);
+		stats->syscalls++;
+		count = epoll_wait(display->epoll_fd, ee, ee_size, -1);
 		if (count < 0 && errno != EINTR) {
 			myret = errno;
 			perror("Error with epoll_wait");
 			break;
 		}
+		if (count > 0)
+			stats->wakeups++;
+
+		/* Everything this wakeup brought is stamped with its time,
+		 * which is also closer to when it happened than the time of
+		 * handling it. */
+		oring_clock_batch_init(&display->wakeup, &display->gfx_clock,
+				       NULL);
 
 		/* Wayland events only read in the callback, not dispatched,
 		 * if the Wayland socket signalled readable. If it signalled
 		 * writable, flush more. See display_handle_data().
 		 */
-		for (i = 0; i < count; i++) {
-			w = ee[i].data.ptr;
-			w->cb(w, ee[i].events);
+		mainloop_dispatch(display, ee, count, WATCH_PRIORITY_DISPLAY);
+		if (!display->must_read) {
+			ret = wl_display_dispatch_pending(dpy);
+			if (ret > 0)
+				stats->events += ret;
 		}
 
+		mainloop_dispatch(display, ee, count,
+				  WATCH_PRIORITY_COMPLETION);
+		mainloop_dispatch(display, ee, count, WATCH_PRIORITY_TIMER);
+
 		/* Match the prepare_read call in case the Wayland socket
 		 * did not need servicing.
 		 */
@@ -1150,6 +2850,7 @@ mainloop(struct display *display)
 	if (display->must_read)
 		wl_display_cancel_read(dpy);
 	display->must_read = false;
+	free(ee);
 
 	return myret;
 }
@@ -1159,26 +2860,109 @@ main(int argc, char **argv)
 {
 	struct sigaction sigint;
 	struct display *display;
-	struct window *window;
+	struct window *window, *tmp;
 	struct output *output;
+	int window_count = 1;
+	int buffer_count = 0;
 	bool fullscreen = false;
 	bool opaque = false;
-	int swapinterval = 1;
-	int buffer_bits = 32;
+	int swapinterval = 0;
+	enum render_format format = RENDER_FORMAT_XRGB8888;
+	bool late_repaint = false;
+	int vrr_min_hz = 40;
+	int frames_in_flight = 1;
+	bool show_stats = false;
+	bool degrade = false;
+	const char *trace_path = NULL;
+	double bench_seconds = 0.0;
+	const char *bench_path = "oring-cal-bench.json";
+	int ret = EXIT_SUCCESS;
 	struct geometry winsize = { 250, 250 };
+	struct scene_options scene_opts = { 1, 0, 0 };
+	struct realtime_options realtime;
 	int i;
 
 	printf(TITLE "\n");
 
+	realtime_options_init(&realtime);
+
 	for (i = 1; i < argc; i++) {
 		if (strcmp("-f", argv[i]) == 0)
 			fullscreen = true;
 		else if (strcmp("-o", argv[i]) == 0)
 			opaque = true;
 		else if (strcmp("-s", argv[i]) == 0)
-			buffer_bits = 16;
+			format = RENDER_FORMAT_RGB565;
+		else if (strcmp("-F", argv[i]) == 0 && i + 1 < argc) {
+			if (render_format_parse(argv[++i], &format) < 0)
+				usage(EXIT_FAILURE);
+		}
 		else if (strcmp("-b", argv[i]) == 0)
 			swapinterval = 0;
+		else if (strcmp("-B", argv[i]) == 0)
+			swapinterval = 1;
+		else if (strcmp("-l", argv[i]) == 0)
+			late_repaint = true;
+		else if (strcmp("-g", argv[i]) == 0)
+			show_stats = true;
+		else if (strcmp("-q", argv[i]) == 0)
+			degrade = true;
+		else if (strcmp("-t", argv[i]) == 0 && i + 1 < argc)
+			trace_path = argv[++i];
+		else if (strcmp("-n", argv[i]) == 0 && i + 1 < argc) {
+			frames_in_flight = atoi(argv[++i]);
+			if (frames_in_flight < 1 ||
+			    frames_in_flight > MAX_FRAMES_IN_FLIGHT)
+				usage(EXIT_FAILURE);
+		}
+		else if (strcmp("-i", argv[i]) == 0 && i + 1 < argc) {
+			scene_opts.instances = atoi(argv[++i]);
+			if (scene_opts.instances < 1)
+				usage(EXIT_FAILURE);
+		}
+		else if (strcmp("-c", argv[i]) == 0 && i + 1 < argc) {
+			scene_opts.fragment_cost = atoi(argv[++i]);
+			if (scene_opts.fragment_cost < 0)
+				usage(EXIT_FAILURE);
+		}
+		else if (strcmp("-d", argv[i]) == 0 && i + 1 < argc) {
+			scene_opts.overdraw = atoi(argv[++i]);
+			if (scene_opts.overdraw < 0)
+				usage(EXIT_FAILURE);
+		}
+		else if (strcmp("-w", argv[i]) == 0 && i + 1 < argc) {
+			window_count = atoi(argv[++i]);
+			if (window_count < 1 || window_count > MAX_WINDOWS)
+				usage(EXIT_FAILURE);
+		}
+		else if (strcmp("-D", argv[i]) == 0 && i + 1 < argc) {
+			buffer_count = atoi(argv[++i]);
+			if (buffer_count < 2 ||
+			    buffer_count > RENDERER_MAX_BUFFERS)
+				usage(EXIT_FAILURE);
+		}
+		else if (strcmp("-v", argv[i]) == 0 && i + 1 < argc) {
+			vrr_min_hz = atoi(argv[++i]);
+			if (vrr_min_hz < 0)
+				usage(EXIT_FAILURE);
+		}
+		else if (strcmp("-r", argv[i]) == 0 && i + 1 < argc) {
+			if (realtime_parse_policy(&realtime, argv[++i]) < 0)
+				usage(EXIT_FAILURE);
+		}
+		else if (strcmp("-a", argv[i]) == 0 && i + 1 < argc) {
+			if (realtime_parse_cpus(&realtime, argv[++i]) < 0)
+				usage(EXIT_FAILURE);
+		}
+		else if (strcmp("-m", argv[i]) == 0)
+			realtime.lock_memory = true;
+		else if (strncmp("--bench=", argv[i], 8) == 0) {
+			bench_seconds = atof(argv[i] + 8);
+			if (!isfinite(bench_seconds) || !(bench_seconds > 0.0))
+				usage(EXIT_FAILURE);
+		}
+		else if (strncmp("--bench-report=", argv[i], 15) == 0)
+			bench_path = argv[i] + 15;
 		else if (strcmp("-h", argv[i]) == 0)
 			usage(EXIT_SUCCESS);
 		else
@@ -1186,7 +2970,21 @@ main(int argc, char **argv)
 	}
 
 	display = display_connect();
-	display->render_display = renderer_display_create(display->display);
+	display->late_repaint = late_repaint;
+	display->realtime = realtime;
+	if (bench_seconds > 0.0)
+		display->bench_path = bench_path;
+	if (vrr_min_hz > 0)
+		display->vrr_max_period = 1e9 / vrr_min_hz;
+	display->render_display =
+		renderer_display_create(display->display,
+					scene_opts.fragment_cost);
+	display_bind_globals(display);
+	if (trace_path) {
+		display->trace = trace_create(trace_path, display->clock_id);
+		display->trace_main = trace_buffer_create(display->trace, "main",
+			oring_clock_get_nsec_now(&display->gfx_clock));
+	}
 
 	output = display_choose_output(display);
 	if (!output) {
@@ -1195,38 +2993,102 @@ main(int argc, char **argv)
 	}
 	printf("chose output-%d\n", output->name);
 
-	window = window_create(display, &winsize, opaque, fullscreen);
-	display->window = window;
+	renderer_display_wait(display->render_display);
 
-	window->render_window =
-		renderer_window_create(display->render_display,
-				       window->surface,
-				       winsize.width,
-				       winsize.height,
-				       !opaque,
-				       buffer_bits,
-				       swapinterval);
+	if (!display->wm_base && !display->shell) {
+		fprintf(stderr, "Error: neither xdg_wm_base nor wl_shell "
+			"available.\n");
+		exit(1);
+	}
 
-	shell_surface_set_state(window);
+	if (buffer_count > 0 && !display->dmabuf) {
+		fprintf(stderr, "Error: zwp_linux_dmabuf_v1 version 2 "
+			"unavailable.\n");
+		exit(1);
+	}
+	if (display->bench_path && !display->presentation) {
+		fprintf(stderr, "Error: benchmarking needs wp_presentation.\n");
+		exit(1);
+	}
 
-	init_gl(window);
+	if (buffer_count > 0 && !display->explicit_sync)
+		fprintf(stderr, "Warning: explicit sync unavailable, "
+			"relying on implicit sync.\n");
+
+	for (i = 0; i < window_count; i++) {
+		window = window_create(display, &winsize, opaque, fullscreen);
+		window->queue.depth = frames_in_flight;
+		window->scene = scene_create(&scene_opts);
+		window->show_stats = show_stats;
+		window_init_pacing(window, degrade);
+
+		window->render_window =
+			renderer_window_create(display->render_display,
+					       window->surface,
+					       winsize.width,
+					       winsize.height,
+					       !window->opaque,
+					       format,
+					       swapinterval,
+					       buffer_count);
+
+		/* An EGL window surface may use a FIFO of its own. */
+		if (buffer_count > 0 && display->fifo_manager)
+			window->fifo = wp_fifo_manager_v1_get_fifo(
+					display->fifo_manager, window->surface);
+
+		shell_surface_set_state(window);
+
+		window_start_render_thread(window);
+	}
 
 	sigint.sa_handler = signal_int;
 	sigemptyset(&sigint.sa_mask);
 	sigint.sa_flags = SA_RESETHAND;
 	sigaction(SIGINT, &sigint, NULL);
 
-	window_schedule_repaint(window, 0);
+	/* xdg-shell windows start at their first configure instead */
+	wl_list_for_each(window, &display->window_list, link) {
+		if (window->configured)
+			window_schedule_repaint(window, 0);
+	}
+
+	/* Only now, so that no helper thread inherits any of it. */
+	realtime_setup_thread(&display->realtime, 0, "event", &display->sched);
+	realtime_lock_memory(&display->realtime);
+
+	if (display->bench_path)
+		display_start_bench(display, bench_seconds);
+
 	mainloop(display);
 
 	fprintf(stderr, TITLE " exiting\n");
 
-	renderer_window_destroy(window->render_window);
-	free(window->render_state); /* XXX */
-	window_destroy(window);
+	if (display->bench_path) {
+		if (display_write_bench_report(display) < 0)
+			ret = EXIT_FAILURE;
+		timer_watch_remove(&display->bench_timer);
+	}
+
+	i = 0;
+	wl_list_for_each_safe(window, tmp, &display->window_list, link) {
+		window_stop_render_thread(window);
+		if (window_count > 1)
+			printf("window %d:\n", i++);
+		window_print_stats(window);
+
+		renderer_window_destroy(window->render_window);
+		free(window->render_state); /* XXX */
+		scene_destroy(window->scene);
+		window_destroy(window);
+	}
+	display_print_loop_stats(display);
+	display_print_sched_stats(display);
+	trace_destroy(display->trace);
 
 	renderer_display_destroy(display->render_display);
+	display_print_pool_stats(display);
 	display_destroy(display);
 
-	return 0;
+	return ret;
 }
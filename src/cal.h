@@ -32,11 +32,22 @@
 
 #include "oring-clock.h"
 #include "output.h"
+#include "predictor.h"
+#include "repaint-scheduler.h"
+#include "pool.h"
+#include "input-queue.h"
+#include "frame-stats.h"
+#include "trace.h"
+#include "realtime.h"
 
 #include "presentation-time-client-protocol.h"
 
 #define INVALID_CLOCK_ID 9999
-#define INVALID_TIME 0xffffffffffffffffULL
+
+/* Maximum frames in flight, see window::queue */
+#define MAX_FRAMES_IN_FLIGHT 4
+#define SUBMISSION_QUEUE_SIZE 8
+#define MAX_WINDOWS 8
 
 struct display;
 struct window;
@@ -44,75 +55,256 @@ struct seat;
 struct renderer_display;
 struct renderer_window;
 struct renderer_state;
+struct render_thread;
+struct soak_stats;
+struct zwp_relative_pointer_manager_v1;
+struct zwp_linux_dmabuf_v1;
+struct xdg_wm_base;
+struct xdg_surface;
+struct xdg_toplevel;
+struct zwp_linux_explicit_synchronization_v1;
+
+/** In which order the main loop handles ready fds, see mainloop() */
+enum watch_priority {
+	WATCH_PRIORITY_DISPLAY, /* presentation feedback and input */
+	WATCH_PRIORITY_COMPLETION, /* render threads and fences */
+	WATCH_PRIORITY_TIMER, /* deadlines that start rendering */
+	WATCH_PRIORITY_COUNT
+};
+
+struct watch {
+	struct display *display;
+	int fd;
+	enum watch_priority priority;
+	void (*cb)(struct watch *w, uint32_t events);
+};
+
+/** Main loop counters, for checking wakeups per frame
+ *
+ * Syscalls are counted approximately: every epoll_wait and flush, and
+ * one for each fd handled.
+ */
+struct loop_stats {
+	uint64_t iterations;
+	uint64_t wakeups; /* epoll_wait returning anything */
+	uint64_t syscalls;
+	uint64_t events; /* Wayland events dispatched */
+	uint64_t frames; /* submissions started */
+};
+
+/** A deadline wakeup in the main loop, see timer_watch_set()
+ *
+ * Deadlines are absolute display::gfx_clock nanoseconds. If timerfd does
+ * not support the presentation clock, the timer runs on CLOCK_MONOTONIC
+ * and each deadline is converted through the offset between the clocks.
+ */
+struct timer_watch {
+	struct watch watch;
+	clockid_t clock_id; /* of the timerfd */
+	uint64_t armed; /* deadline, or INVALID_TIME */
+	void (*cb)(struct timer_watch *tw, uint64_t deadline);
+};
+
+/* Maximum input events handed to the scene with one submission */
+#define SUBMISSION_INPUT_MAX 64
 
 struct submission {
 	struct window *window;
+	uint64_t id; /* for the trace, counts up from 1 */
 
+	uint64_t render_start_time;
 	uint64_t commit_time;
 	uint64_t target_time;
 
+	/* the commit must not be shown before this, see submission_create() */
+	bool timed;
+	struct timespec not_before; /* presentation clock */
+
+	bool in_flight; /* occupies a pipeline slot */
+	bool committed; /* render thread is done with it */
+	bool finished; /* no more feedback to come */
+	bool complete; /* all timings are in, see submission_complete() */
+
+	/* GPU timestamps, INVALID_TIME if not known */
+	bool gpu_pending; /* waiting for the render thread to send them */
+	uint64_t gpu_start_time;
+	uint64_t gpu_end_time;
+
+	/* native fence of the rendering, fd -1 when not waiting on it */
+	struct watch fence;
+	uint64_t fence_time; /* when the fence was seen signalled */
+
 	struct wl_callback *frame;
 	uint64_t frame_time;
 
 	struct wp_presentation_feedback *feedback;
 	uint64_t presented_time;
 	uint64_t next_nsec;
+	uint64_t seq;
 
 	struct output *sync_output;
+
+	int level; /* struct frame_pacer quality level to draw with */
+
+	/* input since the previous submission, in timestamp order */
+	struct timed_input input[SUBMISSION_INPUT_MAX];
+	unsigned input_count;
+
+	/* pointer predicted for target_time, surface coordinates */
+	bool pointer_valid;
+	float pointer_x, pointer_y;
 };
 
-struct watch {
-	struct display *display;
-	int fd;
-	void (*cb)(struct watch *w, uint32_t events);
+/** Fixed capacity ring of submissions, oldest first */
+struct submission_queue {
+	struct submission *subm[SUBMISSION_QUEUE_SIZE];
+	unsigned head;
+	unsigned count;
+
+	unsigned depth; /* maximum frames in flight */
+};
+
+/** A format and modifier pair the compositor accepts in a dmabuf
+ *
+ * The modifier is DRM_FORMAT_MOD_INVALID if the compositor did not say,
+ * meaning it is implied by the buffer.
+ */
+struct dmabuf_modifier {
+	uint32_t format;
+	uint64_t modifier;
 };
 
 struct display {
 	struct wl_display *display;
 	struct wl_registry *registry;
 	struct wl_compositor *compositor;
-	struct wl_shell *shell;
+	struct wl_shell *shell; /* used only without wm_base */
+	struct xdg_wm_base *wm_base;
 
 	int epoll_fd;
+	unsigned watch_count; /* fds in epoll_fd */
 
 	struct watch display_watch;
 	bool must_read;
+	struct loop_stats loop_stats;
 
 	struct wp_presentation *presentation;
+	struct zwp_relative_pointer_manager_v1 *relative_pointer_manager;
+	struct wp_viewporter *viewporter;
+	struct zwp_linux_dmabuf_v1 *dmabuf; /* version 2 or later */
+	struct wl_array dmabuf_modifiers; /* struct dmabuf_modifier */
+	struct zwp_linux_explicit_synchronization_v1 *explicit_sync;
+	struct wp_fifo_manager_v1 *fifo_manager;
+	struct wp_commit_timing_manager_v1 *commit_timing;
 	clockid_t clock_id;
 	uint32_t warned_flags;
 	struct oring_clock gfx_clock;
+	struct oring_clock_batch wakeup; /* taken when mainloop() woke up */
+	bool late_repaint;
+	struct realtime_options realtime;
+	struct realtime_status sched; /* of the event thread */
+	double vrr_max_period; /* nanoseconds, zero disables VRR pacing */
+	struct pool submission_pool;
 	struct renderer_display *render_display;
+	struct trace *trace; /* NULL if not tracing */
+	struct trace_buffer *trace_main; /* main thread records */
+
+	struct timespec start_time; /* CLOCK_MONOTONIC */
+	bool first_presented;
+
+	/* soak run, see display_start_bench() */
+	const char *bench_path; /* report file, NULL if not benchmarking */
+	struct timer_watch bench_timer; /* ends the run */
+	uint64_t bench_start;
 
 	struct wl_shm *shm;
+	bool cursor_loaded; /* see display_get_default_cursor() */
 	struct wl_cursor_theme *cursor_theme;
 	struct wl_cursor *default_cursor;
 	struct wl_surface *cursor_surface;
 
-	struct window *window;
+	struct wl_list window_list; /* struct window::link */
+	struct wl_list scheduler_list; /* struct output_scheduler::link */
 
 	struct wl_list output_list; /* struct output::link */
 	struct wl_list seat_list; /* struct seat::link */
 };
 
+/** Late repaint timer shared by the windows synced to one output
+ *
+ * Windows aiming at the same vblank of the output are started with one
+ * wakeup, so that they render together and their commits go out with
+ * the same flush instead of each waking up the process on its own.
+ */
+struct output_scheduler {
+	struct display *display;
+	struct output *output; /* referenced, NULL if not synced to any */
+	struct wl_list link; /* struct display::scheduler_list */
+
+	struct timer_watch timer; /* armed for the earliest start */
+
+	/* how late the timer woke us up, see output_scheduler_handle_timer() */
+	uint64_t wakeups;
+	double late_sum;
+	double late_max;
+};
+
 struct geometry {
 	int width, height;
 };
 
+/** The latest configure from the shell, see window_take_configure()
+ *
+ * Configures are only recorded when they arrive, and the newest one is
+ * applied when the next frame is submitted, so a burst of them during
+ * an interactive resize costs one resize per frame at most.
+ */
+struct window_configure {
+	bool pending;
+	struct geometry size; /* 0x0 lets us choose */
+	uint32_t serial; /* of the xdg_surface.configure to ack */
+};
+
 struct window {
 	struct display *display;
+	struct wl_list link; /* struct display::window_list */
 	struct geometry geometry, window_size;
 
 	struct renderer_window *render_window;
 	struct renderer_state *render_state;
+	struct render_thread *render_thread;
+	struct realtime_status render_sched; /* set by the render thread */
+	struct scene *scene;
 
-	uint32_t benchmark_time, frames;
+	struct input_queue input; /* see display_dispatch_input() */
+
+	struct frame_stats stats;
+	struct soak_stats *soak; /* NULL if not benchmarking */
+	bool show_stats; /* draw the timing graphs */
 	struct wl_surface *surface;
-	struct wl_shell_surface *shsurf;
+	struct wl_shell_surface *shsurf; /* or the xdg ones */
+	struct xdg_surface *xdg_surface;
+	struct xdg_toplevel *xdg_toplevel;
+	struct window_configure configure;
+	bool configured; /* an xdg configure was seen, may attach buffers */
+	struct wp_viewport *viewport; /* only if degrading is allowed */
 
 	uint64_t target_time;
-	struct submission *prev_sub;
-	struct submission *cur_sub;
+	struct predictor predictor;
+	uint32_t predictor_output; /* output::name the history is from */
+	struct output_scheduler *scheduler; /* of the latest sync output */
+	uint64_t timer_target; /* late repaint target, or INVALID_TIME */
+	uint64_t timer_start; /* when to start rendering for timer_target */
+	struct repaint_offset repaint_offset;
+	struct cost_estimate render_cost;
+	struct frame_pacer pacer;
+	struct vrr_detector vrr;
+	uint64_t presented_time; /* latest presentation, or INVALID_TIME */
+	struct wp_fifo_v1 *fifo; /* only with our own dmabuf swapchain */
+	struct wp_commit_timer_v1 *commit_timer;
+	struct submission_queue queue;
+	uint64_t submission_count;
+	struct watch render_done;
 
 	bool fullscreen;
 	bool opaque;
@@ -129,17 +321,21 @@ struct window *
 window_from_wl_surface(struct wl_surface *surface);
 
 void
-window_add_submission(struct window *window, struct submission *subm);
-
-struct submission *
-submission_create(struct window *window, uint64_t target_time);
+submission_request_feedback(struct submission *subm, struct render_thread *rt);
 
-void
-submission_set_commit_time(struct submission *subm);
+struct wl_cursor *
+display_get_default_cursor(struct display *d);
 
 extern int running;
 
 void
 shell_surface_set_state(struct window *window);
 
+void
+shell_surface_move(struct window *window, struct wl_seat *seat,
+		   uint32_t serial);
+
+bool
+window_take_configure(struct window *window, uint32_t *serial);
+
 #endif /* ORING_CAL_H */
@@ -0,0 +1,101 @@
+/*
+ * Copyright © 2016 Pekka Paalanen <pq@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <stdint.h>
+
+#include "damage.h"
+
+static int64_t
+box_area(const struct box *b)
+{
+	return (int64_t)(b->x2 - b->x1) * (b->y2 - b->y1);
+}
+
+static void
+damage_remove(struct damage *d, int i)
+{
+	d->rects[i] = d->rects[--d->count];
+}
+
+/** Add a rectangle to the damage
+ *
+ * \param d The damage.
+ * \param box The rectangle, may be empty.
+ */
+void
+damage_add_box(struct damage *d, const struct box *box)
+{
+	struct box b = *box;
+	struct box u;
+	int64_t cost, best_cost;
+	int best;
+	int i;
+
+	if (box_is_empty(&b))
+		return;
+
+again:
+	/* Growing b may make it overlap rectangles it did not before. */
+	for (i = 0; i < d->count; i++) {
+		if (!box_intersects(&d->rects[i], &b))
+			continue;
+
+		box_union(&b, &d->rects[i]);
+		damage_remove(d, i);
+		goto again;
+	}
+
+	if (d->count < DAMAGE_MAX_RECTS) {
+		d->rects[d->count++] = b;
+		return;
+	}
+
+	best = 0;
+	best_cost = INT64_MAX;
+	for (i = 0; i < d->count; i++) {
+		u = b;
+		box_union(&u, &d->rects[i]);
+		cost = box_area(&u) - box_area(&d->rects[i]) - box_area(&b);
+		if (cost < best_cost) {
+			best_cost = cost;
+			best = i;
+		}
+	}
+
+	box_union(&b, &d->rects[best]);
+	damage_remove(d, best);
+	goto again;
+}
+
+/** Add all of another damage to the damage */
+void
+damage_add(struct damage *d, const struct damage *other)
+{
+	int i;
+
+	for (i = 0; i < other->count; i++)
+		damage_add_box(d, &other->rects[i]);
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright © 2016 Pekka Paalanen <pq@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef ORING_DAMAGE_H
+#define ORING_DAMAGE_H
+
+#include <stdbool.h>
+
+#include "helpers.h"
+
+/* More damage rectangles than this get merged together */
+#define DAMAGE_MAX_RECTS 8
+
+/** A rectangle in buffer coordinates, y down, x2 and y2 exclusive */
+struct box {
+	int x1, y1;
+	int x2, y2;
+};
+
+/** A short list of disjoint rectangles
+ *
+ * Adding a rectangle merges it with the ones it overlaps, and when the
+ * list is full, with the one it grows the least. The list covers at
+ * least what was added, possibly more.
+ */
+struct damage {
+	int count;
+	struct box rects[DAMAGE_MAX_RECTS];
+};
+
+static inline bool
+box_is_empty(const struct box *b)
+{
+	return b->x1 >= b->x2 || b->y1 >= b->y2;
+}
+
+static inline bool
+box_intersects(const struct box *a, const struct box *b)
+{
+	return a->x1 < b->x2 && b->x1 < a->x2 &&
+	       a->y1 < b->y2 && b->y1 < a->y2;
+}
+
+static inline void
+box_union(struct box *dst, const struct box *b)
+{
+	dst->x1 = MIN(dst->x1, b->x1);
+	dst->y1 = MIN(dst->y1, b->y1);
+	dst->x2 = MAX(dst->x2, b->x2);
+	dst->y2 = MAX(dst->y2, b->y2);
+}
+
+static inline void
+box_clip(struct box *dst, int width, int height)
+{
+	dst->x1 = MAX(dst->x1, 0);
+	dst->y1 = MAX(dst->y1, 0);
+	dst->x2 = MIN(dst->x2, width);
+	dst->y2 = MIN(dst->y2, height);
+}
+
+static inline void
+damage_init(struct damage *d)
+{
+	d->count = 0;
+}
+
+void
+damage_add_box(struct damage *d, const struct box *box);
+
+void
+damage_add(struct damage *d, const struct damage *other);
+
+#endif /* ORING_DAMAGE_H */
@@ -0,0 +1,139 @@
+/*
+ * Copyright © 2016 Pekka Paalanen <pq@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <string.h>
+#include <math.h>
+
+#include "frame-stats.h"
+
+#define FRAME_STATS_RING_SIZE 64
+
+void
+frame_stats_init(struct frame_stats *stats)
+{
+	unsigned i;
+
+	memset(stats, 0, sizeof *stats);
+	spsc_ring_init(&stats->ring, sizeof(struct frame_stats_sample),
+		       FRAME_STATS_RING_SIZE);
+
+	for (i = 0; i < FRAME_STAT_COUNT; i++) {
+		stats->summary[i].min = INFINITY;
+		stats->summary[i].max = -INFINITY;
+	}
+}
+
+void
+frame_stats_release(struct frame_stats *stats)
+{
+	spsc_ring_release(&stats->ring);
+}
+
+/** Record the timings of a presented submission
+ *
+ * \param stats The statistics.
+ * \param sample The timings, copied.
+ *
+ * Called in the main thread. Never blocks or prints; if the render
+ * thread has not taken the previous samples, this one is only counted
+ * in the summary.
+ */
+void
+frame_stats_record(struct frame_stats *stats,
+		   const struct frame_stats_sample *sample)
+{
+	struct frame_stats_summary *sum;
+	double v;
+	unsigned i;
+
+	stats->presented++;
+	if (sample->value[FRAME_STAT_TARGET_ERROR] >= sample->period / 2.0)
+		stats->missed++;
+
+	for (i = 0; i < FRAME_STAT_COUNT; i++) {
+		v = sample->value[i];
+		if (isnan(v))
+			continue;
+
+		sum = &stats->summary[i];
+		sum->count++;
+		sum->sum += v;
+		sum->min = fmin(sum->min, v);
+		sum->max = fmax(sum->max, v);
+	}
+
+	if (!spsc_ring_push(&stats->ring, sample))
+		stats->lost++;
+}
+
+/** Count a submission that was never presented */
+void
+frame_stats_record_discarded(struct frame_stats *stats)
+{
+	stats->discarded++;
+}
+
+/** Move new samples into the history
+ *
+ * \param stats The statistics.
+ *
+ * Called in the render thread before drawing the history.
+ */
+void
+frame_stats_drain(struct frame_stats *stats)
+{
+	struct frame_stats_sample *slot;
+
+	for (;;) {
+		slot = &stats->history[stats->history_next];
+		if (!spsc_ring_pop(&stats->ring, slot))
+			break;
+
+		stats->history_next = (stats->history_next + 1) %
+				      FRAME_STATS_HISTORY;
+		if (stats->history_count < FRAME_STATS_HISTORY)
+			stats->history_count++;
+	}
+}
+
+/** Get a sample from the history
+ *
+ * \param stats The statistics.
+ * \param i Index from 0 for the oldest to history_count - 1 for the newest.
+ * \return The sample.
+ *
+ * Called in the render thread.
+ */
+const struct frame_stats_sample *
+frame_stats_get_history(const struct frame_stats *stats, unsigned i)
+{
+	unsigned oldest;
+
+	oldest = (stats->history_next + FRAME_STATS_HISTORY -
+		  stats->history_count) % FRAME_STATS_HISTORY;
+
+	return &stats->history[(oldest + i) % FRAME_STATS_HISTORY];
+}
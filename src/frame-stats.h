@@ -0,0 +1,99 @@
+/*
+ * Copyright © 2016 Pekka Paalanen <pq@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef ORING_FRAME_STATS_H
+#define ORING_FRAME_STATS_H
+
+#include <stdint.h>
+
+#include "spsc-ring.h"
+
+enum frame_stat {
+	FRAME_STAT_LATENCY, /* commit to presentation */
+	FRAME_STAT_TARGET_ERROR, /* presentation minus target time */
+	FRAME_STAT_RENDER_CPU, /* render start to commit */
+	FRAME_STAT_RENDER_GPU, /* GPU execution time */
+	FRAME_STAT_COUNT
+};
+
+/** Timings of one presented submission, in nanoseconds
+ *
+ * A value is NAN if it is not known.
+ */
+struct frame_stats_sample {
+	uint64_t seq;
+	float period; /* refresh period at the time */
+	float value[FRAME_STAT_COUNT];
+};
+
+struct frame_stats_summary {
+	uint64_t count;
+	double sum;
+	double min, max;
+};
+
+#define FRAME_STATS_HISTORY 128
+
+/** Frame timing statistics
+ *
+ * The main thread records a sample for each presented submission and
+ * keeps the summary. The samples travel through a lock-free ring to the
+ * render thread, which keeps the recent history for drawing.
+ */
+struct frame_stats {
+	struct spsc_ring ring; /* struct frame_stats_sample */
+
+	/* main thread */
+	struct frame_stats_summary summary[FRAME_STAT_COUNT];
+	uint64_t presented;
+	uint64_t discarded;
+	uint64_t missed; /* presented half a period or more past the target */
+	uint64_t lost; /* ring was full */
+
+	/* render thread */
+	struct frame_stats_sample history[FRAME_STATS_HISTORY];
+	unsigned history_next;
+	unsigned history_count;
+};
+
+void
+frame_stats_init(struct frame_stats *stats);
+
+void
+frame_stats_release(struct frame_stats *stats);
+
+void
+frame_stats_record(struct frame_stats *stats,
+		   const struct frame_stats_sample *sample);
+
+void
+frame_stats_record_discarded(struct frame_stats *stats);
+
+void
+frame_stats_drain(struct frame_stats *stats);
+
+const struct frame_stats_sample *
+frame_stats_get_history(const struct frame_stats *stats, unsigned i);
+
+#endif /* ORING_FRAME_STATS_H */
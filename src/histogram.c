@@ -0,0 +1,204 @@
+/*
+ * Copyright © 2016 Pekka Paalanen <pq@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <stdbool.h>
+#include <inttypes.h>
+#include <math.h>
+
+#include "histogram.h"
+#include "helpers.h"
+#include "xalloc.h"
+
+#define SUB_COUNT (1 << HISTOGRAM_SUB_BITS)
+#define MAGNITUDE_MAX ((UINT64_C(1) << HISTOGRAM_MAX_BITS) - 1)
+
+/** Initialize a histogram to empty
+ *
+ * \param h The uninitialized histogram to overwrite.
+ */
+void
+histogram_init(struct histogram *h)
+{
+	h->count = 0;
+	h->min = INT64_MAX;
+	h->max = INT64_MIN;
+	h->sum = 0.0;
+	h->counts = xzalloc(2 * HISTOGRAM_BUCKETS * sizeof h->counts[0]);
+}
+
+void
+histogram_release(struct histogram *h)
+{
+	free(h->counts);
+	h->counts = NULL;
+}
+
+static unsigned
+magnitude_to_bucket(uint64_t m)
+{
+	unsigned shift;
+
+	if (m < SUB_COUNT)
+		return m;
+
+	shift = 63 - __builtin_clzll(m) - HISTOGRAM_SUB_BITS;
+
+	return ((shift + 1) << HISTOGRAM_SUB_BITS) + (m >> shift) - SUB_COUNT;
+}
+
+/* The middle of the bucket, which halves the worst case error. */
+static uint64_t
+bucket_to_magnitude(unsigned bucket)
+{
+	unsigned shift;
+	uint64_t low;
+
+	if (bucket < SUB_COUNT)
+		return bucket;
+
+	shift = (bucket >> HISTOGRAM_SUB_BITS) - 1;
+	low = (uint64_t)(bucket % SUB_COUNT + SUB_COUNT) << shift;
+
+	return low + ((UINT64_C(1) << shift) >> 1);
+}
+
+static unsigned
+value_to_slot(int64_t value)
+{
+	uint64_t m;
+
+	if (value >= 0) {
+		m = MIN((uint64_t)value, MAGNITUDE_MAX);
+		return HISTOGRAM_BUCKETS + magnitude_to_bucket(m);
+	}
+
+	/* -1 goes right below zero, so the slots stay in value order. */
+	m = MIN(-(uint64_t)value, MAGNITUDE_MAX);
+
+	return HISTOGRAM_BUCKETS - magnitude_to_bucket(m);
+}
+
+static int64_t
+slot_to_value(unsigned slot)
+{
+	if (slot >= HISTOGRAM_BUCKETS)
+		return bucket_to_magnitude(slot - HISTOGRAM_BUCKETS);
+
+	return -(int64_t)bucket_to_magnitude(HISTOGRAM_BUCKETS - slot);
+}
+
+/** Count one value
+ *
+ * \param h The histogram.
+ * \param value The value, clamped to the range of the buckets.
+ */
+void
+histogram_record(struct histogram *h, int64_t value)
+{
+	h->counts[value_to_slot(value)]++;
+	h->count++;
+	h->sum += value;
+	h->min = MIN(h->min, value);
+	h->max = MAX(h->max, value);
+}
+
+/** Get the value below or at which the given share of values are
+ *
+ * \param h The histogram.
+ * \param percentile From 0 to 100.
+ * \return The value, to the resolution of the buckets and within the
+ * exact minimum and maximum, or 0 if the histogram is empty.
+ */
+int64_t
+histogram_get_percentile(const struct histogram *h, double percentile)
+{
+	uint64_t rank;
+	uint64_t seen = 0;
+	unsigned slot;
+
+	if (h->count == 0)
+		return 0;
+
+	rank = (uint64_t)ceil(percentile / 100.0 * h->count);
+	rank = MAX(rank, 1);
+
+	for (slot = 0; slot < 2 * HISTOGRAM_BUCKETS; slot++) {
+		seen += h->counts[slot];
+		if (seen >= rank)
+			break;
+	}
+
+	if (slot == 2 * HISTOGRAM_BUCKETS)
+		return h->max;
+
+	return MAX(MIN(slot_to_value(slot), h->max), h->min);
+}
+
+/** Write a histogram as a JSON object
+ *
+ * \param h The histogram.
+ * \param fp The stream to write to.
+ *
+ * The object has the count, the exact minimum, maximum and mean, the
+ * usual percentiles, and the non-empty buckets as [value, count] pairs
+ * in value order, so that other percentiles can be computed later.
+ */
+void
+histogram_write_json(const struct histogram *h, FILE *fp)
+{
+	static const struct {
+		const char *name;
+		double percentile;
+	} ps[] = {
+		{ "p50", 50.0 },
+		{ "p90", 90.0 },
+		{ "p99", 99.0 },
+		{ "p99.9", 99.9 },
+		{ "p99.99", 99.99 },
+	};
+	bool first = true;
+	unsigned i;
+
+	fprintf(fp, "{\"count\":%" PRIu64, h->count);
+	if (h->count > 0) {
+		fprintf(fp, ",\"min\":%" PRId64 ",\"max\":%" PRId64
+			",\"mean\":%.1f", h->min, h->max, h->sum / h->count);
+		for (i = 0; i < ARRAY_LENGTH(ps); i++)
+			fprintf(fp, ",\"%s\":%" PRId64, ps[i].name,
+				histogram_get_percentile(h, ps[i].percentile));
+	}
+
+	fprintf(fp, ",\"buckets\":[");
+	for (i = 0; i < 2 * HISTOGRAM_BUCKETS; i++) {
+		if (h->counts[i] == 0)
+			continue;
+
+		fprintf(fp, "%s[%" PRId64 ",%" PRIu64 "]", first ? "" : ",",
+			slot_to_value(i), h->counts[i]);
+		first = false;
+	}
+	fprintf(fp, "]}");
+}
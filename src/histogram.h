@@ -0,0 +1,70 @@
+/*
+ * Copyright © 2016 Pekka Paalanen <pq@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef ORING_HISTOGRAM_H
+#define ORING_HISTOGRAM_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Sub-buckets per power of two, giving a resolution of 1/64 */
+#define HISTOGRAM_SUB_BITS 6
+/* Magnitudes are clamped below 2^HISTOGRAM_MAX_BITS, about 18 minutes
+ * in nanoseconds */
+#define HISTOGRAM_MAX_BITS 40
+#define HISTOGRAM_BUCKETS \
+	((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS)
+
+/** Log-linear histogram of signed integers, like HdrHistogram
+ *
+ * Values below 64 in magnitude are counted exactly, larger ones in
+ * buckets of 1/64 of their power of two, so the relative error stays
+ * below 1.6 % over the whole range at a fixed size. Negative values
+ * have buckets of their own.
+ */
+struct histogram {
+	uint64_t count;
+	int64_t min, max; /* exact */
+	double sum;
+
+	/* negative values below HISTOGRAM_BUCKETS, the rest above */
+	uint64_t *counts;
+};
+
+void
+histogram_init(struct histogram *h);
+
+void
+histogram_release(struct histogram *h);
+
+void
+histogram_record(struct histogram *h, int64_t value);
+
+int64_t
+histogram_get_percentile(const struct histogram *h, double percentile);
+
+void
+histogram_write_json(const struct histogram *h, FILE *fp);
+
+#endif /* ORING_HISTOGRAM_H */
@@ -0,0 +1,274 @@
+/*
+ * Copyright © 2016 Pekka Paalanen <pq@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <string.h>
+#include <assert.h>
+
+#include "input-queue.h"
+#include "oring-clock.h"
+#include "helpers.h"
+
+/* A receive delay this much above the estimate means the input clock
+ * was changed, and the mapping starts over.
+ */
+#define INPUT_TIMEBASE_RESET_NSEC 1000000000LL
+
+/* How much the offset estimate may grow per event, to follow drift
+ * between the input clock and gfx_clock.
+ */
+#define INPUT_TIMEBASE_DRIFT_NSEC 1000LL
+
+/* Motion older than this, relative to the newest, is not used for
+ * the velocity.
+ */
+#define POINTER_VELOCITY_WINDOW_NSEC 50000000.0
+
+/* The furthest the pointer is extrapolated. */
+#define POINTER_HORIZON_NSEC 50000000.0
+
+/* Without motion for this long, the pointer is considered stopped. */
+#define POINTER_STOPPED_NSEC 100000000.0
+
+void
+input_queue_init(struct input_queue *q)
+{
+	memset(q, 0, sizeof *q);
+}
+
+static struct timed_input *
+input_queue_at(struct input_queue *q, unsigned i)
+{
+	return &q->events[(q->head + i) % INPUT_QUEUE_SIZE];
+}
+
+/** Add an event to the queue
+ *
+ * \param q The queue.
+ * \param ev The event, copied.
+ *
+ * The time is clamped to not go backwards from the newest event, as the
+ * timestamps of different event sources are mapped independently.
+ */
+void
+input_queue_push(struct input_queue *q, const struct timed_input *ev)
+{
+	struct timed_input *newest = NULL;
+	struct timed_input *slot;
+
+	if (q->count > 0)
+		newest = input_queue_at(q, q->count - 1);
+
+	if (q->count == INPUT_QUEUE_SIZE) {
+		q->dropped++;
+
+		if (ev->type == INPUT_EVENT_MOTION &&
+		    newest->type == INPUT_EVENT_MOTION) {
+			newest->time = MAX(newest->time, ev->time);
+			newest->x = ev->x;
+			newest->y = ev->y;
+			newest->dx += ev->dx;
+			newest->dy += ev->dy;
+			return;
+		}
+
+		input_queue_pop(q);
+	}
+
+	slot = input_queue_at(q, q->count);
+	*slot = *ev;
+	if (newest && slot->time < newest->time)
+		slot->time = newest->time;
+	q->count++;
+}
+
+/** Get the oldest event without removing it
+ *
+ * \return The event, or NULL if the queue is empty.
+ */
+const struct timed_input *
+input_queue_peek(const struct input_queue *q)
+{
+	if (q->count == 0)
+		return NULL;
+
+	return &q->events[q->head];
+}
+
+void
+input_queue_pop(struct input_queue *q)
+{
+	assert(q->count > 0);
+
+	q->head = (q->head + 1) % INPUT_QUEUE_SIZE;
+	q->count--;
+}
+
+void
+input_timebase_init(struct input_timebase *tb)
+{
+	memset(tb, 0, sizeof *tb);
+}
+
+static uint64_t
+input_timebase_map(struct input_timebase *tb, uint64_t raw, uint64_t now)
+{
+	int64_t delay = (int64_t)(now - raw);
+
+	if (!tb->valid || delay < tb->offset ||
+	    delay - tb->offset > INPUT_TIMEBASE_RESET_NSEC) {
+		tb->offset = delay;
+		tb->valid = true;
+	} else {
+		tb->offset += MIN(delay - tb->offset,
+				  INPUT_TIMEBASE_DRIFT_NSEC);
+	}
+
+	return raw + tb->offset;
+}
+
+/** Map a protocol millisecond timestamp to gfx_clock
+ *
+ * \param tb The timebase of the event source.
+ * \param msec The 32-bit millisecond timestamp, may wrap around.
+ * \param now The gfx_clock time the event was received.
+ * \return The event time in gfx_clock nanoseconds.
+ */
+uint64_t
+input_timebase_map_msec(struct input_timebase *tb, uint32_t msec,
+			uint64_t now)
+{
+	if (!tb->valid)
+		tb->msec = msec;
+	else
+		tb->msec += (int32_t)(msec - tb->last_msec);
+	tb->last_msec = msec;
+
+	return input_timebase_map(tb, tb->msec * 1000000ULL, now);
+}
+
+/** Map a microsecond timestamp to gfx_clock
+ *
+ * \param tb The timebase of the event source.
+ * \param usec The 64-bit microsecond timestamp.
+ * \param now The gfx_clock time the event was received.
+ * \return The event time in gfx_clock nanoseconds.
+ */
+uint64_t
+input_timebase_map_usec(struct input_timebase *tb, uint64_t usec,
+			uint64_t now)
+{
+	return input_timebase_map(tb, usec * 1000ULL, now);
+}
+
+void
+pointer_predictor_reset(struct pointer_predictor *pp)
+{
+	memset(pp, 0, sizeof *pp);
+}
+
+/** Record a pointer position
+ *
+ * \param pp The predictor.
+ * \param time The gfx_clock time of the position.
+ * \param x Position in surface coordinates.
+ * \param y Position in surface coordinates.
+ */
+void
+pointer_predictor_add(struct pointer_predictor *pp, uint64_t time,
+		      float x, float y)
+{
+	pp->samples[pp->next].time = time;
+	pp->samples[pp->next].x = x;
+	pp->samples[pp->next].y = y;
+	pp->next = (pp->next + 1) % POINTER_PREDICTOR_SAMPLES;
+	if (pp->count < POINTER_PREDICTOR_SAMPLES)
+		pp->count++;
+}
+
+/** Predict the pointer position at a time
+ *
+ * \param pp The predictor.
+ * \param target The gfx_clock time to predict for.
+ * \param x Return the position in surface coordinates.
+ * \param y Return the position in surface coordinates.
+ * \return False if there is no position to predict from.
+ *
+ * The velocity is a least-squares fit over the recent samples. The
+ * extrapolation is limited to a short horizon, and a pointer that has
+ * not moved lately is assumed to stay put.
+ */
+bool
+pointer_predictor_predict(const struct pointer_predictor *pp,
+			  uint64_t target, float *x, float *y)
+{
+	unsigned newest;
+	unsigned i, k;
+	double t, horizon;
+	double st = 0.0, sx = 0.0, sy = 0.0;
+	double stt = 0.0, stx = 0.0, sty = 0.0;
+	double n = 0.0;
+	double den;
+
+	if (pp->count == 0)
+		return false;
+
+	newest = (pp->next + POINTER_PREDICTOR_SAMPLES - 1) %
+		 POINTER_PREDICTOR_SAMPLES;
+	*x = pp->samples[newest].x;
+	*y = pp->samples[newest].y;
+
+	horizon = time_subtract(target, pp->samples[newest].time);
+	if (horizon <= 0.0 || horizon > POINTER_STOPPED_NSEC)
+		return true;
+	if (horizon > POINTER_HORIZON_NSEC)
+		horizon = POINTER_HORIZON_NSEC;
+
+	for (i = 0; i < pp->count; i++) {
+		k = (newest + POINTER_PREDICTOR_SAMPLES - i) %
+		    POINTER_PREDICTOR_SAMPLES;
+		t = time_subtract(pp->samples[k].time,
+				  pp->samples[newest].time);
+		if (t < -POINTER_VELOCITY_WINDOW_NSEC)
+			break;
+
+		n += 1.0;
+		st += t;
+		sx += pp->samples[k].x;
+		sy += pp->samples[k].y;
+		stt += t * t;
+		stx += t * pp->samples[k].x;
+		sty += t * pp->samples[k].y;
+	}
+
+	den = n * stt - st * st;
+	if (n < 2.0 || den <= 0.0)
+		return true;
+
+	*x += horizon * (n * stx - st * sx) / den;
+	*y += horizon * (n * sty - st * sy) / den;
+
+	return true;
+}
@@ -0,0 +1,132 @@
+/*
+ * Copyright © 2016 Pekka Paalanen <pq@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef ORING_INPUT_QUEUE_H
+#define ORING_INPUT_QUEUE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct window;
+
+enum input_event_type {
+	INPUT_EVENT_MOTION,
+	INPUT_EVENT_BUTTON,
+	INPUT_EVENT_AXIS,
+	INPUT_EVENT_KEY,
+};
+
+/** A timestamped input event
+ *
+ * The time is in display::gfx_clock nanoseconds, mapped from the
+ * protocol timestamps by struct input_timebase.
+ */
+struct timed_input {
+	uint64_t time;
+	enum input_event_type type;
+	float x, y; /* pointer position in surface coordinates */
+	float dx, dy; /* motion since the previous motion event */
+	uint32_t code; /* button, axis or key */
+	uint32_t state; /* button or key state */
+	float value; /* axis value */
+
+	struct window *window; /* focus the event was sent to */
+};
+
+#define INPUT_QUEUE_SIZE 256
+
+/** Ring of input events in timestamp order
+ *
+ * When full, a motion event is merged into a newest motion event, and
+ * otherwise the oldest event is dropped.
+ */
+struct input_queue {
+	struct timed_input events[INPUT_QUEUE_SIZE];
+	unsigned head; /* index of the oldest event */
+	unsigned count;
+	uint64_t dropped; /* events merged or lost because of overflow */
+};
+
+/** Mapping from protocol input timestamps to gfx_clock
+ *
+ * The protocol does not say which clock input timestamps are on, so the
+ * offset to gfx_clock is estimated as the smallest delay seen between
+ * an event's timestamp and its receipt. The unknown minimum latency of
+ * the event delivery is therefore counted as zero.
+ */
+struct input_timebase {
+	bool valid;
+	int64_t offset; /* gfx_clock minus raw time, nanoseconds */
+
+	uint32_t last_msec; /* for unwrapping 32-bit millisecond times */
+	uint64_t msec;
+};
+
+#define POINTER_PREDICTOR_SAMPLES 8
+
+/** Pointer position extrapolation from recent motion */
+struct pointer_predictor {
+	struct {
+		uint64_t time;
+		float x, y;
+	} samples[POINTER_PREDICTOR_SAMPLES];
+	unsigned next;
+	unsigned count;
+};
+
+void
+input_queue_init(struct input_queue *q);
+
+void
+input_queue_push(struct input_queue *q, const struct timed_input *ev);
+
+const struct timed_input *
+input_queue_peek(const struct input_queue *q);
+
+void
+input_queue_pop(struct input_queue *q);
+
+void
+input_timebase_init(struct input_timebase *tb);
+
+uint64_t
+input_timebase_map_msec(struct input_timebase *tb, uint32_t msec,
+			uint64_t now);
+
+uint64_t
+input_timebase_map_usec(struct input_timebase *tb, uint64_t usec,
+			uint64_t now);
+
+void
+pointer_predictor_reset(struct pointer_predictor *pp);
+
+void
+pointer_predictor_add(struct pointer_predictor *pp, uint64_t time,
+		      float x, float y);
+
+bool
+pointer_predictor_predict(const struct pointer_predictor *pp,
+			  uint64_t target, float *x, float *y);
+
+#endif /* ORING_INPUT_QUEUE_H */
@@ -26,10 +26,15 @@
 
 #include "cal.h"
 #include "input.h"
+#include "oring-clock.h"
+#include "helpers.h"
 #include "xalloc.h"
 
 #include <stdlib.h>
 #include <stdint.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <assert.h>
 
@@ -37,7 +42,74 @@
 #include <wayland-client.h>
 #include <wayland-cursor.h>
 
-/* XXX: implement support for wl_seat up to version 5 */
+#include "relative-pointer-unstable-v1-client-protocol.h"
+
+/* Input is dispatched right after a main loop wakeup. */
+static uint64_t
+seat_get_now(struct seat *seat)
+{
+	return seat->display->wakeup.now;
+}
+
+static uint64_t
+seat_map_time(struct seat *seat, uint32_t msec)
+{
+	return input_timebase_map_msec(&seat->timebase, msec,
+				       seat_get_now(seat));
+}
+
+/* Queue everything accumulated for the current pointer frame. */
+static void
+seat_flush_pointer_frame(struct seat *seat)
+{
+	unsigned i;
+
+	if (seat->has_pending_motion) {
+		seat->pending_motion.window = seat->pointer_focus;
+		input_queue_push(&seat->queue, &seat->pending_motion);
+		pointer_predictor_add(&seat->predictor,
+				      seat->pending_motion.time,
+				      seat->pending_motion.x,
+				      seat->pending_motion.y);
+		seat->has_pending_motion = false;
+		seat->pending_relative = false;
+	}
+
+	for (i = 0; i < ARRAY_LENGTH(seat->pending_axis); i++) {
+		if (!seat->has_pending_axis[i])
+			continue;
+
+		seat->pending_axis[i].window = seat->pointer_focus;
+		input_queue_push(&seat->queue, &seat->pending_axis[i]);
+		seat->has_pending_axis[i] = false;
+	}
+}
+
+/* Without wl_pointer.frame every event stands on its own. */
+static void
+seat_maybe_flush_pointer_frame(struct seat *seat)
+{
+	if (seat->version < WL_POINTER_FRAME_SINCE_VERSION)
+		seat_flush_pointer_frame(seat);
+}
+
+static struct timed_input *
+seat_get_pending_motion(struct seat *seat, uint64_t time)
+{
+	struct timed_input *ev = &seat->pending_motion;
+
+	if (!seat->has_pending_motion) {
+		memset(ev, 0, sizeof *ev);
+		ev->type = INPUT_EVENT_MOTION;
+		ev->time = time;
+		ev->x = seat->pointer_x;
+		ev->y = seat->pointer_y;
+		seat->has_pending_motion = true;
+		seat->pending_relative = false;
+	}
+
+	return ev;
+}
 
 static void
 pointer_handle_enter(void *data, struct wl_pointer *pointer,
@@ -48,7 +120,7 @@ pointer_handle_enter(void *data, struct wl_pointer *pointer,
 	struct display *display = seat->display;
 	struct window *window;
 	struct wl_buffer *buffer;
-	struct wl_cursor *cursor = display->default_cursor;
+	struct wl_cursor *cursor;
 	struct wl_cursor_image *image;
 
 	assert(!seat->pointer_focus || !"server bug");
@@ -59,10 +131,20 @@ pointer_handle_enter(void *data, struct wl_pointer *pointer,
 	if (!window)
 		return;
 
-	if (window->fullscreen)
+	seat->pointer_x = wl_fixed_to_double(sx);
+	seat->pointer_y = wl_fixed_to_double(sy);
+	pointer_predictor_reset(&seat->predictor);
+	pointer_predictor_add(&seat->predictor, seat_get_now(seat),
+			      seat->pointer_x, seat->pointer_y);
+
+	if (window->fullscreen) {
 		wl_pointer_set_cursor(pointer, serial, NULL, 0, 0);
-	else if (cursor) {
-		image = display->default_cursor->images[0];
+		return;
+	}
+
+	cursor = display_get_default_cursor(display);
+	if (cursor) {
+		image = cursor->images[0];
 		buffer = wl_cursor_image_get_buffer(image);
 		if (!buffer)
 			return;
@@ -87,6 +169,8 @@ pointer_handle_leave(void *data, struct wl_pointer *pointer,
 	window = window_from_wl_surface(surface);
 	assert(seat->pointer_focus == window || !"server bug");
 
+	seat_flush_pointer_frame(seat);
+	pointer_predictor_reset(&seat->predictor);
 	seat->pointer_focus = NULL;
 }
 
@@ -94,6 +178,31 @@ static void
 pointer_handle_motion(void *data, struct wl_pointer *pointer,
 		      uint32_t time, wl_fixed_t sx, wl_fixed_t sy)
 {
+	struct seat *seat = data;
+	struct timed_input *ev;
+	uint64_t t;
+	float x = wl_fixed_to_double(sx);
+	float y = wl_fixed_to_double(sy);
+
+	if (!seat->pointer_focus)
+		return;
+
+	t = seat_map_time(seat, time);
+	ev = seat_get_pending_motion(seat, t);
+
+	/* Relative motion has the better timestamp and delta. */
+	if (!seat->pending_relative) {
+		ev->time = t;
+		ev->dx += x - seat->pointer_x;
+		ev->dy += y - seat->pointer_y;
+	}
+	ev->x = x;
+	ev->y = y;
+
+	seat->pointer_x = x;
+	seat->pointer_y = y;
+
+	seat_maybe_flush_pointer_frame(seat);
 }
 
 static void
@@ -103,18 +212,75 @@ pointer_handle_button(void *data, struct wl_pointer *wl_pointer,
 {
 	struct seat *seat = data;
 	struct window *window;
+	struct timed_input ev;
 
 	window = seat->pointer_focus;
 	if (!window)
 		return;
 
+	seat_flush_pointer_frame(seat);
+	memset(&ev, 0, sizeof ev);
+	ev.type = INPUT_EVENT_BUTTON;
+	ev.time = seat_map_time(seat, time);
+	ev.x = seat->pointer_x;
+	ev.y = seat->pointer_y;
+	ev.code = button;
+	ev.state = state;
+	ev.window = window;
+	input_queue_push(&seat->queue, &ev);
+
 	if (button == BTN_LEFT && state == WL_POINTER_BUTTON_STATE_PRESSED)
-		wl_shell_surface_move(window->shsurf, seat->seat, serial);
+		shell_surface_move(window, seat->seat, serial);
 }
 
 static void
 pointer_handle_axis(void *data, struct wl_pointer *wl_pointer,
 		    uint32_t time, uint32_t axis, wl_fixed_t value)
+{
+	struct seat *seat = data;
+	struct timed_input *ev;
+
+	if (!seat->pointer_focus || axis >= ARRAY_LENGTH(seat->pending_axis))
+		return;
+
+	ev = &seat->pending_axis[axis];
+	if (!seat->has_pending_axis[axis]) {
+		memset(ev, 0, sizeof *ev);
+		ev->type = INPUT_EVENT_AXIS;
+		ev->code = axis;
+		seat->has_pending_axis[axis] = true;
+	}
+	ev->time = seat_map_time(seat, time);
+	ev->x = seat->pointer_x;
+	ev->y = seat->pointer_y;
+	ev->value += wl_fixed_to_double(value);
+
+	seat_maybe_flush_pointer_frame(seat);
+}
+
+static void
+pointer_handle_frame(void *data, struct wl_pointer *pointer)
+{
+	struct seat *seat = data;
+
+	seat_flush_pointer_frame(seat);
+}
+
+static void
+pointer_handle_axis_source(void *data, struct wl_pointer *pointer,
+			   uint32_t axis_source)
+{
+}
+
+static void
+pointer_handle_axis_stop(void *data, struct wl_pointer *pointer,
+			 uint32_t time, uint32_t axis)
+{
+}
+
+static void
+pointer_handle_axis_discrete(void *data, struct wl_pointer *pointer,
+			     uint32_t axis, int32_t discrete)
 {
 }
 
@@ -124,6 +290,44 @@ static const struct wl_pointer_listener pointer_listener = {
 	pointer_handle_motion,
 	pointer_handle_button,
 	pointer_handle_axis,
+	pointer_handle_frame,
+	pointer_handle_axis_source,
+	pointer_handle_axis_stop,
+	pointer_handle_axis_discrete,
+};
+
+static void
+relative_pointer_handle_motion(void *data,
+			       struct zwp_relative_pointer_v1 *relative_pointer,
+			       uint32_t utime_hi, uint32_t utime_lo,
+			       wl_fixed_t dx, wl_fixed_t dy,
+			       wl_fixed_t dx_unaccel, wl_fixed_t dy_unaccel)
+{
+	struct seat *seat = data;
+	struct timed_input *ev;
+	uint64_t t;
+
+	if (!seat->pointer_focus)
+		return;
+
+	t = input_timebase_map_usec(&seat->relative_timebase,
+				    (uint64_t)utime_hi << 32 | utime_lo,
+				    seat_get_now(seat));
+	ev = seat_get_pending_motion(seat, t);
+	if (!seat->pending_relative) {
+		ev->dx = 0.0f;
+		ev->dy = 0.0f;
+		seat->pending_relative = true;
+	}
+	ev->time = t;
+	ev->dx += wl_fixed_to_double(dx);
+	ev->dy += wl_fixed_to_double(dy);
+
+	/* Flushed by the wl_pointer.motion or frame that follows. */
+}
+
+static const struct zwp_relative_pointer_v1_listener relative_pointer_listener = {
+	relative_pointer_handle_motion,
 };
 
 static void
@@ -165,13 +369,19 @@ keyboard_handle_key(void *data, struct wl_keyboard *keyboard,
 {
 	struct seat *seat = data;
 	struct window *window;
+	struct timed_input ev;
 
 	window = seat->keyboard_focus;
 	if (!window)
 		return;
 
-	if (!window->display->shell)
-		return;
+	memset(&ev, 0, sizeof ev);
+	ev.type = INPUT_EVENT_KEY;
+	ev.time = seat_map_time(seat, time);
+	ev.code = key;
+	ev.state = state;
+	ev.window = window;
+	input_queue_push(&seat->queue, &ev);
 
 	if (key == KEY_F11 && state) {
 		window->fullscreen = !window->fullscreen;
@@ -188,14 +398,68 @@ keyboard_handle_modifiers(void *data, struct wl_keyboard *keyboard,
 {
 }
 
+static void
+keyboard_handle_repeat_info(void *data, struct wl_keyboard *keyboard,
+			    int32_t rate, int32_t delay)
+{
+}
+
 static const struct wl_keyboard_listener keyboard_listener = {
 	keyboard_handle_keymap,
 	keyboard_handle_enter,
 	keyboard_handle_leave,
 	keyboard_handle_key,
 	keyboard_handle_modifiers,
+	keyboard_handle_repeat_info,
 };
 
+static void
+seat_release_pointer(struct seat *seat)
+{
+	if (seat->relative_pointer)
+		zwp_relative_pointer_v1_destroy(seat->relative_pointer);
+	seat->relative_pointer = NULL;
+
+	if (seat->version >= WL_POINTER_RELEASE_SINCE_VERSION)
+		wl_pointer_release(seat->pointer);
+	else
+		wl_pointer_destroy(seat->pointer);
+	seat->pointer = NULL;
+}
+
+static void
+seat_release_keyboard(struct seat *seat)
+{
+	if (seat->version >= WL_KEYBOARD_RELEASE_SINCE_VERSION)
+		wl_keyboard_release(seat->keyboard);
+	else
+		wl_keyboard_destroy(seat->keyboard);
+	seat->keyboard = NULL;
+}
+
+/** Create or destroy the relative pointer to match the seat
+ *
+ * \param seat The seat.
+ *
+ * Called when the pointer capability or the relative pointer manager
+ * comes or goes.
+ */
+void
+seat_update_relative_pointer(struct seat *seat)
+{
+	struct zwp_relative_pointer_manager_v1 *manager =
+		seat->display->relative_pointer_manager;
+
+	if (seat->pointer && manager && !seat->relative_pointer) {
+		seat->relative_pointer =
+			zwp_relative_pointer_manager_v1_get_relative_pointer(
+				manager, seat->pointer);
+		zwp_relative_pointer_v1_add_listener(seat->relative_pointer,
+						     &relative_pointer_listener,
+						     seat);
+	}
+}
+
 static void
 seat_handle_capabilities(void *data, struct wl_seat *seat,
 			 enum wl_seat_capability caps)
@@ -207,24 +471,32 @@ seat_handle_capabilities(void *data, struct wl_seat *seat,
 	if ((caps & WL_SEAT_CAPABILITY_POINTER) && !s->pointer) {
 		s->pointer = wl_seat_get_pointer(seat);
 		wl_pointer_add_listener(s->pointer, &pointer_listener, s);
+		seat_update_relative_pointer(s);
 	} else if (!(caps & WL_SEAT_CAPABILITY_POINTER) && s->pointer) {
-		wl_pointer_destroy(s->pointer);
-		s->pointer = NULL;
+		seat_release_pointer(s);
 		s->pointer_focus = NULL;
+		s->has_pending_motion = false;
+		s->has_pending_axis[0] = false;
+		s->has_pending_axis[1] = false;
 	}
 
 	if ((caps & WL_SEAT_CAPABILITY_KEYBOARD) && !s->keyboard) {
 		s->keyboard = wl_seat_get_keyboard(seat);
 		wl_keyboard_add_listener(s->keyboard, &keyboard_listener, s);
 	} else if (!(caps & WL_SEAT_CAPABILITY_KEYBOARD) && s->keyboard) {
-		wl_keyboard_destroy(s->keyboard);
-		s->keyboard = NULL;
+		seat_release_keyboard(s);
 		s->keyboard_focus = NULL;
 	}
 }
 
+static void
+seat_handle_name(void *data, struct wl_seat *seat, const char *name)
+{
+}
+
 static const struct wl_seat_listener seat_listener = {
 	seat_handle_capabilities,
+	seat_handle_name,
 };
 
 struct seat *
@@ -237,6 +509,11 @@ seat_create(struct display *display, struct wl_seat *proxy, uint32_t name)
 	wl_list_init(&seat->link);
 	seat->seat = proxy;
 	seat->global_name = name;
+	seat->version = wl_proxy_get_version((struct wl_proxy *)proxy);
+	input_timebase_init(&seat->timebase);
+	input_timebase_init(&seat->relative_timebase);
+	input_queue_init(&seat->queue);
+	pointer_predictor_reset(&seat->predictor);
 
 	wl_seat_add_listener(seat->seat, &seat_listener, seat);
 
@@ -249,11 +526,105 @@ seat_destroy(struct seat *seat)
 	wl_list_remove(&seat->link);
 
 	if (seat->pointer)
-		wl_pointer_destroy(seat->pointer);
+		seat_release_pointer(seat);
 
 	if (seat->keyboard)
-		wl_keyboard_destroy(seat->keyboard);
+		seat_release_keyboard(seat);
+
+	if (seat->queue.dropped > 0)
+		printf("seat-%d: %" PRIu64 " input events lost to overflow\n",
+		       seat->global_name, seat->queue.dropped);
 
-	wl_seat_destroy(seat->seat);
+	if (seat->version >= WL_SEAT_RELEASE_SINCE_VERSION)
+		wl_seat_release(seat->seat);
+	else
+		wl_seat_destroy(seat->seat);
 	free(seat);
 }
+
+/** Hand the queued input events of all seats over to the windows
+ *
+ * \param display The display.
+ *
+ * The events are merged across seats in timestamp order and appended
+ * to the queue of the window that had the focus, see
+ * window_collect_input().
+ */
+void
+display_dispatch_input(struct display *display)
+{
+	struct seat *seat;
+	struct seat *oldest;
+	const struct timed_input *ev;
+	const struct timed_input *oldest_ev;
+
+	for (;;) {
+		oldest = NULL;
+		oldest_ev = NULL;
+
+		wl_list_for_each(seat, &display->seat_list, link) {
+			ev = input_queue_peek(&seat->queue);
+			if (ev && (!oldest_ev || ev->time < oldest_ev->time)) {
+				oldest = seat;
+				oldest_ev = ev;
+			}
+		}
+
+		if (!oldest)
+			break;
+
+		if (oldest_ev->window)
+			input_queue_push(&oldest_ev->window->input, oldest_ev);
+		input_queue_pop(&oldest->queue);
+	}
+}
+
+/** Take the queued input events of a window
+ *
+ * \param window The window.
+ * \param events Array to fill.
+ * \param max Length of the array.
+ * \return Number of events stored, in timestamp order.
+ *
+ * Events that do not fit stay queued for the next call.
+ */
+unsigned
+window_collect_input(struct window *window,
+		     struct timed_input *events, unsigned max)
+{
+	const struct timed_input *ev;
+	unsigned n = 0;
+
+	while (n < max && (ev = input_queue_peek(&window->input))) {
+		events[n++] = *ev;
+		input_queue_pop(&window->input);
+	}
+
+	return n;
+}
+
+/** Predict where the pointer will be on a window
+ *
+ * \param display The display.
+ * \param window The window.
+ * \param target The gfx_clock time to predict for.
+ * \param x Return the position in surface coordinates.
+ * \param y Return the position in surface coordinates.
+ * \return False if no pointer is on the window.
+ */
+bool
+display_predict_pointer(struct display *display, struct window *window,
+			uint64_t target, float *x, float *y)
+{
+	struct seat *seat;
+
+	wl_list_for_each(seat, &display->seat_list, link) {
+		if (seat->pointer_focus != window)
+			continue;
+
+		if (pointer_predictor_predict(&seat->predictor, target, x, y))
+			return true;
+	}
+
+	return false;
+}
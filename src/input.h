@@ -26,8 +26,11 @@
 
 #include <wayland-client.h>
 
+#include "input-queue.h"
+
 struct display;
 struct window;
+struct zwp_relative_pointer_v1;
 
 struct seat {
 	struct display *display;
@@ -35,12 +38,27 @@ struct seat {
 
 	struct wl_seat *seat;
 	uint32_t global_name;
+	uint32_t version;
 
 	struct wl_pointer *pointer;
 	struct window *pointer_focus;
+	struct zwp_relative_pointer_v1 *relative_pointer;
+	float pointer_x, pointer_y; /* surface coordinates */
+
+	/* accumulated until wl_pointer.frame */
+	struct timed_input pending_motion;
+	bool has_pending_motion;
+	bool pending_relative; /* pending_motion is from relative pointer */
+	struct timed_input pending_axis[2];
+	bool has_pending_axis[2];
 
 	struct wl_keyboard *keyboard;
 	struct window *keyboard_focus;
+
+	struct input_timebase timebase; /* protocol millisecond times */
+	struct input_timebase relative_timebase; /* relative pointer times */
+	struct input_queue queue;
+	struct pointer_predictor predictor;
 };
 
 struct seat *
@@ -49,4 +67,18 @@ seat_create(struct display *display, struct wl_seat *proxy, uint32_t name);
 void
 seat_destroy(struct seat *seat);
 
+void
+seat_update_relative_pointer(struct seat *seat);
+
+void
+display_dispatch_input(struct display *display);
+
+unsigned
+window_collect_input(struct window *window,
+		     struct timed_input *events, unsigned max);
+
+bool
+display_predict_pointer(struct display *display, struct window *window,
+			uint64_t target, float *x, float *y);
+
 #endif /* ORING_INPUT_H */
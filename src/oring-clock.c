@@ -172,6 +172,24 @@ oring_clock_get_nsec(const struct oring_clock *oc, const struct timespec *ts)
 	return nsec;
 }
 
+/** Convert clock value to a time instant
+ *
+ * \param oc The clock, must not be frozen.
+ * \param nsec The clock value.
+ * \param ts Returns the time instant, for use with the clock_id used to
+ * initialize the clock, e.g. with timerfd_settime().
+ *
+ * This is the inverse of oring_clock_get_nsec().
+ */
+void
+oring_clock_get_timespec(const struct oring_clock *oc, uint64_t nsec,
+			 struct timespec *ts)
+{
+	assert(oc->frozen == false);
+
+	timespec_add_nsec(ts, &oc->base, (int64_t)(nsec - oc->offset));
+}
+
 /** Get current clock value in nanoseconds
  *
  * \param oc The clock.
@@ -193,6 +211,35 @@ oring_clock_get_nsec_now(const struct oring_clock *oc)
 	return oring_clock_get_nsec(oc, &now);
 }
 
+/** Take a snapshot of a clock for batch conversions
+ *
+ * \param batch The snapshot to overwrite.
+ * \param oc The clock.
+ * \param now The current time from the clock_id of the clock, or NULL to
+ * read it here. Passing a time read for something else saves the
+ * clock_gettime() call.
+ *
+ * The snapshot stays valid until the clock is frozen or thawed.
+ */
+void
+oring_clock_batch_init(struct oring_clock_batch *batch,
+		       const struct oring_clock *oc,
+		       const struct timespec *now)
+{
+	struct timespec ts;
+	int ret;
+
+	if (!now) {
+		ret = clock_gettime(oc->clock_id, &ts);
+		assert(ret == 0);
+		now = &ts;
+	}
+
+	batch->base = timespec_to_nsec(&oc->base) - (int64_t)oc->offset;
+	batch->limit = oc->frozen ? oc->offset : INVALID_TIME;
+	batch->now = oring_clock_batch_get_nsec(batch, now);
+}
+
 /** Get the name string for the given clock id
  *
  * \param clock_id ID, see clock_gettime()
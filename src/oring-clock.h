@@ -27,6 +27,9 @@
 #include <stdbool.h>
 #include <time.h>
 #include <stdint.h>
+#include <assert.h>
+
+#define INVALID_TIME 0xffffffffffffffffULL
 
 struct oring_clock {
 	clockid_t clock_id;
@@ -35,6 +38,18 @@ struct oring_clock {
 	bool frozen;
 };
 
+/** A clock snapshot for converting many time instants cheaply
+ *
+ * Taken once for a batch of time stamps, for example everything
+ * dispatched after one main loop wakeup. The conversions are inline
+ * integer arithmetic, and their checks go away with NDEBUG.
+ */
+struct oring_clock_batch {
+	int64_t base; /* clock_id nanoseconds where the value is zero */
+	uint64_t limit; /* value the clock is frozen at, or INVALID_TIME */
+	uint64_t now; /* clock value when the snapshot was taken */
+};
+
 void
 oring_clock_init(struct oring_clock *oc, clockid_t clock_id,
 		 const struct timespec *epoch);
@@ -51,9 +66,45 @@ oring_clock_thaw(struct oring_clock *oc, const struct timespec *now);
 uint64_t
 oring_clock_get_nsec(const struct oring_clock *oc, const struct timespec *ts);
 
+void
+oring_clock_get_timespec(const struct oring_clock *oc, uint64_t nsec,
+			 struct timespec *ts);
+
 uint64_t
 oring_clock_get_nsec_now(const struct oring_clock *oc);
 
+void
+oring_clock_batch_init(struct oring_clock_batch *batch,
+		       const struct oring_clock *oc,
+		       const struct timespec *now);
+
+/** Get clock value in nanoseconds from a snapshot
+ *
+ * \param batch The snapshot, see oring_clock_batch_init().
+ * \param tv_sec The seconds of the time instant.
+ * \param tv_nsec The nanoseconds of the time instant.
+ * \return The same as oring_clock_get_nsec() for the clock as it was
+ * when the snapshot was taken.
+ */
+static inline uint64_t
+oring_clock_batch_get_nsec_parts(const struct oring_clock_batch *batch,
+				 int64_t tv_sec, int64_t tv_nsec)
+{
+	int64_t nsec = tv_sec * 1000000000 + tv_nsec - batch->base;
+
+	assert(nsec >= 0);
+
+	return (uint64_t)nsec < batch->limit ? (uint64_t)nsec : batch->limit;
+}
+
+static inline uint64_t
+oring_clock_batch_get_nsec(const struct oring_clock_batch *batch,
+			   const struct timespec *ts)
+{
+	return oring_clock_batch_get_nsec_parts(batch, ts->tv_sec,
+						ts->tv_nsec);
+}
+
 const char *
 clock_get_name(clockid_t clock_id);
 
@@ -25,6 +25,7 @@
 
 #include "output.h"
 #include "xalloc.h"
+#include "timespec-util.h"
 
 #include <stdint.h>
 #include <stdbool.h>
@@ -115,6 +116,40 @@ output_handle_geometry(void *data,
 	o->transform = transform;
 }
 
+static struct vidmode *
+output_find_mode(struct output *o, int width, int height, int millihz)
+{
+	struct vidmode *mode;
+
+	wl_list_for_each(mode, &o->mode_list, link) {
+		if (mode->width == width && mode->height == height &&
+		    mode->millihz == millihz)
+			return mode;
+	}
+
+	return NULL;
+}
+
+/* A new current mode invalidates everything learnt about the old one. */
+static void
+output_set_current(struct output *o, struct vidmode *mode)
+{
+	if (o->current == mode)
+		return;
+
+	if (o->current)
+		o->current->flags &= ~WL_OUTPUT_MODE_CURRENT;
+	o->current = mode;
+
+	o->timing.period = mode->millihz > 0 ?
+			   millihz_to_nsec(mode->millihz) : 0;
+	o->timing.measured = false;
+	o->timing.last_vblank = INVALID_TIME;
+	o->timing.vrr = false;
+}
+
+/* Compositors send the current mode again when it changes, so a mode
+ * already known is only updated. */
 static void
 output_handle_mode(void *data,
 		   struct wl_output *output,
@@ -128,15 +163,18 @@ output_handle_mode(void *data,
 
 	assert(o->proxy == output);
 
-	mode = xzalloc(sizeof(*mode));
+	mode = output_find_mode(o, width, height, refresh);
+	if (!mode) {
+		mode = xzalloc(sizeof(*mode));
+		mode->width = width;
+		mode->height = height;
+		mode->millihz = refresh;
+		wl_list_insert(o->mode_list.prev, &mode->link);
+	}
 	mode->flags = flags;
-	mode->width = width;
-	mode->height = height;
-	mode->millihz = refresh;
-	wl_list_insert(o->mode_list.prev, &mode->link);
 
 	if (flags & WL_OUTPUT_MODE_CURRENT)
-		o->current = mode;
+		output_set_current(o, mode);
 }
 
 static void
@@ -193,6 +231,7 @@ output_create(void *proxy, uint32_t name)
 
 	o->proxy = proxy;
 	o->name = name;
+	o->timing.last_vblank = INVALID_TIME;
 	wl_list_init(&o->link);
 	o->refcount = 1;
 
@@ -235,3 +274,75 @@ output_from_wl_output(struct wl_output *wo)
 
 	return wl_output_get_user_data(wo);
 }
+
+/** Learn from a presentation on the output
+ *
+ * \param o The sync output of the presentation.
+ * \param presented The presentation time in gfx_clock nanoseconds.
+ * \param refresh The refresh from presentation feedback, zero if unknown.
+ *
+ * On variable refresh the reported refresh says nothing about the next
+ * vblank, so only the phase is kept.
+ */
+void
+output_timing_presented(struct output *o, uint64_t presented,
+			uint32_t refresh)
+{
+	struct output_timing *t = &o->timing;
+
+	if (t->last_vblank == INVALID_TIME || presented > t->last_vblank)
+		t->last_vblank = presented;
+
+	if (refresh == 0 || t->vrr)
+		return;
+
+	t->period = refresh;
+	t->measured = true;
+}
+
+/** Record whether the output runs with variable refresh
+ *
+ * \param o The output.
+ * \param vrr True if a window detected variable refresh on it.
+ * \param max_period The longest refresh period assumed, nanoseconds.
+ *
+ * The shortest period is the one of the current mode.
+ */
+void
+output_timing_set_vrr(struct output *o, bool vrr, uint64_t max_period)
+{
+	struct output_timing *t = &o->timing;
+
+	t->vrr = vrr;
+	if (!vrr)
+		return;
+
+	t->min_period = o->current && o->current->millihz > 0 ?
+			(uint64_t)millihz_to_nsec(o->current->millihz) : t->period;
+	t->max_period = max_period > t->min_period ? max_period :
+			t->min_period;
+}
+
+/** Predict the first vblank of the output after a time
+ *
+ * \param o The output.
+ * \param after The time in gfx_clock nanoseconds.
+ * \return The vblank time, or INVALID_TIME if the phase is not known
+ * or the output has no fixed refresh.
+ */
+uint64_t
+output_timing_next_vblank(const struct output *o, uint64_t after)
+{
+	const struct output_timing *t = &o->timing;
+	uint64_t n;
+
+	if (t->last_vblank == INVALID_TIME || t->period == 0 || t->vrr)
+		return INVALID_TIME;
+
+	if (after < t->last_vblank)
+		return t->last_vblank;
+
+	n = (after - t->last_vblank) / t->period + 1;
+
+	return t->last_vblank + n * t->period;
+}
@@ -28,6 +28,8 @@
 #include <stdbool.h>
 #include <wayland-client.h>
 
+#include "oring-clock.h"
+
 struct vidmode {
 	struct wl_list link; /* struct output::mode_list */
 
@@ -37,6 +39,22 @@ struct vidmode {
 	int millihz;
 };
 
+/** Refresh timing of an output, shared by all windows on it
+ *
+ * The period starts from the current mode and is replaced by the refresh
+ * from presentation feedback. The phase is the latest presentation any
+ * window saw on the output, so that a window new to the output can aim
+ * at its vblanks right away instead of guessing.
+ */
+struct output_timing {
+	uint64_t period; /* nanoseconds, zero if not known */
+	bool measured; /* period is from feedback, not from the mode */
+	uint64_t last_vblank; /* gfx_clock, INVALID_TIME if not seen */
+
+	bool vrr; /* variable refresh seen by a window */
+	uint64_t min_period, max_period; /* range, valid if vrr */
+};
+
 struct output {
 	struct wl_list link; /* struct display::output_list */
 	int refcount;
@@ -52,6 +70,7 @@ struct output {
 
 	struct wl_list mode_list; /* struct vidmode::link */
 	struct vidmode *current;
+	struct output_timing timing;
 
 	bool done;
 
@@ -73,4 +92,14 @@ output_unref(struct output *o);
 struct output *
 output_from_wl_output(struct wl_output *wo);
 
+void
+output_timing_presented(struct output *o, uint64_t presented,
+			uint32_t refresh);
+
+void
+output_timing_set_vrr(struct output *o, bool vrr, uint64_t max_period);
+
+uint64_t
+output_timing_next_vblank(const struct output *o, uint64_t after);
+
 #endif /* ORING_OUTPUT_H */
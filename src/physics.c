@@ -0,0 +1,240 @@
+/*
+ * Copyright © 2016 Pekka Paalanen <pq@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "physics.h"
+#include "oring-clock.h"
+#include "helpers.h"
+#include "xalloc.h"
+
+/* Arrays are padded to whole vectors of this many floats. */
+#define PHYSICS_LANES 8
+
+/* The longest stretch of time that is simulated in one go, in steps.
+ * After a longer stall the missed time is skipped instead.
+ */
+#define PHYSICS_MAX_STEPS 64
+
+#define TWO_PI ((float)(2.0 * M_PI))
+
+/* Squared distance where the field force peaks, in clip space units. */
+#define PHYSICS_FIELD_SOFTENING 0.01f
+
+/** Create a simulation
+ *
+ * \param count Number of bodies.
+ * \param step_nsec The fixed timestep in nanoseconds.
+ * \return A new simulation with all bodies zeroed.
+ *
+ * The caller sets up the body arrays before the first physics_advance().
+ */
+struct physics *
+physics_create(int count, uint64_t step_nsec)
+{
+	struct physics *phys;
+	float **arrays[10];
+	size_t stride;
+	unsigned i;
+	int ret;
+
+	phys = xzalloc(sizeof *phys);
+	phys->count = count;
+	phys->step_nsec = step_nsec;
+	phys->stiffness = 40.0f;
+	phys->damping = 1.5f;
+
+	arrays[0] = &phys->b.x;
+	arrays[1] = &phys->b.y;
+	arrays[2] = &phys->b.vx;
+	arrays[3] = &phys->b.vy;
+	arrays[4] = &phys->b.rest_x;
+	arrays[5] = &phys->b.rest_y;
+	arrays[6] = &phys->b.angle;
+	arrays[7] = &phys->b.omega;
+	arrays[8] = &phys->b.prev_x;
+	arrays[9] = &phys->b.prev_y;
+
+	stride = (count + PHYSICS_LANES - 1) & ~(PHYSICS_LANES - 1);
+	ret = posix_memalign(&phys->storage, PHYSICS_LANES * sizeof(float),
+			     ARRAY_LENGTH(arrays) * stride * sizeof(float));
+	if (ret != 0) {
+		fprintf(stderr, "Error: out of memory for %d bodies\n", count);
+		exit(1);
+	}
+	memset(phys->storage, 0, ARRAY_LENGTH(arrays) * stride * sizeof(float));
+
+	for (i = 0; i < ARRAY_LENGTH(arrays); i++)
+		*arrays[i] = (float *)phys->storage + i * stride;
+
+	return phys;
+}
+
+void
+physics_destroy(struct physics *phys)
+{
+	free(phys->storage);
+	free(phys);
+}
+
+/* One semi-implicit Euler step over all bodies. The loop has no branches
+ * and no aliasing, so the compiler can vectorize it.
+ */
+static void
+physics_step(struct physics *phys, float dt)
+{
+	float *restrict x = phys->b.x;
+	float *restrict y = phys->b.y;
+	float *restrict vx = phys->b.vx;
+	float *restrict vy = phys->b.vy;
+	const float *restrict rest_x = phys->b.rest_x;
+	const float *restrict rest_y = phys->b.rest_y;
+	float *restrict angle = phys->b.angle;
+	const float *restrict omega = phys->b.omega;
+	float *restrict prev_x = phys->b.prev_x;
+	float *restrict prev_y = phys->b.prev_y;
+	const float k = phys->stiffness;
+	const float c = phys->damping;
+	const float fx = phys->field_x;
+	const float fy = phys->field_y;
+	const float fs = phys->field_strength;
+	float a, dx, dy, f;
+	int i;
+
+	for (i = 0; i < phys->count; i++) {
+		prev_x[i] = x[i];
+		prev_y[i] = y[i];
+
+		/* soft repulsion, strongest at the softening distance */
+		dx = x[i] - fx;
+		dy = y[i] - fy;
+		f = fs / (dx * dx + dy * dy + PHYSICS_FIELD_SOFTENING);
+
+		vx[i] += (-k * (x[i] - rest_x[i]) - c * vx[i] + f * dx) * dt;
+		vy[i] += (-k * (y[i] - rest_y[i]) - c * vy[i] + f * dy) * dt;
+		x[i] += vx[i] * dt;
+		y[i] += vy[i] * dt;
+
+		a = angle[i] + omega[i] * dt;
+		angle[i] = a - TWO_PI * floorf(a * (1.0f / TWO_PI));
+	}
+}
+
+/** Advance the simulation up to a time
+ *
+ * \param phys The simulation.
+ * \param target The gfx_clock time that will be sampled next.
+ *
+ * Runs whole steps until the state is at or past target, so that
+ * physics_get_alpha() interpolates between the last two steps. The
+ * first call only sets the starting time. Targets in the past of the
+ * current state do nothing.
+ */
+void
+physics_advance(struct physics *phys, uint64_t target)
+{
+	size_t size = phys->count * sizeof(float);
+	float dt = phys->step_nsec * 1e-9f;
+
+	if (!phys->started) {
+		memcpy(phys->b.prev_x, phys->b.x, size);
+		memcpy(phys->b.prev_y, phys->b.y, size);
+		phys->time = target;
+		phys->started = true;
+		return;
+	}
+
+	if (time_subtract(target, phys->time) >
+	    (double)PHYSICS_MAX_STEPS * phys->step_nsec)
+		phys->time = target - phys->step_nsec;
+
+	while (phys->time < target) {
+		physics_step(phys, dt);
+		phys->time += phys->step_nsec;
+	}
+}
+
+/** Get the interpolation factor for a time
+ *
+ * \param phys The simulation.
+ * \param target The gfx_clock time to sample.
+ * \return 0.0 at the previous step, 1.0 at the current state.
+ *
+ * Values outside of [0, 1] extrapolate, which happens if target was not
+ * passed to physics_advance() first.
+ */
+float
+physics_get_alpha(const struct physics *phys, uint64_t target)
+{
+	return 1.0 + time_subtract(target, phys->time) / phys->step_nsec;
+}
+
+/** Give nearby bodies a velocity change
+ *
+ * \param phys The simulation.
+ * \param x Center of the push.
+ * \param y Center of the push.
+ * \param vx Velocity change at the center.
+ * \param vy Velocity change at the center.
+ * \param radius Distance where the push falls off to nothing.
+ */
+void
+physics_push(struct physics *phys, float x, float y,
+	     float vx, float vy, float radius)
+{
+	float *restrict bvx = phys->b.vx;
+	float *restrict bvy = phys->b.vy;
+	const float *restrict bx = phys->b.x;
+	const float *restrict by = phys->b.y;
+	const float inv_r2 = 1.0f / (radius * radius);
+	float dx, dy, w;
+	int i;
+
+	for (i = 0; i < phys->count; i++) {
+		dx = bx[i] - x;
+		dy = by[i] - y;
+		w = fmaxf(0.0f, 1.0f - (dx * dx + dy * dy) * inv_r2);
+		bvx[i] += vx * w;
+		bvy[i] += vy * w;
+	}
+}
+
+/** Multiply the spin rate of all bodies
+ *
+ * \param phys The simulation.
+ * \param factor The multiplier.
+ */
+void
+physics_scale_spin(struct physics *phys, float factor)
+{
+	int i;
+
+	for (i = 0; i < phys->count; i++)
+		phys->b.omega[i] *= factor;
+}
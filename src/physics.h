@@ -0,0 +1,91 @@
+/*
+ * Copyright © 2016 Pekka Paalanen <pq@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef ORING_PHYSICS_H
+#define ORING_PHYSICS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Body state as a struct of arrays
+ *
+ * Each array has physics::count elements, padded and aligned so that
+ * the integrator loops vectorize.
+ */
+struct physics_bodies {
+	float *x, *y; /* position */
+	float *vx, *vy; /* velocity */
+	float *rest_x, *rest_y; /* spring anchor */
+	float *angle; /* rotation, radians in [0, 2 pi) */
+	float *omega; /* angular velocity, radians per second */
+
+	/* position one step before physics::time, for interpolation */
+	float *prev_x, *prev_y;
+};
+
+/** A fixed timestep simulation sampled at arbitrary times
+ *
+ * The state is advanced in steps of step_nsec on display::gfx_clock
+ * until it is at or past the requested time, and the bodies are then
+ * interpolated between the last two steps. Every body is a damped
+ * spring pulling it towards its anchor, spinning at a constant rate,
+ * and repelled by the field point.
+ */
+struct physics {
+	int count;
+	struct physics_bodies b;
+	void *storage;
+
+	uint64_t step_nsec;
+	uint64_t time; /* gfx_clock time of the current state */
+	bool started;
+
+	float stiffness; /* spring constant per unit mass, 1/s^2 */
+	float damping; /* velocity damping per unit mass, 1/s */
+
+	/* a point pushing the bodies away, off with zero strength */
+	float field_x, field_y;
+	float field_strength;
+};
+
+struct physics *
+physics_create(int count, uint64_t step_nsec);
+
+void
+physics_destroy(struct physics *phys);
+
+void
+physics_advance(struct physics *phys, uint64_t target);
+
+float
+physics_get_alpha(const struct physics *phys, uint64_t target);
+
+void
+physics_push(struct physics *phys, float x, float y,
+	     float vx, float vy, float radius);
+
+void
+physics_scale_spin(struct physics *phys, float factor);
+
+#endif /* ORING_PHYSICS_H */
@@ -0,0 +1,181 @@
+/*
+ * Copyright © 2016 Pekka Paalanen <pq@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "pool.h"
+#include "xalloc.h"
+
+/* Strictest alignment any pooled object needs */
+union pool_align {
+	void *p;
+	uint64_t u;
+	double d;
+};
+
+struct pool_chunk {
+	struct pool_chunk *next;
+	union pool_align data[];
+};
+
+struct pool_free_obj {
+	struct pool_free_obj *next;
+};
+
+static void
+pool_grow(struct pool *pool)
+{
+	struct pool_chunk *chunk;
+	char *obj;
+	unsigned i;
+
+	chunk = xmalloc(sizeof *chunk + pool->obj_size * pool->per_chunk);
+	chunk->next = pool->chunks;
+	pool->chunks = chunk;
+	pool->stats.heap_allocs++;
+
+	obj = (char *)chunk->data;
+	for (i = 0; i < pool->per_chunk; i++) {
+		((struct pool_free_obj *)obj)->next = pool->free_list;
+		pool->free_list = obj;
+		obj += pool->obj_size;
+	}
+}
+
+/** Initialize a pool
+ *
+ * \param pool The uninitialized pool to overwrite.
+ * \param obj_size Size of one object in bytes.
+ * \param per_chunk Number of objects to allocate from the heap at a time.
+ *
+ * The first chunk is allocated right away, so a pool that never has more
+ * than per_chunk objects alive never touches the heap again.
+ */
+void
+pool_init(struct pool *pool, size_t obj_size, unsigned per_chunk)
+{
+	const size_t align = sizeof(union pool_align);
+
+	assert(per_chunk > 0);
+
+	memset(pool, 0, sizeof *pool);
+
+	if (obj_size < sizeof(struct pool_free_obj))
+		obj_size = sizeof(struct pool_free_obj);
+	pool->obj_size = (obj_size + align - 1) / align * align;
+	pool->per_chunk = per_chunk;
+
+	pool_grow(pool);
+}
+
+/** Release a pool
+ *
+ * \param pool The pool.
+ *
+ * Frees all memory of the pool. All objects must have been returned.
+ */
+void
+pool_release(struct pool *pool)
+{
+	struct pool_chunk *chunk;
+
+	if (pool->stats.in_use != 0)
+		fprintf(stderr, "Warning: %u objects leaked from pool.\n",
+			pool->stats.in_use);
+
+	while (pool->chunks) {
+		chunk = pool->chunks;
+		pool->chunks = chunk->next;
+		free(chunk);
+	}
+
+	pool->free_list = NULL;
+}
+
+/** Allocate a zeroed object
+ *
+ * \param pool The pool.
+ * \return A new object, never NULL.
+ *
+ * Aborts on out of memory, like xzalloc().
+ */
+void *
+pool_zalloc(struct pool *pool)
+{
+	struct pool_free_obj *obj;
+
+	if (!pool->free_list)
+		pool_grow(pool);
+
+	obj = pool->free_list;
+	pool->free_list = obj->next;
+
+	pool->stats.allocs++;
+	pool->stats.in_use++;
+	if (pool->stats.in_use > pool->stats.high_water)
+		pool->stats.high_water = pool->stats.in_use;
+
+	memset(obj, 0, pool->obj_size);
+
+	return obj;
+}
+
+/** Return an object to the pool
+ *
+ * \param pool The pool the object was allocated from.
+ * \param obj The object.
+ */
+void
+pool_free(struct pool *pool, void *obj)
+{
+	struct pool_free_obj *fo = obj;
+
+	assert(pool->stats.in_use > 0);
+
+	fo->next = pool->free_list;
+	pool->free_list = fo;
+
+	pool->stats.frees++;
+	pool->stats.in_use--;
+}
+
+/** Get the pool statistics
+ *
+ * \param pool The pool.
+ * \return Counters since pool_init().
+ *
+ * A heap_allocs count that stays fixed while allocs keeps growing means
+ * there are no heap allocations in steady state.
+ */
+const struct pool_stats *
+pool_get_stats(const struct pool *pool)
+{
+	return &pool->stats;
+}
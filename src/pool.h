@@ -0,0 +1,75 @@
+/*
+ * Copyright © 2016 Pekka Paalanen <pq@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef ORING_POOL_H
+#define ORING_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct pool_chunk;
+
+struct pool_stats {
+	uint64_t allocs; /* objects handed out */
+	uint64_t frees; /* objects returned */
+	uint64_t heap_allocs; /* chunks taken from the heap */
+	unsigned in_use;
+	unsigned high_water;
+};
+
+/** Fixed-size object allocator with a free list
+ *
+ * Objects are carved out of chunks allocated from the heap. Freed objects
+ * go to a free list and are reused, so once the pool has grown to the peak
+ * number of live objects, no more heap allocations happen. The chunks are
+ * freed only when the pool is released.
+ *
+ * Not thread-safe.
+ */
+struct pool {
+	size_t obj_size;
+	unsigned per_chunk;
+
+	void *free_list;
+	struct pool_chunk *chunks;
+
+	struct pool_stats stats;
+};
+
+void
+pool_init(struct pool *pool, size_t obj_size, unsigned per_chunk);
+
+void
+pool_release(struct pool *pool);
+
+void *
+pool_zalloc(struct pool *pool);
+
+void
+pool_free(struct pool *pool, void *obj);
+
+const struct pool_stats *
+pool_get_stats(const struct pool *pool);
+
+#endif /* ORING_POOL_H */
@@ -0,0 +1,282 @@
+/*
+ * Copyright © 2016 Pekka Paalanen <pq@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#include "predictor.h"
+#include "oring-clock.h"
+#include "helpers.h"
+
+/* Minimum number of samples for a fit */
+#define PREDICTOR_MIN_SAMPLES 4
+
+/* Residuals below this are never treated as outliers, nsec */
+#define PREDICTOR_MIN_THRESHOLD 100000.0
+
+/* A refresh change larger than this fraction means a mode change */
+#define PREDICTOR_REFRESH_TOLERANCE 0.01
+
+struct fit_point {
+	double x; /* vblank index relative to the newest sample */
+	double y; /* nsec relative to the newest sample */
+	bool inlier;
+};
+
+/** Initialize a predictor
+ *
+ * \param p The uninitialized predictor to overwrite.
+ */
+void
+predictor_init(struct predictor *p)
+{
+	memset(p, 0, sizeof *p);
+}
+
+/** Forget all history
+ *
+ * \param p The predictor.
+ *
+ * Call this when the timings are known to change discontinuously, e.g.
+ * when the window moves to a different output.
+ */
+void
+predictor_reset(struct predictor *p)
+{
+	predictor_init(p);
+}
+
+static const struct predictor_sample *
+predictor_get(const struct predictor *p, unsigned age)
+{
+	unsigned i;
+
+	i = (p->next + PREDICTOR_HISTORY - 1 - age) % PREDICTOR_HISTORY;
+
+	return &p->history[i];
+}
+
+static double
+median(double *v, unsigned n)
+{
+	unsigned i, j;
+	double tmp;
+
+	/* insertion sort, n is small */
+	for (i = 1; i < n; i++) {
+		tmp = v[i];
+		for (j = i; j > 0 && v[j - 1] > tmp; j--)
+			v[j] = v[j - 1];
+		v[j] = tmp;
+	}
+
+	if (n % 2)
+		return v[n / 2];
+
+	return (v[n / 2 - 1] + v[n / 2]) / 2.0;
+}
+
+/* Least squares line y = a + b * x over the inlier points */
+static bool
+fit_line(const struct fit_point *pt, unsigned n, double *a, double *b)
+{
+	double sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0;
+	double m = 0.0;
+	double det;
+	unsigned i;
+
+	for (i = 0; i < n; i++) {
+		if (!pt[i].inlier)
+			continue;
+
+		sx += pt[i].x;
+		sy += pt[i].y;
+		sxx += pt[i].x * pt[i].x;
+		sxy += pt[i].x * pt[i].y;
+		m += 1.0;
+	}
+
+	if (m < PREDICTOR_MIN_SAMPLES)
+		return false;
+
+	det = m * sxx - sx * sx;
+	if (det <= 0.0)
+		return false;
+
+	*b = (m * sxy - sx * sy) / det;
+	*a = (sy - *b * sx) / m;
+
+	return true;
+}
+
+static bool
+predictor_fit(struct predictor *p)
+{
+	struct fit_point pt[PREDICTOR_HISTORY];
+	double absres[PREDICTOR_HISTORY];
+	const struct predictor_sample *newest;
+	const struct predictor_sample *s;
+	double guess;
+	double a, b, res, threshold;
+	bool use_seq;
+	unsigned i, n;
+
+	if (p->count < PREDICTOR_MIN_SAMPLES)
+		return false;
+
+	newest = predictor_get(p, 0);
+
+	/* The MSC would tell the vblank index directly, but not all
+	 * compositors provide it. Otherwise round the time deltas with
+	 * the best period guess we have.
+	 */
+	use_seq = true;
+	for (i = 0; i < p->count; i++) {
+		if (predictor_get(p, i)->seq == 0)
+			use_seq = false;
+	}
+
+	if (p->valid)
+		guess = p->period;
+	else
+		guess = newest->refresh;
+
+	if (!use_seq && guess <= 0.0)
+		return false;
+
+	n = MIN(p->count, PREDICTOR_HISTORY);
+	for (i = 0; i < n; i++) {
+		s = predictor_get(p, i);
+		pt[i].y = time_subtract(s->presented_time,
+					newest->presented_time);
+		if (use_seq)
+			pt[i].x = -(double)(newest->seq - s->seq);
+		else
+			pt[i].x = round(pt[i].y / guess);
+		pt[i].inlier = true;
+	}
+
+	if (!fit_line(pt, n, &a, &b))
+		return false;
+
+	/* Reject points further than 3 sigma from the first fit, with
+	 * sigma estimated robustly from the median absolute residual.
+	 */
+	for (i = 0; i < n; i++)
+		absres[i] = fabs(pt[i].y - (a + b * pt[i].x));
+
+	threshold = 3.0 * 1.4826 * median(absres, n);
+	if (threshold < PREDICTOR_MIN_THRESHOLD)
+		threshold = PREDICTOR_MIN_THRESHOLD;
+
+	p->inliers = 0;
+	for (i = 0; i < n; i++) {
+		res = fabs(pt[i].y - (a + b * pt[i].x));
+		pt[i].inlier = res <= threshold;
+		if (pt[i].inlier)
+			p->inliers++;
+	}
+
+	if (!fit_line(pt, n, &a, &b))
+		return false;
+
+	/* Guard against nonsense if the grid assumption is broken. */
+	if (b <= 0.0)
+		return false;
+
+	if (newest->refresh &&
+	    fabs(b - newest->refresh) > newest->refresh * 0.1)
+		return false;
+
+	p->ref_time = newest->presented_time;
+	p->ref_offset = a;
+	p->period = b;
+
+	return true;
+}
+
+/** Add a presented frame to the history
+ *
+ * \param p The predictor.
+ * \param s The sample, presented_time must be valid.
+ *
+ * The history is cleared first if the sample contradicts it: the refresh
+ * period changed, or the presentation time or MSC went backwards.
+ * The vblank grid is re-fitted after adding the sample.
+ */
+void
+predictor_add_sample(struct predictor *p, const struct predictor_sample *s)
+{
+	const struct predictor_sample *prev;
+	double tolerance;
+
+	if (p->count > 0) {
+		prev = predictor_get(p, 0);
+		tolerance = prev->refresh * PREDICTOR_REFRESH_TOLERANCE;
+
+		if (fabs((double)s->refresh - prev->refresh) > tolerance ||
+		    s->presented_time <= prev->presented_time ||
+		    (s->seq && prev->seq && s->seq <= prev->seq))
+			predictor_reset(p);
+	}
+
+	p->history[p->next] = *s;
+	p->next = (p->next + 1) % PREDICTOR_HISTORY;
+	if (p->count < PREDICTOR_HISTORY)
+		p->count++;
+
+	p->valid = predictor_fit(p);
+}
+
+/** Predict the next vblank
+ *
+ * \param p The predictor, must be valid.
+ * \param after Time instant in display::gfx_clock nanoseconds.
+ * \return The first predicted vblank at least a quarter period after
+ * the given time.
+ *
+ * The quarter period margin keeps noise from returning the very vblank
+ * the given time was measured from, e.g. when passing the latest
+ * presentation time.
+ */
+uint64_t
+predictor_next_vblank(const struct predictor *p, uint64_t after)
+{
+	double t;
+	double k;
+	double v;
+
+	t = time_subtract(after, p->ref_time) - p->ref_offset;
+	k = ceil(t / p->period + 0.25);
+	v = p->ref_offset + k * p->period;
+
+	if (v < 0.0)
+		return p->ref_time - (uint64_t)llround(-v);
+
+	return p->ref_time + (uint64_t)llround(v);
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright © 2016 Pekka Paalanen <pq@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef ORING_PREDICTOR_H
+#define ORING_PREDICTOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define PREDICTOR_HISTORY 32
+
+/** One presented frame as seen by the predictor
+ *
+ * All times are in display::gfx_clock nanoseconds, INVALID_TIME if not
+ * known. The refresh and seq are as received in
+ * wp_presentation_feedback.presented, zero if not known.
+ */
+struct predictor_sample {
+	uint64_t commit_time;
+	uint64_t frame_time;
+	uint64_t presented_time;
+	uint32_t refresh;
+	uint64_t seq;
+};
+
+/** Presentation time predictor
+ *
+ * Keeps a history of recent presentations and fits a vblank grid
+ * (phase and period) to them with an outlier-rejecting least squares
+ * estimator.
+ */
+struct predictor {
+	struct predictor_sample history[PREDICTOR_HISTORY];
+	unsigned count;
+	unsigned next;
+
+	/* Result of the latest fit, valid only if 'valid' */
+	bool valid;
+	uint64_t ref_time; /* presented_time of the newest sample */
+	double ref_offset; /* fitted vblank time relative to ref_time */
+	double period;
+	unsigned inliers;
+};
+
+void
+predictor_init(struct predictor *p);
+
+void
+predictor_reset(struct predictor *p);
+
+void
+predictor_add_sample(struct predictor *p, const struct predictor_sample *s);
+
+uint64_t
+predictor_next_vblank(const struct predictor *p, uint64_t after);
+
+#endif /* ORING_PREDICTOR_H */
@@ -0,0 +1,410 @@
+/*
+ * Copyright © 2016 Pekka Paalanen <pq@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <EGL/egl.h>
+
+#include "program-cache.h"
+#include "helpers.h"
+#include "xalloc.h"
+
+/** The start of a program binary file, followed by the binary */
+struct program_file_header {
+	uint32_t format; /* from glGetProgramBinaryOES */
+	uint32_t length;
+};
+
+static GLuint
+create_shader(const char *prefix, const char *source, GLenum shader_type)
+{
+	const char *sources[] = { prefix, source };
+	GLuint shader;
+	GLint status;
+
+	shader = glCreateShader(shader_type);
+	assert(shader != 0);
+
+	glShaderSource(shader, ARRAY_LENGTH(sources), sources, NULL);
+	glCompileShader(shader);
+
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+	if (!status) {
+		char log[1000];
+		GLsizei len;
+		glGetShaderInfoLog(shader, 1000, &len, log);
+		fprintf(stderr, "Error: compiling %s: %*s\n",
+			shader_type == GL_VERTEX_SHADER ? "vertex" : "fragment",
+			len, log);
+		exit(1);
+	}
+
+	return shader;
+}
+
+/* Compile and link, with the attribute locations bound before linking. */
+static GLuint
+compile_program(const struct program_source *src)
+{
+	char prefix[32];
+	GLuint frag, vert;
+	GLuint program;
+	GLint status;
+	GLuint i;
+
+	snprintf(prefix, sizeof prefix, "#define COST %d\n", src->cost);
+	frag = create_shader(prefix, src->frag, GL_FRAGMENT_SHADER);
+	vert = create_shader("", src->vert, GL_VERTEX_SHADER);
+
+	program = glCreateProgram();
+	glAttachShader(program, frag);
+	glAttachShader(program, vert);
+
+	for (i = 0; src->attribs[i]; i++)
+		glBindAttribLocation(program, i, src->attribs[i]);
+	glLinkProgram(program);
+
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	if (!status) {
+		char log[1000];
+		GLsizei len;
+		glGetProgramInfoLog(program, 1000, &len, log);
+		fprintf(stderr, "Error: linking:\n%*s\n", len, log);
+		exit(1);
+	}
+
+	/* Freed along with the program. */
+	glDeleteShader(frag);
+	glDeleteShader(vert);
+
+	return program;
+}
+
+static bool
+source_equal(const struct program_source *a, const struct program_source *b)
+{
+	return a->vert == b->vert && a->frag == b->frag &&
+	       a->cost == b->cost && a->attribs == b->attribs;
+}
+
+static uint64_t
+hash_string(uint64_t h, const char *s)
+{
+	/* FNV-1a, including the terminating zero as a separator */
+	do {
+		h ^= (unsigned char)*s;
+		h *= 0x100000001b3ULL;
+	} while (*s++);
+
+	return h;
+}
+
+/* A binary is only good for the very driver and source it came from. */
+static uint64_t
+program_hash(const struct program_source *src)
+{
+	static const GLenum driver[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+	uint64_t h = 0xcbf29ce484222325ULL;
+	const char *str;
+	char cost[16];
+	unsigned i;
+
+	for (i = 0; i < ARRAY_LENGTH(driver); i++) {
+		str = (const char *)glGetString(driver[i]);
+		h = hash_string(h, str ? str : "");
+	}
+
+	snprintf(cost, sizeof cost, "%d", src->cost);
+	h = hash_string(h, cost);
+	h = hash_string(h, src->vert);
+	h = hash_string(h, src->frag);
+	for (i = 0; src->attribs[i]; i++)
+		h = hash_string(h, src->attribs[i]);
+
+	return h;
+}
+
+static char *
+program_path(const struct program_cache *pc, uint64_t hash)
+{
+	char *path;
+
+	if (asprintf(&path, "%s/%016" PRIx64 ".bin", pc->dir, hash) < 0)
+		return NULL;
+
+	return path;
+}
+
+static void
+probe_program_binary(struct program_cache *pc)
+{
+	const char *exts = (const char *)glGetString(GL_EXTENSIONS);
+	GLint formats = 0;
+
+	pc->probed = true;
+
+	if (!pc->dir || !exts || !strstr(exts, "GL_OES_get_program_binary"))
+		return;
+
+	/* Drivers without any binary format cannot give binaries back. */
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &formats);
+	if (formats < 1)
+		return;
+
+	pc->get_program_binary = (PFNGLGETPROGRAMBINARYOESPROC)
+		eglGetProcAddress("glGetProgramBinaryOES");
+	pc->program_binary = (PFNGLPROGRAMBINARYOESPROC)
+		eglGetProcAddress("glProgramBinaryOES");
+
+	if (!pc->get_program_binary || !pc->program_binary) {
+		pc->get_program_binary = NULL;
+		pc->program_binary = NULL;
+	}
+}
+
+/* Returns 0 if there is no usable binary, e.g. after a driver update. */
+static GLuint
+load_program(struct program_cache *pc, const char *path)
+{
+	struct program_file_header header;
+	GLuint program = 0;
+	GLint status;
+	void *data;
+	FILE *fp;
+
+	fp = fopen(path, "rb");
+	if (!fp)
+		return 0;
+
+	if (fread(&header, sizeof header, 1, fp) != 1 || header.length == 0) {
+		fclose(fp);
+		return 0;
+	}
+
+	data = xmalloc(header.length);
+	if (fread(data, header.length, 1, fp) == 1) {
+		program = glCreateProgram();
+		pc->program_binary(program, header.format, data,
+				   header.length);
+
+		glGetProgramiv(program, GL_LINK_STATUS, &status);
+		if (!status) {
+			glDeleteProgram(program);
+			program = 0;
+		}
+	}
+
+	free(data);
+	fclose(fp);
+
+	return program;
+}
+
+/* Written to a temporary file first, so a reader never sees half. */
+static void
+save_program(struct program_cache *pc, GLuint program, const char *path)
+{
+	struct program_file_header header;
+	GLint length = 0;
+	GLsizei got = 0;
+	GLenum format;
+	char *tmp;
+	void *data;
+	FILE *fp;
+
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH_OES, &length);
+	if (length <= 0)
+		return;
+
+	data = xmalloc(length);
+	pc->get_program_binary(program, length, &got, &format, data);
+	if (got <= 0 || asprintf(&tmp, "%s.tmp", path) < 0) {
+		free(data);
+		return;
+	}
+
+	header.format = format;
+	header.length = got;
+
+	fp = fopen(tmp, "wb");
+	if (!fp ||
+	    fwrite(&header, sizeof header, 1, fp) != 1 ||
+	    fwrite(data, got, 1, fp) != 1 ||
+	    fclose(fp) != 0 ||
+	    rename(tmp, path) < 0) {
+		fprintf(stderr, "Warning: writing program cache '%s' failed: "
+			"%s\n", path, strerror(errno));
+		unlink(tmp);
+	}
+
+	free(tmp);
+	free(data);
+}
+
+/* $XDG_CACHE_HOME/oring-cal, falling back to ~/.cache/oring-cal */
+static char *
+cache_dir_create(void)
+{
+	const char *base = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+	char *cache = NULL;
+	char *dir = NULL;
+
+	if (base && base[0] == '/')
+		cache = xstrdup(base);
+	else if (home && asprintf(&cache, "%s/.cache", home) < 0)
+		cache = NULL;
+
+	if (!cache)
+		return NULL;
+
+	if (asprintf(&dir, "%s/oring-cal", cache) < 0)
+		dir = NULL;
+
+	if (dir &&
+	    (mkdir(cache, 0700) < 0 && errno != EEXIST)) {
+		free(dir);
+		dir = NULL;
+	}
+
+	if (dir && mkdir(dir, 0700) < 0 && errno != EEXIST) {
+		fprintf(stderr, "Warning: no program cache in '%s': %s\n",
+			dir, strerror(errno));
+		free(dir);
+		dir = NULL;
+	}
+
+	free(cache);
+
+	return dir;
+}
+
+/** Initialize a program cache
+ *
+ * \param pc The uninitialized cache to overwrite.
+ *
+ * Does not need a GL context. The disk cache is disabled by setting
+ * ORING_PROGRAM_CACHE=0 in the environment.
+ */
+void
+program_cache_init(struct program_cache *pc)
+{
+	const char *env = getenv("ORING_PROGRAM_CACHE");
+
+	memset(pc, 0, sizeof *pc);
+	pthread_mutex_init(&pc->mutex, NULL);
+
+	if (!env || strcmp(env, "0") != 0)
+		pc->dir = cache_dir_create();
+}
+
+/** Release a program cache
+ *
+ * \param pc The cache.
+ *
+ * The programs themselves go away with the share group.
+ */
+void
+program_cache_release(struct program_cache *pc)
+{
+	if (pc->shared + pc->loaded + pc->compiled > 0)
+		printf("programs: %u compiled, %u loaded from disk, "
+		       "%u shared\n", pc->compiled, pc->loaded, pc->shared);
+
+	pthread_mutex_destroy(&pc->mutex);
+	free(pc->dir);
+}
+
+/** Get a linked program
+ *
+ * \param pc The cache.
+ * \param src The source, the strings must live as long as the cache.
+ * \return The program, owned by the cache.
+ *
+ * The program comes from the first of: the programs already linked in
+ * the share group, a binary on disk, compiling the source. Exits the
+ * program if compiling fails.
+ */
+GLuint
+program_cache_get(struct program_cache *pc, const struct program_source *src)
+{
+	GLuint program = 0;
+	char *path = NULL;
+	unsigned i;
+
+	pthread_mutex_lock(&pc->mutex);
+
+	for (i = 0; i < pc->count; i++) {
+		if (source_equal(&pc->entries[i].source, src)) {
+			pc->shared++;
+			program = pc->entries[i].program;
+			pthread_mutex_unlock(&pc->mutex);
+			return program;
+		}
+	}
+
+	if (!pc->probed)
+		probe_program_binary(pc);
+
+	if (pc->program_binary)
+		path = program_path(pc, program_hash(src));
+
+	if (path)
+		program = load_program(pc, path);
+
+	if (program) {
+		pc->loaded++;
+	} else {
+		program = compile_program(src);
+		pc->compiled++;
+
+		if (path)
+			save_program(pc, program, path);
+	}
+
+	free(path);
+
+	/* Another context may use the program only once it is complete. */
+	glFinish();
+
+	if (pc->count < ARRAY_LENGTH(pc->entries)) {
+		pc->entries[pc->count].source = *src;
+		pc->entries[pc->count].program = program;
+		pc->count++;
+	}
+
+	pthread_mutex_unlock(&pc->mutex);
+
+	return program;
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright © 2016 Pekka Paalanen <pq@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef ORING_PROGRAM_CACHE_H
+#define ORING_PROGRAM_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+
+/** What a program is built from */
+struct program_source {
+	const char *vert; /* vertex shader text */
+	const char *frag; /* fragment shader text */
+	int cost; /* value of COST in the fragment shader */
+	const char * const *attribs; /* names by location, NULL terminated */
+};
+
+#define PROGRAM_CACHE_SIZE 16
+
+/** Linked programs shared by all contexts of a display
+ *
+ * The contexts must be in one share group. Programs are looked up by
+ * source and built once. With GL_OES_get_program_binary, the binaries
+ * are also kept on disk, keyed by the driver and the source, so that
+ * the next start does not need to compile at all.
+ *
+ * Thread-safe, but each call needs a context of the share group current.
+ */
+struct program_cache {
+	pthread_mutex_t mutex;
+	char *dir; /* disk cache directory, NULL if disabled */
+
+	struct {
+		struct program_source source;
+		GLuint program;
+	} entries[PROGRAM_CACHE_SIZE];
+	unsigned count;
+
+	/* GL_OES_get_program_binary, looked up with the first program */
+	bool probed;
+	PFNGLGETPROGRAMBINARYOESPROC get_program_binary;
+	PFNGLPROGRAMBINARYOESPROC program_binary;
+
+	/* statistics */
+	unsigned shared; /* found already linked */
+	unsigned loaded; /* from a binary on disk */
+	unsigned compiled;
+};
+
+void
+program_cache_init(struct program_cache *pc);
+
+void
+program_cache_release(struct program_cache *pc);
+
+GLuint
+program_cache_get(struct program_cache *pc, const struct program_source *src);
+
+#endif /* ORING_PROGRAM_CACHE_H */
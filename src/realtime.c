@@ -0,0 +1,323 @@
+/*
+ * Copyright © 2016 Pekka Paalanen <pq@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#ifdef HAVE_DBUS
+#include <dbus/dbus.h>
+#endif
+
+#include "realtime.h"
+
+#ifndef SCHED_RESET_ON_FORK
+#define SCHED_RESET_ON_FORK 0
+#endif
+
+#define REALTIME_DEFAULT_PRIORITY 10
+
+/* RealtimeKit refuses threads that could run unbounded, and by default
+ * allows at most this much CPU time without blocking. */
+#define RTKIT_RTTIME_USEC 200000
+
+/** Initialize to leave scheduling alone
+ *
+ * \param opts The uninitialized options to overwrite.
+ */
+void
+realtime_options_init(struct realtime_options *opts)
+{
+	memset(opts, 0, sizeof *opts);
+	opts->policy = SCHED_OTHER;
+}
+
+/** Parse a scheduling policy from the command line
+ *
+ * \param opts The options to set the policy and priority in.
+ * \param arg "fifo" or "rr", optionally followed by ":priority".
+ * \return 0 on success, -1 if arg is not valid.
+ */
+int
+realtime_parse_policy(struct realtime_options *opts, const char *arg)
+{
+	const char *colon = strchr(arg, ':');
+	size_t len = colon ? (size_t)(colon - arg) : strlen(arg);
+	int min, max;
+	char *end;
+
+	if (len == 4 && strncmp(arg, "fifo", len) == 0)
+		opts->policy = SCHED_FIFO;
+	else if (len == 2 && strncmp(arg, "rr", len) == 0)
+		opts->policy = SCHED_RR;
+	else
+		return -1;
+
+	opts->priority = REALTIME_DEFAULT_PRIORITY;
+	if (!colon)
+		return 0;
+
+	errno = 0;
+	opts->priority = strtol(colon + 1, &end, 10);
+	min = sched_get_priority_min(opts->policy);
+	max = sched_get_priority_max(opts->policy);
+	if (errno != 0 || end == colon + 1 || *end != '\0' ||
+	    opts->priority < min || opts->priority > max)
+		return -1;
+
+	return 0;
+}
+
+/** Parse a comma separated CPU list from the command line
+ *
+ * \param opts The options to set the CPUs in.
+ * \param arg For example "2,3".
+ * \return 0 on success, -1 if arg is not valid.
+ */
+int
+realtime_parse_cpus(struct realtime_options *opts, const char *arg)
+{
+	const char *p = arg;
+	char *end;
+	long cpu;
+
+	opts->cpu_count = 0;
+
+	do {
+		errno = 0;
+		cpu = strtol(p, &end, 10);
+		if (errno != 0 || end == p || cpu < 0 || cpu >= CPU_SETSIZE ||
+		    opts->cpu_count == REALTIME_MAX_CPUS)
+			return -1;
+
+		opts->cpus[opts->cpu_count++] = cpu;
+		p = end + 1;
+	} while (*end == ',');
+
+	return *end == '\0' ? 0 : -1;
+}
+
+static int
+realtime_pick_cpu(const struct realtime_options *opts, unsigned index)
+{
+	if (opts->cpu_count == 1 || index == 0)
+		return opts->cpus[0];
+
+	return opts->cpus[1 + (index - 1) % (opts->cpu_count - 1)];
+}
+
+#ifdef HAVE_DBUS
+/** Ask RealtimeKit to make the calling thread SCHED_RR
+ *
+ * \param priority The priority, within what RealtimeKit allows.
+ * \return 0 on success, -1 on failure with a warning printed.
+ */
+static int
+rtkit_make_realtime(int priority)
+{
+	static const char *rtkit = "org.freedesktop.RealtimeKit1";
+	dbus_uint64_t thread = syscall(SYS_gettid);
+	dbus_uint32_t prio = priority;
+	DBusConnection *conn;
+	DBusMessage *msg;
+	DBusMessage *reply = NULL;
+	DBusError err;
+	struct rlimit rl = {
+		.rlim_cur = RTKIT_RTTIME_USEC,
+		.rlim_max = RTKIT_RTTIME_USEC,
+	};
+
+	if (setrlimit(RLIMIT_RTTIME, &rl) < 0) {
+		perror("Warning: could not limit RLIMIT_RTTIME for RealtimeKit");
+		return -1;
+	}
+
+	dbus_error_init(&err);
+	conn = dbus_bus_get_private(DBUS_BUS_SYSTEM, &err);
+	if (!conn)
+		goto out;
+	dbus_connection_set_exit_on_disconnect(conn, FALSE);
+
+	msg = dbus_message_new_method_call(rtkit, "/org/freedesktop/RealtimeKit1",
+					   rtkit, "MakeThreadRealtime");
+	if (msg && dbus_message_append_args(msg, DBUS_TYPE_UINT64, &thread,
+					    DBUS_TYPE_UINT32, &prio,
+					    DBUS_TYPE_INVALID))
+		reply = dbus_connection_send_with_reply_and_block(conn, msg,
+								  -1, &err);
+	if (msg)
+		dbus_message_unref(msg);
+	if (reply)
+		dbus_message_unref(reply);
+
+	dbus_connection_close(conn);
+	dbus_connection_unref(conn);
+
+out:
+	if (dbus_error_is_set(&err)) {
+		fprintf(stderr, "Warning: RealtimeKit: %s\n", err.message);
+		dbus_error_free(&err);
+	}
+
+	return reply ? 0 : -1;
+}
+#else
+static int
+rtkit_make_realtime(int priority)
+{
+	fprintf(stderr, "Warning: built without D-Bus, "
+		"cannot ask RealtimeKit.\n");
+
+	return -1;
+}
+#endif
+
+/** Apply the options to the calling thread
+ *
+ * \param opts The options.
+ * \param index 0 for the event thread, 1 and up for the render threads.
+ * \param name The thread name for warnings.
+ * \param status Where to store what the thread actually got.
+ *
+ * Failures only print warnings, the program still works without. When
+ * realtime scheduling is not permitted, RealtimeKit is asked instead,
+ * which only grants SCHED_RR.
+ *
+ * Threads inherit both the policy and the affinity, so call this only
+ * after creating any helper threads that should not get them.
+ */
+void
+realtime_setup_thread(const struct realtime_options *opts, unsigned index,
+		      const char *name, struct realtime_status *status)
+{
+	struct sched_param param = { .sched_priority = opts->priority };
+	cpu_set_t set;
+	int policy;
+	int ret;
+
+	status->cpu = -1;
+	status->rtkit = false;
+
+	if (opts->cpu_count > 0) {
+		status->cpu = realtime_pick_cpu(opts, index);
+		CPU_ZERO(&set);
+		CPU_SET(status->cpu, &set);
+
+		ret = pthread_setaffinity_np(pthread_self(), sizeof set, &set);
+		if (ret != 0) {
+			fprintf(stderr, "Warning: could not pin the %s thread "
+				"to CPU %d: %s\n", name, status->cpu,
+				strerror(ret));
+			status->cpu = -1;
+		}
+	}
+
+	if (opts->policy != SCHED_OTHER) {
+		ret = pthread_setschedparam(pthread_self(), opts->policy,
+					    &param);
+		if (ret == EPERM)
+			status->rtkit = rtkit_make_realtime(opts->priority) == 0;
+		else if (ret != 0)
+			fprintf(stderr, "Warning: could not make the %s thread "
+				"realtime: %s\n", name, strerror(ret));
+	}
+
+	if (pthread_getschedparam(pthread_self(), &policy, &param) != 0) {
+		policy = SCHED_OTHER;
+		param.sched_priority = 0;
+	}
+
+	status->policy = policy & ~SCHED_RESET_ON_FORK;
+	status->priority = param.sched_priority;
+}
+
+/** Lock the memory mapped so far
+ *
+ * \param opts The options.
+ *
+ * Call once everything for the main loop has been allocated: the pools,
+ * the rings and the thread stacks. Future mappings are not locked,
+ * because the driver allocates buffers on resize and those would start
+ * failing past RLIMIT_MEMLOCK.
+ */
+void
+realtime_lock_memory(const struct realtime_options *opts)
+{
+	if (!opts->lock_memory)
+		return;
+
+	if (mlockall(MCL_CURRENT) < 0)
+		perror("Warning: mlockall failed");
+}
+
+static const char *
+policy_name(int policy)
+{
+	switch (policy) {
+	case SCHED_OTHER:
+		return "SCHED_OTHER";
+	case SCHED_FIFO:
+		return "SCHED_FIFO";
+	case SCHED_RR:
+		return "SCHED_RR";
+#ifdef SCHED_BATCH
+	case SCHED_BATCH:
+		return "SCHED_BATCH";
+#endif
+#ifdef SCHED_IDLE
+	case SCHED_IDLE:
+		return "SCHED_IDLE";
+#endif
+	}
+
+	return "unknown policy";
+}
+
+/** Print what a thread got
+ *
+ * \param status The status from realtime_setup_thread().
+ * \param name The thread name.
+ */
+void
+realtime_status_print(const struct realtime_status *status,
+		      const char *name)
+{
+	printf("\t%s thread: %s", name, policy_name(status->policy));
+	if (status->policy == SCHED_FIFO || status->policy == SCHED_RR)
+		printf(" priority %d", status->priority);
+	if (status->rtkit)
+		printf(" through RealtimeKit");
+	if (status->cpu >= 0)
+		printf(", on CPU %d", status->cpu);
+	printf("\n");
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright © 2016 Pekka Paalanen <pq@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef ORING_REALTIME_H
+#define ORING_REALTIME_H
+
+#include <stdbool.h>
+
+#define REALTIME_MAX_CPUS 16
+
+/** How to schedule the time critical threads
+ *
+ * The event thread takes the first CPU of the list, and the render
+ * threads go round the rest of it, or all of it if it has only one CPU.
+ */
+struct realtime_options {
+	int policy; /* SCHED_FIFO or SCHED_RR, SCHED_OTHER leaves it alone */
+	int priority;
+	int cpus[REALTIME_MAX_CPUS];
+	unsigned cpu_count; /* zero for no pinning */
+	bool lock_memory;
+};
+
+/** What a thread actually got, for the statistics */
+struct realtime_status {
+	int policy;
+	int priority;
+	int cpu; /* pinned to, or -1 */
+	bool rtkit; /* granted through RealtimeKit */
+};
+
+void
+realtime_options_init(struct realtime_options *opts);
+
+int
+realtime_parse_policy(struct realtime_options *opts, const char *arg);
+
+int
+realtime_parse_cpus(struct realtime_options *opts, const char *arg);
+
+void
+realtime_setup_thread(const struct realtime_options *opts, unsigned index,
+		      const char *name, struct realtime_status *status);
+
+void
+realtime_lock_memory(const struct realtime_options *opts);
+
+void
+realtime_status_print(const struct realtime_status *status,
+		      const char *name);
+
+#endif /* ORING_REALTIME_H */
@@ -0,0 +1,198 @@
+/*
+ * Copyright © 2016 Pekka Paalanen <pq@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <assert.h>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <drm_fourcc.h>
+
+#include "render-format.h"
+#include "helpers.h"
+
+#ifndef EGL_EXT_pixel_format_float
+#define EGL_COLOR_COMPONENT_TYPE_EXT 0x3339
+#define EGL_COLOR_COMPONENT_TYPE_FIXED_EXT 0x333A
+#define EGL_COLOR_COMPONENT_TYPE_FLOAT_EXT 0x333B
+#endif
+
+static const struct render_format_info formats[] = {
+	[RENDER_FORMAT_RGB565] = {
+		"rgb565", 5, 6, 5, 0, false,
+		DRM_FORMAT_RGB565, DRM_FORMAT_RGB565,
+	},
+	[RENDER_FORMAT_XRGB8888] = {
+		"xrgb8888", 8, 8, 8, 8, false,
+		DRM_FORMAT_XRGB8888, DRM_FORMAT_ARGB8888,
+	},
+	[RENDER_FORMAT_ARGB2101010] = {
+		"argb2101010", 10, 10, 10, 2, false,
+		DRM_FORMAT_XRGB2101010, DRM_FORMAT_ARGB2101010,
+	},
+	[RENDER_FORMAT_FP16] = {
+		"fp16", 16, 16, 16, 16, true,
+		DRM_FORMAT_XBGR16161616F, DRM_FORMAT_ABGR16161616F,
+	},
+};
+
+/** Get the description of a render format
+ *
+ * \param format The format.
+ * \return The description, never NULL.
+ */
+const struct render_format_info *
+render_format_get(enum render_format format)
+{
+	assert(format < ARRAY_LENGTH(formats));
+
+	return &formats[format];
+}
+
+/** Look up a render format by name
+ *
+ * \param name The name as in struct render_format_info.
+ * \param format Returns the format.
+ * \return 0 on success, -1 if the name is not known.
+ */
+int
+render_format_parse(const char *name, enum render_format *format)
+{
+	unsigned i;
+
+	for (i = 0; i < ARRAY_LENGTH(formats); i++) {
+		if (strcmp(formats[i].name, name) == 0) {
+			*format = i;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+static bool
+config_matches(EGLDisplay dpy, EGLConfig config,
+	       const struct render_format_info *info, int alpha)
+{
+	EGLint r, g, b, a;
+
+	eglGetConfigAttrib(dpy, config, EGL_RED_SIZE, &r);
+	eglGetConfigAttrib(dpy, config, EGL_GREEN_SIZE, &g);
+	eglGetConfigAttrib(dpy, config, EGL_BLUE_SIZE, &b);
+	eglGetConfigAttrib(dpy, config, EGL_ALPHA_SIZE, &a);
+
+	return r == info->red && g == info->green && b == info->blue &&
+	       a == alpha;
+}
+
+/** Choose the EGLConfig for a render format
+ *
+ * \param dpy The initialized EGLDisplay.
+ * \param format The render format.
+ * \param has_alpha Whether the window is translucent. Formats without
+ * alpha are always opaque.
+ * \param surface_type The EGL_SURFACE_TYPE bits needed.
+ * \param float_configs Whether the display has EGL_EXT_pixel_format_float.
+ * \return The config with exactly the channel sizes of the format, or
+ * NULL if there is none.
+ *
+ * eglChooseConfig() returns configs at least as deep as asked for, so
+ * the exact match is picked from those. An opaque window that only gets
+ * a config with alpha still works, but the compositor has to rely on
+ * the opaque region to skip blending, so that is the last resort.
+ */
+EGLConfig
+render_format_choose_config(EGLDisplay dpy, enum render_format format,
+			    bool has_alpha, EGLint surface_type,
+			    bool float_configs)
+{
+	const struct render_format_info *info = render_format_get(format);
+	int alpha = has_alpha ? info->alpha : 0;
+	EGLint attribs[] = {
+		EGL_SURFACE_TYPE, surface_type,
+		EGL_RED_SIZE, info->red,
+		EGL_GREEN_SIZE, info->green,
+		EGL_BLUE_SIZE, info->blue,
+		EGL_ALPHA_SIZE, alpha,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+		EGL_NONE, EGL_NONE,
+		EGL_NONE
+	};
+	EGLConfig *configs;
+	EGLConfig chosen = NULL;
+	EGLint n, i;
+
+	/* Without the extension every config is fixed point. */
+	if (float_configs) {
+		attribs[12] = EGL_COLOR_COMPONENT_TYPE_EXT;
+		attribs[13] = info->is_float ?
+			      EGL_COLOR_COMPONENT_TYPE_FLOAT_EXT :
+			      EGL_COLOR_COMPONENT_TYPE_FIXED_EXT;
+	} else if (info->is_float) {
+		fprintf(stderr, "Error: %s needs EGL_EXT_pixel_format_float.\n",
+			info->name);
+		return NULL;
+	}
+
+	if (!eglChooseConfig(dpy, attribs, NULL, 0, &n) || n < 1)
+		return NULL;
+
+	configs = calloc(n, sizeof *configs);
+	assert(configs);
+
+	if (!eglChooseConfig(dpy, attribs, configs, n, &n))
+		n = 0;
+
+	for (i = 0; i < n && !chosen; i++) {
+		if (config_matches(dpy, configs[i], info, alpha))
+			chosen = configs[i];
+	}
+
+	for (i = 0; i < n && !chosen && alpha == 0; i++) {
+		if (config_matches(dpy, configs[i], info, info->alpha))
+			chosen = configs[i];
+	}
+
+	free(configs);
+
+	return chosen;
+}
+
+/** Get the dmabuf format for a render format
+ *
+ * \param format The render format.
+ * \param has_alpha Whether the window is translucent.
+ * \return The DRM_FORMAT_* code.
+ */
+uint32_t
+render_format_get_drm(enum render_format format, bool has_alpha)
+{
+	const struct render_format_info *info = render_format_get(format);
+
+	return has_alpha ? info->drm_alpha : info->drm_opaque;
+}
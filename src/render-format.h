@@ -0,0 +1,71 @@
+/*
+ * Copyright © 2016 Pekka Paalanen <pq@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef ORING_RENDER_FORMAT_H
+#define ORING_RENDER_FORMAT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <EGL/egl.h>
+
+/** Pixel formats to render in, cheapest in bandwidth first */
+enum render_format {
+	RENDER_FORMAT_RGB565,
+	RENDER_FORMAT_XRGB8888,
+	RENDER_FORMAT_ARGB2101010,
+	RENDER_FORMAT_FP16,
+	RENDER_FORMAT_COUNT
+};
+
+/** Channel sizes and buffer formats of a render format
+ *
+ * Each format has an opaque variant, used for opaque windows so that
+ * the compositor need not blend them, and a variant with alpha if the
+ * format has one.
+ */
+struct render_format_info {
+	const char *name; /* for the command line */
+	int red, green, blue;
+	int alpha; /* bits of the alpha variant, zero if none */
+	bool is_float; /* needs EGL_EXT_pixel_format_float */
+	uint32_t drm_opaque; /* DRM_FORMAT_* */
+	uint32_t drm_alpha; /* DRM_FORMAT_*, the same if no alpha variant */
+};
+
+const struct render_format_info *
+render_format_get(enum render_format format);
+
+int
+render_format_parse(const char *name, enum render_format *format);
+
+EGLConfig
+render_format_choose_config(EGLDisplay dpy, enum render_format format,
+			    bool has_alpha, EGLint surface_type,
+			    bool float_configs);
+
+uint32_t
+render_format_get_drm(enum render_format format, bool has_alpha);
+
+#endif /* ORING_RENDER_FORMAT_H */
@@ -0,0 +1,447 @@
+/*
+ * Copyright © 2016 Pekka Paalanen <pq@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+
+#include <wayland-client.h>
+
+#include "cal.h"
+#include "render-thread.h"
+#include "renderer.h"
+#include "trace.h"
+#include "xalloc.h"
+#include "helpers.h"
+
+#include "viewporter-client-protocol.h"
+#include "xdg-shell-client-protocol.h"
+#include "fifo-v1-client-protocol.h"
+
+#define RENDER_JOB_CAPACITY 8
+
+/* Room for a commit and a GPU timing message per job */
+#define RENDER_DONE_CAPACITY (2 * RENDER_JOB_CAPACITY)
+
+struct render_job {
+	struct submission *subm;
+	struct geometry size; /* buffer size */
+	struct geometry surface_size; /* differs if scaled by the viewport */
+	bool opaque;
+	bool ack_configure; /* with this size, before the commit */
+	uint32_t configure_serial;
+};
+
+static void
+render_thread_send(struct render_thread *rt, const struct render_done *done)
+{
+	uint64_t one = 1;
+
+	/* Each job sends at most two messages, so this cannot fail. */
+	if (!spsc_ring_push(&rt->done, done))
+		assert(0 && "render done ring overflow");
+
+	if (write(rt->done_fd, &one, sizeof one) < 0)
+		perror("Error signalling render done");
+}
+
+/* Scale a lower resolution buffer up to the window size, or reset the
+ * viewport when the buffer is at full size. Goes with the next commit.
+ */
+static void
+render_thread_set_viewport(struct render_thread *rt,
+			   const struct render_job *job)
+{
+	struct wp_viewport *viewport = rt->viewport;
+	int width = -1;
+	int height = -1;
+
+	if (!viewport)
+		return;
+
+	if (job->size.width != job->surface_size.width ||
+	    job->size.height != job->surface_size.height) {
+		width = job->surface_size.width;
+		height = job->surface_size.height;
+	}
+
+	if (width == rt->dest_width && height == rt->dest_height)
+		return;
+
+	wp_viewport_set_destination(viewport, width, height);
+	rt->dest_width = width;
+	rt->dest_height = height;
+}
+
+static void
+render_thread_clear_gpu_fence(struct render_thread *rt)
+{
+	if (rt->gpu_fence_fd >= 0)
+		close(rt->gpu_fence_fd);
+	rt->gpu_fence_fd = -1;
+}
+
+/* The fence of the newest timed frame signals after all GPU timer
+ * queries so far, so waiting for it is enough. The main thread owns the
+ * original.
+ */
+static void
+render_thread_set_gpu_fence(struct render_thread *rt, int fence_fd)
+{
+	render_thread_clear_gpu_fence(rt);
+
+	rt->gpu_fence_fd = fcntl(fence_fd, F_DUPFD_CLOEXEC, 0);
+	if (rt->gpu_fence_fd < 0)
+		perror("Error duplicating render fence");
+}
+
+static void
+render_job_run(struct render_thread *rt, const struct render_job *job)
+{
+	struct window *window = rt->window;
+	struct oring_clock *clock = &window->display->gfx_clock;
+	struct render_done done = {
+		.type = RENDER_DONE_COMMIT,
+		.subm = job->subm,
+		.fence_fd = -1,
+	};
+
+	done.render_start_time = oring_clock_get_nsec_now(clock);
+	trace_emit(rt->trace, TRACE_RENDER_BEGIN, done.render_start_time,
+		   job->subm->id, 0, 0);
+
+	renderer_window_resize(window->render_window,
+			       job->size.width, job->size.height);
+	render_thread_set_viewport(rt, job);
+	rt->surface_width = job->surface_size.width;
+	rt->surface_height = job->surface_size.height;
+	rt->opaque = job->opaque;
+
+	if (job->ack_configure && rt->xdg_surface)
+		xdg_surface_ack_configure(rt->xdg_surface,
+					  job->configure_serial);
+
+	/* Queue behind the previous frame instead of replacing it, and
+	 * hold the next one until this one has been shown.
+	 */
+	if (rt->fifo) {
+		wp_fifo_v1_wait_barrier(rt->fifo);
+		wp_fifo_v1_set_barrier(rt->fifo);
+	}
+
+	redraw(window, job->subm, &done);
+	if (done.gpu_timed && done.fence_fd >= 0)
+		render_thread_set_gpu_fence(rt, done.fence_fd);
+	done.commit_time = oring_clock_get_nsec_now(clock);
+	trace_emit(rt->trace, TRACE_RENDER_END, done.commit_time,
+		   job->subm->id, 0, 0);
+
+	/* eglSwapBuffers flushes, but do not leave anything of ours
+	 * waiting for the main thread to wake up.
+	 */
+	wl_display_flush(window->display->display);
+
+	/* From here on the submission belongs to the main thread alone,
+	 * the GPU timing message only refers to it.
+	 */
+	render_thread_send(rt, &done);
+}
+
+static void
+render_thread_send_gpu_timings(struct render_thread *rt)
+{
+	struct render_done done;
+
+	while (renderer_get_gpu_timing(rt->window, &done))
+		render_thread_send(rt, &done);
+}
+
+/* Sleep until the main thread kicks us, or until the GPU is done with
+ * frames whose timer results are still to come. Without a native fence
+ * those are collected after the next job. Returns false on fatal errors.
+ */
+static bool
+render_thread_wait(struct render_thread *rt)
+{
+	struct pollfd pfd[2];
+	uint64_t count;
+
+	if (!renderer_has_gpu_timing_pending(rt->window))
+		render_thread_clear_gpu_fence(rt);
+
+	/* poll() ignores the fence entry while it is -1. */
+	pfd[0].fd = rt->wake_fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = rt->gpu_fence_fd;
+	pfd[1].events = POLLIN;
+
+	if (poll(pfd, 2, -1) < 0) {
+		if (errno == EINTR)
+			return true;
+		perror("Error polling render thread wake fd");
+		return false;
+	}
+
+	if (pfd[1].revents)
+		render_thread_clear_gpu_fence(rt);
+
+	if (!(pfd[0].revents & POLLIN))
+		return true;
+
+	if (read(rt->wake_fd, &count, sizeof count) < 0 && errno != EINTR) {
+		perror("Error reading render thread wake fd");
+		return false;
+	}
+
+	return true;
+}
+
+static void *
+render_thread_main(void *data)
+{
+	struct render_thread *rt = data;
+	struct window *window = rt->window;
+	struct render_job job;
+
+	realtime_setup_thread(&window->display->realtime, rt->index,
+			      "render", &window->render_sched);
+
+	/* The EGL context is never current in any other thread. */
+	renderer_window_make_current(window->render_window);
+	init_gl(window);
+
+	while (!__atomic_load_n(&rt->quit, __ATOMIC_ACQUIRE)) {
+		while (spsc_ring_pop(&rt->jobs, &job)) {
+			render_job_run(rt, &job);
+			render_thread_send_gpu_timings(rt);
+		}
+
+		render_thread_send_gpu_timings(rt);
+		if (!render_thread_wait(rt))
+			break;
+	}
+
+	renderer_window_release_current(window->render_window);
+
+	return NULL;
+}
+
+/* A wrapper on the render thread queue, NULL for a NULL proxy */
+static void *
+render_thread_wrap(struct render_thread *rt, void *proxy)
+{
+	void *wrapper;
+
+	if (!proxy)
+		return NULL;
+
+	wrapper = wl_proxy_create_wrapper(proxy);
+	wl_proxy_set_queue(wrapper, rt->queue);
+
+	return wrapper;
+}
+
+static void
+render_thread_unwrap(void *wrapper)
+{
+	if (wrapper)
+		wl_proxy_wrapper_destroy(wrapper);
+}
+
+/** Create and start a render thread for a window
+ *
+ * \param window The window to render, with render_window already created.
+ * \return A new render thread.
+ *
+ * The thread makes the window's EGL context current and initializes GL
+ * before processing any submitted targets. From now on the main thread
+ * must not call into GL or EGL for this window.
+ *
+ * The render thread sends all its requests through proxy wrappers on
+ * its own event queue, made here of the objects the window has by now.
+ * The frame callbacks and presentation feedback it creates are moved to
+ * the main queue before the commit, see submission_request_feedback().
+ */
+struct render_thread *
+render_thread_create(struct window *window)
+{
+	struct render_thread *rt;
+	struct display *d = window->display;
+	int ret;
+
+	rt = xzalloc(sizeof *rt);
+	rt->window = window;
+	rt->dest_width = -1;
+	rt->dest_height = -1;
+	rt->gpu_fence_fd = -1;
+	rt->index = wl_list_length(&d->window_list);
+	rt->trace = trace_buffer_create(d->trace, "render",
+					oring_clock_get_nsec_now(&d->gfx_clock));
+
+	spsc_ring_init(&rt->jobs, sizeof(struct render_job),
+		       RENDER_JOB_CAPACITY);
+	spsc_ring_init(&rt->done, sizeof(struct render_done),
+		       RENDER_DONE_CAPACITY);
+
+	rt->wake_fd = eventfd(0, EFD_CLOEXEC);
+	rt->done_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (rt->wake_fd < 0 || rt->done_fd < 0) {
+		perror("Error creating render thread eventfd");
+		exit(1);
+	}
+
+	rt->queue = wl_display_create_queue(d->display);
+
+	rt->compositor = render_thread_wrap(rt, d->compositor);
+	rt->surface = render_thread_wrap(rt, window->surface);
+	rt->presentation = render_thread_wrap(rt, d->presentation);
+	rt->xdg_surface = render_thread_wrap(rt, window->xdg_surface);
+	rt->viewport = render_thread_wrap(rt, window->viewport);
+	rt->fifo = render_thread_wrap(rt, window->fifo);
+	rt->commit_timer = render_thread_wrap(rt, window->commit_timer);
+
+	ret = pthread_create(&rt->thread, NULL, render_thread_main, rt);
+	if (ret != 0) {
+		errno = ret;
+		perror("Error creating render thread");
+		exit(1);
+	}
+
+	return rt;
+}
+
+static void
+render_thread_wake(struct render_thread *rt)
+{
+	uint64_t one = 1;
+
+	if (write(rt->wake_fd, &one, sizeof one) < 0)
+		perror("Error waking render thread");
+}
+
+/** Stop and destroy a render thread
+ *
+ * \param rt The render thread.
+ *
+ * Submissions not yet picked up by the render thread are dropped, and
+ * the main thread remains their owner. Returns after the thread has
+ * exited and released the EGL context.
+ */
+void
+render_thread_destroy(struct render_thread *rt)
+{
+	__atomic_store_n(&rt->quit, true, __ATOMIC_RELEASE);
+	render_thread_wake(rt);
+	pthread_join(rt->thread, NULL);
+
+	render_thread_unwrap(rt->commit_timer);
+	render_thread_unwrap(rt->fifo);
+	render_thread_unwrap(rt->viewport);
+	render_thread_unwrap(rt->xdg_surface);
+	render_thread_unwrap(rt->presentation);
+	render_thread_unwrap(rt->surface);
+	render_thread_unwrap(rt->compositor);
+	wl_event_queue_destroy(rt->queue);
+
+	render_thread_clear_gpu_fence(rt);
+	close(rt->done_fd);
+	close(rt->wake_fd);
+	spsc_ring_release(&rt->done);
+	spsc_ring_release(&rt->jobs);
+	free(rt);
+}
+
+/** Hand a submission over to the render thread for drawing
+ *
+ * \param rt The render thread.
+ * \param subm The submission with its target time, see redraw().
+ * \return 0 on success, -1 if the render thread is too far behind.
+ *
+ * Called from the main thread only. The latest configure is applied to
+ * the window geometry, which is passed along with the submission with
+ * the opaqueness, and the render thread resizes its buffers accordingly
+ * before drawing. The configure is acked right before that commit.
+ *
+ * The render thread hands the submission back through
+ * render_thread_get_done() after committing it.
+ */
+int
+render_thread_submit(struct render_thread *rt, struct submission *subm)
+{
+	const struct frame_quality *quality = frame_quality_get(subm->level);
+	struct render_job job = { .subm = subm };
+	struct geometry size;
+
+	job.ack_configure = window_take_configure(rt->window,
+						  &job.configure_serial);
+	size = rt->window->geometry;
+	job.surface_size = size;
+	job.opaque = rt->window->opaque || rt->window->fullscreen;
+
+	job.size.width = MAX(1, (int)(size.width * quality->scale + 0.5f));
+	job.size.height = MAX(1, (int)(size.height * quality->scale + 0.5f));
+
+	if (!spsc_ring_push(&rt->jobs, &job)) {
+		/* Ack it with the next one then. */
+		if (job.ack_configure)
+			rt->window->configure.pending = true;
+		return -1;
+	}
+
+	render_thread_wake(rt);
+
+	return 0;
+}
+
+/** Take a message from the render thread
+ *
+ * \param rt The render thread.
+ * \param done Returns the submission and its render timings.
+ * \return True if one was returned, false if there are no more.
+ *
+ * Called from the main thread only, when render_thread::done_fd becomes
+ * readable. This also resets done_fd.
+ */
+bool
+render_thread_get_done(struct render_thread *rt, struct render_done *done)
+{
+	uint64_t count;
+
+	if (spsc_ring_pop(&rt->done, done))
+		return true;
+
+	if (read(rt->done_fd, &count, sizeof count) < 0 && errno != EAGAIN)
+		perror("Error reading render done fd");
+
+	/* Catch a push that raced with the read. */
+	return spsc_ring_pop(&rt->done, done);
+}
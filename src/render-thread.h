@@ -0,0 +1,113 @@
+/*
+ * Copyright © 2016 Pekka Paalanen <pq@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef ORING_RENDER_THREAD_H
+#define ORING_RENDER_THREAD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include <wayland-client.h>
+
+#include "spsc-ring.h"
+
+struct window;
+struct submission;
+struct trace_buffer;
+struct wp_presentation;
+struct xdg_surface;
+struct wp_viewport;
+struct wp_fifo_v1;
+struct wp_commit_timer_v1;
+
+enum render_done_type {
+	RENDER_DONE_COMMIT, /* the frame was committed */
+	RENDER_DONE_GPU_TIMING, /* GPU timer results of a committed frame */
+};
+
+/** A message about a submission, handed back to the main thread
+ *
+ * A RENDER_DONE_COMMIT with gpu_timed set is always followed later by
+ * a RENDER_DONE_GPU_TIMING for the same submission.
+ */
+struct render_done {
+	enum render_done_type type;
+	struct submission *subm;
+
+	/* RENDER_DONE_COMMIT */
+	uint64_t render_start_time;
+	uint64_t commit_time;
+	bool gpu_timed;
+	int fence_fd; /* signalled when the GPU is done, or -1 */
+
+	/* RENDER_DONE_GPU_TIMING, INVALID_TIME if the results were lost */
+	uint64_t gpu_start_time;
+	uint64_t gpu_end_time;
+};
+
+struct render_thread {
+	struct window *window;
+	pthread_t thread;
+	unsigned index; /* see realtime_setup_thread() */
+	bool quit;
+
+	/* Submissions from the main thread, struct render_job */
+	struct spsc_ring jobs;
+	int wake_fd;
+
+	/* Messages to the main thread, struct render_done */
+	struct spsc_ring done;
+	int done_fd;
+
+	/* Render thread only. All its requests go through these wrappers
+	 * on queue, NULL where the window lacks the object. */
+	struct wl_event_queue *queue;
+	struct wl_compositor *compositor;
+	struct wl_surface *surface;
+	struct wp_presentation *presentation;
+	struct xdg_surface *xdg_surface;
+	struct wp_viewport *viewport;
+	struct wp_fifo_v1 *fifo;
+	struct wp_commit_timer_v1 *commit_timer;
+	int surface_width, surface_height; /* of the current job */
+	int dest_width, dest_height; /* viewport destination, -1 if unset */
+	bool opaque;
+	int gpu_fence_fd; /* wakes us for GPU timer results, or -1 */
+	struct trace_buffer *trace;
+};
+
+struct render_thread *
+render_thread_create(struct window *window);
+
+void
+render_thread_destroy(struct render_thread *rt);
+
+int
+render_thread_submit(struct render_thread *rt, struct submission *subm);
+
+bool
+render_thread_get_done(struct render_thread *rt, struct render_done *done);
+
+#endif /* ORING_RENDER_THREAD_H */
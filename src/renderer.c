@@ -25,53 +25,343 @@
 #include "config.h"
 
 #include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
 #include <assert.h>
 #include <stdio.h>
-#include <sys/time.h>
+#include <math.h>
+#include <errno.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
 
 #include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
+#include <gbm.h>
+#include <drm_fourcc.h>
 
 #include "cal.h"
 #include "platform.h"
 #include "renderer.h"
+#include "render-thread.h"
+#include "scene.h"
+#include "program-cache.h"
+#include "damage.h"
+#include "helpers.h"
 #include "xalloc.h"
 
+#include "linux-dmabuf-unstable-v1-client-protocol.h"
+#include "linux-explicit-synchronization-unstable-v1-client-protocol.h"
+
 struct renderer_display {
 	EGLDisplay dpy;
 	EGLint egl_major;
 	EGLint egl_minor;
 
 	EGLint n_configs;
+	bool float_configs; /* EGL_EXT_pixel_format_float */
+
+	/* EGL setup runs here while the main thread binds globals */
+	pthread_t init_thread;
+	bool init_pending;
+	struct wl_display *wdisp;
+	int warm_up_cost; /* fragment cost of the programs to prebuild */
+
+	/* Root of the share group of all window contexts, current only
+	 * on the init thread for building programs ahead of the windows
+	 */
+	EGLContext share_ctx;
+	struct program_cache programs;
+
+	/* EGL_ANDROID_native_fence_sync, NULL if not supported */
+	PFNEGLCREATESYNCKHRPROC create_sync;
+	PFNEGLDESTROYSYNCKHRPROC destroy_sync;
+	PFNEGLDUPNATIVEFENCEFDANDROIDPROC dup_native_fence_fd;
+	PFNEGLWAITSYNCKHRPROC wait_sync; /* EGL_KHR_wait_sync, or NULL */
+
+	/* EGL_KHR or EXT_swap_buffers_with_damage, or NULL */
+	PFNEGLSWAPBUFFERSWITHDAMAGEEXTPROC swap_with_damage;
+	bool buffer_age; /* EGL_EXT_buffer_age */
+
+	/* For windows with their own buffers, opened on first use */
+	int drm_fd;
+	struct gbm_device *gbm;
+	bool import_modifiers; /* EGL_EXT_image_dma_buf_import_modifiers */
+	PFNEGLCREATEIMAGEKHRPROC create_image;
+	PFNEGLDESTROYIMAGEKHRPROC destroy_image;
+	PFNGLEGLIMAGETARGETRENDERBUFFERSTORAGEOESPROC image_target_storage;
+};
+
+/** A dmabuf the window renders into through an FBO */
+struct dmabuf_buffer {
+	struct dmabuf_swapchain *swapchain;
+
+	struct gbm_bo *bo;
+	struct wl_buffer *wl_buffer; /* on the render thread queue */
+	EGLImageKHR image;
+	GLuint rbo;
+	GLuint fbo;
+	int width, height;
+
+	uint64_t frame; /* swapchain frame it was last drawn for, 0 if none */
+	bool busy; /* committed and not yet released by the compositor */
+	struct zwp_linux_buffer_release_v1 *release; /* explicit sync only */
+	int release_fence_fd; /* wait before drawing again, or -1 */
+};
+
+/** Buffers allocated and recycled by the application
+ *
+ * Instead of wl_egl_window and eglSwapBuffers, each frame is drawn into
+ * the oldest released buffer and committed with zwp_linux_dmabuf_v1. The
+ * depth is the number of buffers, and when all of them are held by the
+ * compositor the render thread waits for a release.
+ */
+struct dmabuf_swapchain {
+	int depth;
+	struct dmabuf_buffer buffers[RENDERER_MAX_BUFFERS];
+	struct dmabuf_buffer *current; /* being drawn, or NULL */
+	uint32_t format;
+	uint64_t frame_count; /* frames committed */
+
+	/* Created on the render thread, see swapchain_bind() */
+	struct wl_display *wdisp;
+	struct wl_event_queue *queue;
+	struct zwp_linux_dmabuf_v1 *dmabuf; /* wrapper on queue */
+	struct zwp_linux_surface_synchronization_v1 *sync; /* or NULL */
+	const struct wl_array *modifiers; /* struct dmabuf_modifier */
 };
 
+/* Buffers older than this many frames are redrawn in full */
+#define DAMAGE_HISTORY 4
+
 struct renderer_window {
 	struct renderer_display *render_display;
 
 	EGLContext ctx;
 	EGLConfig conf;
 
+	/* Either an EGL window surface, or our own buffers */
 	struct wl_egl_window *native;
 	EGLSurface egl_surface;
+	struct dmabuf_swapchain *swapchain;
+	int width, height;
+
+	int swapinterval;
+
+	/* Damage of the latest frames, newest first, see redraw() */
+	struct damage damage_history[DAMAGE_HISTORY];
+	int damage_count;
+};
+
+/* A line segment per stat and sample pair, and the reference line */
+#define GRAPH_MAX_VERTICES \
+	(FRAME_STAT_COUNT * (FRAME_STATS_HISTORY - 1) * 2 + 2)
+
+enum attrib_location {
+	ATTRIB_POS = 0,
+	ATTRIB_COLOR = 1,
+	ATTRIB_INSTANCE = 2,
+};
+
+/* Indexed by enum attrib_location */
+static const char * const attrib_names[] = {
+	"pos",
+	"color",
+	"instance",
+	NULL
+};
+
+struct vertex {
+	GLfloat pos[2];
+	GLfloat color[3];
+};
+
+#define GPU_TIMER_SLOTS 8
+
+/** GPU timestamps around the drawing of one submission */
+struct gpu_timer {
+	struct submission *subm; /* only passed back, never dereferenced */
+	GLuint queries[2]; /* before and after drawing */
+	int64_t offset; /* gfx_clock minus GL time when started */
 };
 
 struct renderer_state {
-	GLuint rotation_uniform;
-	GLuint pos;
-	GLuint col;
+	GLuint mesh_program;
+	GLuint layer_program;
+	GLuint graph_program;
+
+	GLuint vbo;
+	GLuint instance_vbo;
+	GLuint mesh_vao;
+	GLuint layer_vao;
+	GLuint graph_vbo;
+	GLuint graph_vao;
+	PFNGLGENVERTEXARRAYSOESPROC gen_vertex_arrays;
+	PFNGLBINDVERTEXARRAYOESPROC bind_vertex_array;
+	PFNGLDRAWARRAYSINSTANCEDEXTPROC draw_arrays_instanced;
+	PFNGLVERTEXATTRIBDIVISOREXTPROC vertex_attrib_divisor;
+
+	struct vertex graph[GRAPH_MAX_VERTICES];
+	int graph_count; /* vertices uploaded for this frame */
+
+	/* GL_EXT_disjoint_timer_query, NULL if not supported */
+	PFNGLGENQUERIESEXTPROC gen_queries;
+	PFNGLGETQUERYIVEXTPROC get_queryiv;
+	PFNGLQUERYCOUNTEREXTPROC query_counter;
+	PFNGLGETQUERYOBJECTIVEXTPROC get_query_objectiv;
+	PFNGLGETQUERYOBJECTUI64VEXTPROC get_query_objectui64v;
+	PFNGLGETINTEGER64VEXTPROC get_integer64v;
+
+	/* timers in flight, oldest first */
+	struct gpu_timer timers[GPU_TIMER_SLOTS];
+	unsigned timer_head;
+	unsigned timer_count;
+
+	/* What was drawn in the previous frame, see get_scene_damage() */
+	int drawn_width, drawn_height; /* 0 before the first frame */
+	int drawn_instances;
+	int drawn_layers;
+	struct box mesh_boxes[]; /* one per scene instance */
 };
 
-struct renderer_display *
-renderer_display_create(struct wl_display *wdisp)
+/* The mesh triangle followed by the full-window overdraw quad. */
+#define MESH_FIRST 0
+#define MESH_COUNT 3
+#define LAYER_FIRST 3
+#define LAYER_COUNT 4
+
+static const struct vertex vertices[MESH_COUNT + LAYER_COUNT] = {
+	{ { -0.5, -0.5 }, { 1, 0, 0 } },
+	{ {  0.5, -0.5 }, { 0, 1, 0 } },
+	{ {  0,    0.5 }, { 0, 0, 1 } },
+
+	{ { -1, -1 }, { 1, 1, 1 } },
+	{ {  1, -1 }, { 1, 1, 1 } },
+	{ { -1,  1 }, { 1, 1, 1 } },
+	{ {  1,  1 }, { 1, 1, 1 } },
+};
+
+static bool
+extension_list_has(const char *exts, const char *name)
 {
-	struct renderer_display *rd;
-	EGLBoolean ret;
+	size_t len = strlen(name);
+	const char *p;
 
-	rd = xzalloc(sizeof *rd);
+	for (p = exts; p && (p = strstr(p, name)); p += len) {
+		if ((p == exts || p[-1] == ' ') &&
+		    (p[len] == ' ' || p[len] == '\0'))
+			return true;
+	}
+
+	return false;
+}
+
+/** Check for a GL extension in the current context
+ *
+ * \param name The full extension name.
+ * \return True if the extension is listed.
+ */
+static bool
+gl_has_extension(const char *name)
+{
+	return extension_list_has((const char *)glGetString(GL_EXTENSIONS),
+				  name);
+}
+
+/* Native fence FDs let the main thread see when the GPU is done. */
+static void
+init_fence_sync(struct renderer_display *rd)
+{
+	const char *exts = eglQueryString(rd->dpy, EGL_EXTENSIONS);
+
+	if (!extension_list_has(exts, "EGL_KHR_fence_sync") ||
+	    !extension_list_has(exts, "EGL_ANDROID_native_fence_sync"))
+		return;
+
+	rd->create_sync = (PFNEGLCREATESYNCKHRPROC)
+		eglGetProcAddress("eglCreateSyncKHR");
+	rd->destroy_sync = (PFNEGLDESTROYSYNCKHRPROC)
+		eglGetProcAddress("eglDestroySyncKHR");
+	rd->dup_native_fence_fd = (PFNEGLDUPNATIVEFENCEFDANDROIDPROC)
+		eglGetProcAddress("eglDupNativeFenceFDANDROID");
+
+	if (!rd->create_sync || !rd->destroy_sync ||
+	    !rd->dup_native_fence_fd) {
+		rd->create_sync = NULL;
+		rd->destroy_sync = NULL;
+		rd->dup_native_fence_fd = NULL;
+		return;
+	}
+
+	if (extension_list_has(exts, "EGL_KHR_wait_sync"))
+		rd->wait_sync = (PFNEGLWAITSYNCKHRPROC)
+			eglGetProcAddress("eglWaitSyncKHR");
+}
+
+/* Damage lets the compositor skip the unchanged parts, and buffer age
+ * lets us skip them too.
+ */
+static void
+init_swap_damage(struct renderer_display *rd)
+{
+	const char *exts = eglQueryString(rd->dpy, EGL_EXTENSIONS);
+
+	if (extension_list_has(exts, "EGL_KHR_swap_buffers_with_damage"))
+		rd->swap_with_damage = (PFNEGLSWAPBUFFERSWITHDAMAGEEXTPROC)
+			eglGetProcAddress("eglSwapBuffersWithDamageKHR");
+	else if (extension_list_has(exts, "EGL_EXT_swap_buffers_with_damage"))
+		rd->swap_with_damage = (PFNEGLSWAPBUFFERSWITHDAMAGEEXTPROC)
+			eglGetProcAddress("eglSwapBuffersWithDamageEXT");
+
+	rd->buffer_age = extension_list_has(exts, "EGL_EXT_buffer_age");
+}
+
+static const EGLint context_attribs[] = {
+	EGL_CONTEXT_CLIENT_VERSION, 2,
+	EGL_NONE
+};
+
+/* All window contexts share one namespace, so that programs are built
+ * once per display instead of once per window. The root needs a config
+ * only without EGL_KHR_no_config_context, and sharing does not require
+ * the window configs to match it.
+ */
+static void
+init_share_context(struct renderer_display *rd)
+{
+	static const EGLint config_attribs[] = {
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+		EGL_NONE
+	};
+	const char *exts = eglQueryString(rd->dpy, EGL_EXTENSIONS);
+	EGLConfig conf = EGL_NO_CONFIG_KHR;
+	EGLint n;
+
+	if (!extension_list_has(exts, "EGL_KHR_no_config_context") &&
+	    (!eglChooseConfig(rd->dpy, config_attribs, &conf, 1, &n) ||
+	     n < 1)) {
+		fprintf(stderr, "Error: no EGLConfig for GL ES 2.\n");
+		exit(1);
+	}
+
+	rd->share_ctx = eglCreateContext(rd->dpy, conf, EGL_NO_CONTEXT,
+					 context_attribs);
+	if (!rd->share_ctx) {
+		fprintf(stderr, "Error: failed to create an EGL context.\n");
+		exit(1);
+	}
+}
+
+static void
+init_egl(struct renderer_display *rd)
+{
+	EGLBoolean ret;
 
 	rd->dpy = weston_platform_get_egl_display(EGL_PLATFORM_WAYLAND_KHR,
-						  wdisp, NULL);
+						  rd->wdisp, NULL);
 	if (!rd->dpy) {
 		fprintf(stderr, "Error: getting EGLDisplay failed.\n");
 		exit(1);
@@ -94,134 +384,768 @@ renderer_display_create(struct wl_display *wdisp)
 		fprintf(stderr, "Error: getting count of EGLConfigs failed.\n");
 		exit(1);
 	}
+	rd->float_configs =
+		extension_list_has(eglQueryString(rd->dpy, EGL_EXTENSIONS),
+				   "EGL_EXT_pixel_format_float");
+
+	init_fence_sync(rd);
+	init_swap_damage(rd);
+	init_share_context(rd);
+	program_cache_init(&rd->programs);
 
 	printf("Initialized EGL %d.%d on Wayland platform with GL ES.\n",
 	       rd->egl_major, rd->egl_minor);
+}
+
+static void
+build_programs(struct program_cache *programs, int fragment_cost,
+	       struct renderer_state *gl);
+
+/* Compiling or loading the programs is the bulk of init_gl(), and
+ * nothing in it needs a window. With a surfaceless share context the
+ * init thread puts them in the cache before the first window exists,
+ * and init_gl() only finds them there.
+ */
+static void
+warm_up_programs(struct renderer_display *rd)
+{
+	const char *exts = eglQueryString(rd->dpy, EGL_EXTENSIONS);
+	struct renderer_state gl;
+
+	if (!extension_list_has(exts, "EGL_KHR_surfaceless_context"))
+		return;
+
+	if (!eglMakeCurrent(rd->dpy, EGL_NO_SURFACE, EGL_NO_SURFACE,
+			    rd->share_ctx))
+		return;
+
+	build_programs(&rd->programs, rd->warm_up_cost, &gl);
+
+	eglMakeCurrent(rd->dpy, EGL_NO_SURFACE, EGL_NO_SURFACE,
+		       EGL_NO_CONTEXT);
+}
+
+static void *
+renderer_display_init_thread(void *data)
+{
+	struct renderer_display *rd = data;
+
+	init_egl(rd);
+	warm_up_programs(rd);
+	eglReleaseThread();
+
+	return NULL;
+}
+
+/** Start initializing EGL on a helper thread
+ *
+ * \param wdisp The Wayland display to initialize EGL on.
+ * \param fragment_cost The scene option the windows will be using, to
+ * build their programs in advance.
+ * \return A renderer display that must be waited on with
+ * renderer_display_wait() before making windows.
+ *
+ * EGL initialization does roundtrips of its own on a private queue, and
+ * may compile shaders, so it does not need to wait for the registry.
+ */
+struct renderer_display *
+renderer_display_create(struct wl_display *wdisp, int fragment_cost)
+{
+	struct renderer_display *rd;
+	int ret;
+
+	rd = xzalloc(sizeof *rd);
+	rd->wdisp = wdisp;
+	rd->drm_fd = -1;
+	rd->warm_up_cost = fragment_cost;
+
+	ret = pthread_create(&rd->init_thread, NULL,
+			     renderer_display_init_thread, rd);
+	if (ret != 0) {
+		errno = ret;
+		perror("Error creating EGL init thread");
+		exit(1);
+	}
+	rd->init_pending = true;
 
 	return rd;
 }
 
+/** Wait for renderer_display_create() to finish */
+void
+renderer_display_wait(struct renderer_display *rd)
+{
+	if (!rd->init_pending)
+		return;
+
+	pthread_join(rd->init_thread, NULL);
+	rd->init_pending = false;
+}
+
 void
 renderer_display_destroy(struct renderer_display *rd)
 {
+	renderer_display_wait(rd);
+	if (rd->gbm)
+		gbm_device_destroy(rd->gbm);
+	if (rd->drm_fd >= 0)
+		close(rd->drm_fd);
+	program_cache_release(&rd->programs);
+	eglDestroyContext(rd->dpy, rd->share_ctx);
 	eglTerminate(rd->dpy);
 	eglReleaseThread();
 	free(rd);
 }
 
-static const char *vert_shader_text =
-	"uniform mat4 rotation;\n"
-	"attribute vec4 pos;\n"
+static const char *mesh_vert_shader_text =
+	"attribute vec2 pos;\n"
 	"attribute vec4 color;\n"
+	"attribute vec4 instance;\n"
 	"varying vec4 v_color;\n"
 	"void main() {\n"
-	"  gl_Position = rotation * pos;\n"
+	"  vec2 p = pos * instance.z;\n"
+	"  float c = cos(instance.w);\n"
+	"  float s = sin(instance.w);\n"
+	"  gl_Position = vec4(instance.x + p.x * c, instance.y + p.y,\n"
+	"                     p.x * s, 1.0);\n"
 	"  v_color = color;\n"
 	"}\n";
 
+static const char *layer_vert_shader_text =
+	"attribute vec2 pos;\n"
+	"attribute vec3 color;\n"
+	"varying vec4 v_color;\n"
+	"void main() {\n"
+	"  gl_Position = vec4(pos, 0.0, 1.0);\n"
+	"  v_color = vec4(color, 1.0) * 0.03;\n"
+	"}\n";
+
+static const char *graph_vert_shader_text =
+	"attribute vec2 pos;\n"
+	"attribute vec3 color;\n"
+	"varying vec4 v_color;\n"
+	"void main() {\n"
+	"  gl_Position = vec4(pos, 0.0, 1.0);\n"
+	"  v_color = vec4(color, 1.0);\n"
+	"}\n";
+
+/* COST is defined by the program cache, see struct program_source. */
 static const char *frag_shader_text =
 	"precision mediump float;\n"
 	"varying vec4 v_color;\n"
 	"void main() {\n"
-	"  gl_FragColor = v_color;\n"
+	"  vec4 c = v_color;\n"
+	"#if COST > 0\n"
+	"  vec4 acc = vec4(0.0);\n"
+	"  for (int i = 0; i < COST; i++)\n"
+	"    acc += sin(c * float(i) + gl_FragCoord.xyxy * 0.01);\n"
+	"  c.rgb += acc.rgb * (0.001 / float(COST));\n"
+	"#endif\n"
+	"  gl_FragColor = c;\n"
 	"}\n";
 
-static EGLConfig
-egl_choose_config(struct renderer_display *rd,
-		  const EGLint *config_attribs, int buffer_bits)
+/* The render node should be the GPU that EGL renders with. With more
+ * than one, pick it with ORING_DRM_DEVICE.
+ */
+static void
+renderer_display_init_dmabuf(struct renderer_display *rd)
 {
-	EGLint n, i, size;
-	EGLConfig *configs;
-	EGLBoolean ret;
-	EGLConfig chosen = 0;
+	const char *exts = eglQueryString(rd->dpy, EGL_EXTENSIONS);
+	const char *path = getenv("ORING_DRM_DEVICE");
 
-	configs = calloc(rd->n_configs, sizeof *configs);
-	assert(configs);
+	if (rd->gbm)
+		return;
 
-	ret = eglChooseConfig(rd->dpy, config_attribs,
-			      configs, rd->n_configs, &n);
-	if (!ret || n < 1) {
-		fprintf(stderr, "Error: failed to find any EGLConfigs\n");
+	if (!extension_list_has(exts, "EGL_EXT_image_dma_buf_import") ||
+	    !extension_list_has(exts, "EGL_KHR_surfaceless_context")) {
+		fprintf(stderr, "Error: EGL cannot import dmabufs or "
+			"make a context current without a surface.\n");
+		exit(1);
+	}
+	rd->import_modifiers = extension_list_has(exts,
+		"EGL_EXT_image_dma_buf_import_modifiers");
+
+	rd->create_image = (PFNEGLCREATEIMAGEKHRPROC)
+		eglGetProcAddress("eglCreateImageKHR");
+	rd->destroy_image = (PFNEGLDESTROYIMAGEKHRPROC)
+		eglGetProcAddress("eglDestroyImageKHR");
+	rd->image_target_storage = (PFNGLEGLIMAGETARGETRENDERBUFFERSTORAGEOESPROC)
+		eglGetProcAddress("glEGLImageTargetRenderbufferStorageOES");
+	if (!rd->create_image || !rd->destroy_image ||
+	    !rd->image_target_storage) {
+		fprintf(stderr, "Error: EGLImage functions missing.\n");
 		exit(1);
 	}
 
-	for (i = 0; i < n; i++) {
-		eglGetConfigAttrib(rd->dpy, configs[i], EGL_BUFFER_SIZE, &size);
-		if (buffer_bits == size) {
-			chosen = configs[i];
-			break;
+	if (!path)
+		path = "/dev/dri/renderD128";
+
+	rd->drm_fd = open(path, O_RDWR | O_CLOEXEC);
+	if (rd->drm_fd < 0) {
+		fprintf(stderr, "Error: opening %s: %s\n",
+			path, strerror(errno));
+		exit(1);
+	}
+
+	rd->gbm = gbm_create_device(rd->drm_fd);
+	if (!rd->gbm) {
+		fprintf(stderr, "Error: creating a GBM device on %s failed.\n",
+			path);
+		exit(1);
+	}
+}
+
+static struct dmabuf_swapchain *
+swapchain_create(struct renderer_display *rd, int depth, uint32_t format)
+{
+	struct dmabuf_swapchain *sc;
+	int i;
+
+	assert(depth > 0 && depth <= RENDERER_MAX_BUFFERS);
+
+	if (!gbm_device_is_format_supported(rd->gbm, format,
+					    GBM_BO_USE_RENDERING)) {
+		fprintf(stderr, "Error: GBM cannot render to format 0x%08x.\n",
+			format);
+		exit(1);
+	}
+
+	sc = xzalloc(sizeof *sc);
+	sc->depth = depth;
+	sc->format = format;
+	for (i = 0; i < depth; i++) {
+		sc->buffers[i].swapchain = sc;
+		sc->buffers[i].release_fence_fd = -1;
+	}
+
+	return sc;
+}
+
+/* Explicit sync releases through zwp_linux_buffer_release_v1 alone, as
+ * wl_buffer.release would not say when the compositor's reads finish.
+ */
+static void
+buffer_handle_release(void *data, struct wl_buffer *wl_buffer)
+{
+	struct dmabuf_buffer *buf = data;
+
+	if (!buf->swapchain->sync)
+		buf->busy = false;
+}
+
+static const struct wl_buffer_listener buffer_listener = {
+	buffer_handle_release,
+};
+
+static void
+buffer_release_done(struct dmabuf_buffer *buf, int fence_fd)
+{
+	zwp_linux_buffer_release_v1_destroy(buf->release);
+	buf->release = NULL;
+
+	assert(buf->release_fence_fd < 0);
+	buf->release_fence_fd = fence_fd;
+	buf->busy = false;
+}
+
+static void
+buffer_release_fenced(void *data,
+		      struct zwp_linux_buffer_release_v1 *release,
+		      int32_t fence)
+{
+	buffer_release_done(data, fence);
+}
+
+static void
+buffer_release_immediate(void *data,
+			 struct zwp_linux_buffer_release_v1 *release)
+{
+	buffer_release_done(data, -1);
+}
+
+static const struct zwp_linux_buffer_release_v1_listener
+buffer_release_listener = {
+	buffer_release_fenced,
+	buffer_release_immediate,
+};
+
+/* Called on the render thread, where the buffer events are dispatched. */
+static void
+swapchain_bind(struct dmabuf_swapchain *sc, struct renderer_display *rd,
+	       struct window *window)
+{
+	struct display *d = window->display;
+	struct render_thread *rt = window->render_thread;
+
+	if (!gl_has_extension("GL_OES_EGL_image")) {
+		fprintf(stderr, "Error: GL_OES_EGL_image unavailable.\n");
+		exit(1);
+	}
+
+	sc->wdisp = d->display;
+	sc->queue = rt->queue;
+	sc->modifiers = &d->dmabuf_modifiers;
+
+	sc->dmabuf = wl_proxy_create_wrapper(d->dmabuf);
+	wl_proxy_set_queue((struct wl_proxy *)sc->dmabuf, sc->queue);
+
+	/* The acquire fence is the same one the stats wait for. */
+	if (d->explicit_sync && rd->create_sync) {
+		struct zwp_linux_explicit_synchronization_v1 *wrapper;
+
+		wrapper = wl_proxy_create_wrapper(d->explicit_sync);
+		wl_proxy_set_queue((struct wl_proxy *)wrapper, sc->queue);
+		sc->sync = zwp_linux_explicit_synchronization_v1_get_synchronization(
+				wrapper, rt->surface);
+		wl_proxy_wrapper_destroy(wrapper);
+	}
+}
+
+static struct gbm_bo *
+swapchain_alloc_bo(struct dmabuf_swapchain *sc, struct renderer_display *rd,
+		   int width, int height)
+{
+	const struct dmabuf_modifier *mod;
+	uint64_t *modifiers;
+	unsigned count = 0;
+	bool listed = false;
+	struct gbm_bo *bo = NULL;
+
+	/* Never more modifiers than entries, each entry is bigger */
+	modifiers = xzalloc(MAX(sc->modifiers->size, sizeof *modifiers));
+	wl_array_for_each(mod, sc->modifiers) {
+		if (mod->format != sc->format)
+			continue;
+
+		listed = true;
+		if (mod->modifier != DRM_FORMAT_MOD_INVALID)
+			modifiers[count++] = mod->modifier;
+	}
+
+	if (!listed) {
+		fprintf(stderr, "Error: compositor does not take dmabufs "
+			"in format 0x%08x.\n", sc->format);
+		exit(1);
+	}
+
+	if (count > 0 && rd->import_modifiers)
+		bo = gbm_bo_create_with_modifiers(rd->gbm, width, height,
+						  sc->format, modifiers, count);
+	free(modifiers);
+
+	if (!bo)
+		bo = gbm_bo_create(rd->gbm, width, height, sc->format,
+				   GBM_BO_USE_RENDERING);
+	if (!bo) {
+		fprintf(stderr, "Error: allocating a %dx%d buffer failed.\n",
+			width, height);
+		exit(1);
+	}
+
+	return bo;
+}
+
+static const EGLint plane_attribs[4][5] = {
+	{
+		EGL_DMA_BUF_PLANE0_FD_EXT,
+		EGL_DMA_BUF_PLANE0_OFFSET_EXT,
+		EGL_DMA_BUF_PLANE0_PITCH_EXT,
+		EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT,
+		EGL_DMA_BUF_PLANE0_MODIFIER_HI_EXT,
+	}, {
+		EGL_DMA_BUF_PLANE1_FD_EXT,
+		EGL_DMA_BUF_PLANE1_OFFSET_EXT,
+		EGL_DMA_BUF_PLANE1_PITCH_EXT,
+		EGL_DMA_BUF_PLANE1_MODIFIER_LO_EXT,
+		EGL_DMA_BUF_PLANE1_MODIFIER_HI_EXT,
+	}, {
+		EGL_DMA_BUF_PLANE2_FD_EXT,
+		EGL_DMA_BUF_PLANE2_OFFSET_EXT,
+		EGL_DMA_BUF_PLANE2_PITCH_EXT,
+		EGL_DMA_BUF_PLANE2_MODIFIER_LO_EXT,
+		EGL_DMA_BUF_PLANE2_MODIFIER_HI_EXT,
+	}, {
+		EGL_DMA_BUF_PLANE3_FD_EXT,
+		EGL_DMA_BUF_PLANE3_OFFSET_EXT,
+		EGL_DMA_BUF_PLANE3_PITCH_EXT,
+		EGL_DMA_BUF_PLANE3_MODIFIER_LO_EXT,
+		EGL_DMA_BUF_PLANE3_MODIFIER_HI_EXT,
+	},
+};
+
+/* Allocate, share with the compositor, and wrap in an FBO. The window
+ * context must be current.
+ */
+static void
+dmabuf_buffer_init(struct dmabuf_buffer *buf, struct renderer_display *rd,
+		   int width, int height)
+{
+	struct dmabuf_swapchain *sc = buf->swapchain;
+	struct zwp_linux_buffer_params_v1 *params;
+	EGLint attribs[6 + 4 * 10 + 1];
+	uint64_t modifier;
+	int planes;
+	int fd;
+	int i, n = 0;
+
+	buf->bo = swapchain_alloc_bo(sc, rd, width, height);
+	buf->width = width;
+	buf->height = height;
+
+	planes = MIN(gbm_bo_get_plane_count(buf->bo), 4);
+	modifier = gbm_bo_get_modifier(buf->bo);
+	fd = gbm_bo_get_fd(buf->bo);
+	if (fd < 0) {
+		fprintf(stderr, "Error: exporting a dmabuf failed.\n");
+		exit(1);
+	}
+
+	attribs[n++] = EGL_WIDTH;
+	attribs[n++] = width;
+	attribs[n++] = EGL_HEIGHT;
+	attribs[n++] = height;
+	attribs[n++] = EGL_LINUX_DRM_FOURCC_EXT;
+	attribs[n++] = sc->format;
+
+	params = zwp_linux_dmabuf_v1_create_params(sc->dmabuf);
+	for (i = 0; i < planes; i++) {
+		uint32_t offset = gbm_bo_get_offset(buf->bo, i);
+		uint32_t stride = gbm_bo_get_stride_for_plane(buf->bo, i);
+
+		zwp_linux_buffer_params_v1_add(params, fd, i, offset, stride,
+					       modifier >> 32,
+					       modifier & 0xffffffff);
+
+		attribs[n++] = plane_attribs[i][0];
+		attribs[n++] = fd;
+		attribs[n++] = plane_attribs[i][1];
+		attribs[n++] = offset;
+		attribs[n++] = plane_attribs[i][2];
+		attribs[n++] = stride;
+		if (modifier != DRM_FORMAT_MOD_INVALID &&
+		    rd->import_modifiers) {
+			attribs[n++] = plane_attribs[i][3];
+			attribs[n++] = modifier & 0xffffffff;
+			attribs[n++] = plane_attribs[i][4];
+			attribs[n++] = modifier >> 32;
+		}
+	}
+	attribs[n++] = EGL_NONE;
+
+	buf->wl_buffer = zwp_linux_buffer_params_v1_create_immed(params,
+			width, height, sc->format, 0);
+	zwp_linux_buffer_params_v1_destroy(params);
+	wl_buffer_add_listener(buf->wl_buffer, &buffer_listener, buf);
+
+	buf->image = rd->create_image(rd->dpy, EGL_NO_CONTEXT,
+				      EGL_LINUX_DMA_BUF_EXT, NULL, attribs);
+	close(fd);
+	if (buf->image == EGL_NO_IMAGE_KHR) {
+		fprintf(stderr, "Error: importing a dmabuf to EGL failed.\n");
+		exit(1);
+	}
+
+	glGenRenderbuffers(1, &buf->rbo);
+	glBindRenderbuffer(GL_RENDERBUFFER, buf->rbo);
+	rd->image_target_storage(GL_RENDERBUFFER, buf->image);
+
+	glGenFramebuffers(1, &buf->fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, buf->fbo);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+				  GL_RENDERBUFFER, buf->rbo);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) !=
+	    GL_FRAMEBUFFER_COMPLETE) {
+		fprintf(stderr, "Error: dmabuf FBO is incomplete.\n");
+		exit(1);
+	}
+}
+
+static void
+dmabuf_buffer_fini(struct dmabuf_buffer *buf, struct renderer_display *rd)
+{
+	if (!buf->bo)
+		return;
+
+	glDeleteFramebuffers(1, &buf->fbo);
+	glDeleteRenderbuffers(1, &buf->rbo);
+	rd->destroy_image(rd->dpy, buf->image);
+	wl_buffer_destroy(buf->wl_buffer);
+	if (buf->release)
+		zwp_linux_buffer_release_v1_destroy(buf->release);
+	if (buf->release_fence_fd >= 0)
+		close(buf->release_fence_fd);
+	gbm_bo_destroy(buf->bo);
+
+	buf->bo = NULL;
+	buf->frame = 0;
+	buf->release = NULL;
+	buf->release_fence_fd = -1;
+	buf->busy = false;
+}
+
+/* Make the GPU, or failing that the CPU, wait until the compositor is
+ * done reading the buffer.
+ */
+static void
+dmabuf_buffer_wait_release(struct dmabuf_buffer *buf,
+			   struct renderer_display *rd)
+{
+	int fd = buf->release_fence_fd;
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	EGLSyncKHR sync;
+
+	if (fd < 0)
+		return;
+
+	buf->release_fence_fd = -1;
+
+	if (rd->wait_sync) {
+		const EGLint attribs[] = {
+			EGL_SYNC_NATIVE_FENCE_FD_ANDROID, fd,
+			EGL_NONE
+		};
+
+		/* On success EGL owns the FD. */
+		sync = rd->create_sync(rd->dpy, EGL_SYNC_NATIVE_FENCE_ANDROID,
+				       attribs);
+		if (sync != EGL_NO_SYNC_KHR) {
+			rd->wait_sync(rd->dpy, sync, 0);
+			rd->destroy_sync(rd->dpy, sync);
+			return;
+		}
+	}
+
+	while (poll(&pfd, 1, -1) < 0 && errno == EINTR)
+		;
+	close(fd);
+}
+
+static struct dmabuf_buffer *
+swapchain_find_free(struct dmabuf_swapchain *sc)
+{
+	int i;
+
+	for (i = 0; i < sc->depth; i++) {
+		if (!sc->buffers[i].busy)
+			return &sc->buffers[i];
+	}
+
+	return NULL;
+}
+
+/** Pick a released buffer to draw into and bind its FBO
+ *
+ * \param rw The renderer window, with a swapchain.
+ * \param window The window, for the render thread and the globals.
+ *
+ * Blocks on the render thread queue while the compositor holds all the
+ * buffers; that wait is what the swapchain depth bounds.
+ */
+static void
+swapchain_acquire(struct renderer_window *rw, struct window *window)
+{
+	struct renderer_display *rd = rw->render_display;
+	struct dmabuf_swapchain *sc = rw->swapchain;
+	struct dmabuf_buffer *buf;
+
+	if (!sc->queue)
+		swapchain_bind(sc, rd, window);
+
+	if (wl_display_dispatch_queue_pending(sc->wdisp, sc->queue) < 0) {
+		perror("Error dispatching buffer releases");
+		exit(1);
+	}
+
+	while (!(buf = swapchain_find_free(sc))) {
+		if (wl_display_dispatch_queue(sc->wdisp, sc->queue) < 0) {
+			perror("Error waiting for a buffer release");
+			exit(1);
+		}
+	}
+
+	if (buf->bo && (buf->width != rw->width || buf->height != rw->height))
+		dmabuf_buffer_fini(buf, rd);
+	if (!buf->bo)
+		dmabuf_buffer_init(buf, rd, rw->width, rw->height);
+
+	dmabuf_buffer_wait_release(buf, rd);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, buf->fbo);
+	sc->current = buf;
+}
+
+/** Commit the drawn buffer
+ *
+ * \param rw The renderer window, with a swapchain.
+ * \param rt The render thread, for the surface wrapper.
+ * \param damage What changed since the previous frame.
+ * \param fence_fd Signalled when drawing is done, or -1. Not consumed.
+ */
+static void
+swapchain_commit(struct renderer_window *rw, struct render_thread *rt,
+		 const struct damage *damage, int fence_fd)
+{
+	struct dmabuf_swapchain *sc = rw->swapchain;
+	struct dmabuf_buffer *buf = sc->current;
+	const struct box *b;
+	int i;
+
+	assert(buf);
+
+	if (sc->sync) {
+		if (fence_fd >= 0)
+			zwp_linux_surface_synchronization_v1_set_acquire_fence(
+				sc->sync, fence_fd);
+
+		buf->release =
+			zwp_linux_surface_synchronization_v1_get_release(sc->sync);
+		zwp_linux_buffer_release_v1_add_listener(buf->release,
+			&buffer_release_listener, buf);
+	}
+
+	wl_surface_attach(rt->surface, buf->wl_buffer, 0, 0);
+	if (wl_proxy_get_version((struct wl_proxy *)rt->surface) >= 4) {
+		for (i = 0; i < damage->count; i++) {
+			b = &damage->rects[i];
+			wl_surface_damage_buffer(rt->surface, b->x1, b->y1,
+						 b->x2 - b->x1, b->y2 - b->y1);
 		}
+	} else {
+		wl_surface_damage(rt->surface, 0, 0, INT32_MAX, INT32_MAX);
 	}
-	free(configs);
+	wl_surface_commit(rt->surface);
+
+	buf->frame = ++sc->frame_count;
+	buf->busy = true;
+	sc->current = NULL;
+}
 
-	return chosen;
+/* On the render thread with the context current, see
+ * renderer_window_release_current().
+ */
+static void
+swapchain_release(struct dmabuf_swapchain *sc, struct renderer_display *rd)
+{
+	int i;
+
+	for (i = 0; i < sc->depth; i++)
+		dmabuf_buffer_fini(&sc->buffers[i], rd);
+
+	if (sc->sync)
+		zwp_linux_surface_synchronization_v1_destroy(sc->sync);
+	sc->sync = NULL;
+
+	if (sc->dmabuf)
+		wl_proxy_wrapper_destroy(sc->dmabuf);
+	sc->dmabuf = NULL;
+	sc->queue = NULL;
 }
 
+/** Create the EGL context and the buffers of a window
+ *
+ * \param buffer_count The number of dmabufs to render into and commit
+ * ourselves, or 0 to use an EGL window surface.
+ *
+ * The other parameters are as in the usage text.
+ */
 struct renderer_window *
 renderer_window_create(struct renderer_display *rd,
 		       struct wl_surface *wsurf,
 		       int width,
 		       int height,
 		       bool has_alpha,
-		       int buffer_bits,
-		       int swapinterval)
+		       enum render_format format,
+		       int swapinterval,
+		       int buffer_count)
 {
-	static const EGLint context_attribs[] = {
-		EGL_CONTEXT_CLIENT_VERSION, 2,
-		EGL_NONE
-	};
-
-	EGLint config_attribs[] = {
-		EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
-		EGL_RED_SIZE, 1,
-		EGL_GREEN_SIZE, 1,
-		EGL_BLUE_SIZE, 1,
-		EGL_ALPHA_SIZE, 1,
-		EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
-		EGL_NONE
-	};
-
-	EGLBoolean ret;
 	struct renderer_window *rw;
 
 	rw = xzalloc(sizeof *rw);
 	rw->render_display = rd;
 
-	if (!has_alpha || buffer_bits == 16)
-		config_attribs[9] = 0;
-
-	rw->conf = egl_choose_config(rd, config_attribs, buffer_bits);
+	rw->conf = render_format_choose_config(rd->dpy, format, has_alpha,
+					       EGL_WINDOW_BIT,
+					       rd->float_configs);
 	if (rw->conf == NULL) {
-		fprintf(stderr, "Error: did not find EGLConfig with buffer size %d\n",
-			buffer_bits);
+		fprintf(stderr, "Error: did not find an EGLConfig for %s\n",
+			render_format_get(format)->name);
 		exit(1);
 	}
 
 	rw->ctx = eglCreateContext(rd->dpy, rw->conf,
-				   EGL_NO_CONTEXT, context_attribs);
+				   rd->share_ctx, context_attribs);
 	if (!rw->ctx) {
 		fprintf(stderr, "Error: failed to create an EGL context.\n");
 		exit(1);
 	}
 
-	rw->native = wl_egl_window_create(wsurf, width, height);
-	rw->egl_surface = weston_platform_create_egl_surface(rd->dpy,
-							     rw->conf,
-							     rw->native,
-							     NULL);
+	if (buffer_count > 0) {
+		renderer_display_init_dmabuf(rd);
+		rw->swapchain = swapchain_create(rd, buffer_count,
+			render_format_get_drm(format, has_alpha));
+	} else {
+		rw->native = wl_egl_window_create(wsurf, width, height);
+		rw->egl_surface =
+			weston_platform_create_egl_surface(rd->dpy, rw->conf,
+							   rw->native, NULL);
+	}
+	rw->width = width;
+	rw->height = height;
+	rw->swapinterval = swapinterval;
+
+	return rw;
+}
+
+/** Make the window's EGL context current in the calling thread
+ *
+ * \param rw The renderer window.
+ *
+ * Also applies the swap interval, which is per context and surface.
+ * Must be called in the render thread before any GL calls.
+ */
+void
+renderer_window_make_current(struct renderer_window *rw)
+{
+	EGLDisplay dpy = rw->render_display->dpy;
+	EGLBoolean ret;
+
+	/* Our own buffers are drawn through FBOs, and nothing blocks on
+	 * a swap, so the swap interval does not apply.
+	 */
+	if (rw->swapchain) {
+		ret = eglMakeCurrent(dpy, EGL_NO_SURFACE, EGL_NO_SURFACE,
+				     rw->ctx);
+		assert(ret == EGL_TRUE);
+		return;
+	}
 
-	ret = eglMakeCurrent(rd->dpy, rw->egl_surface, rw->egl_surface, rw->ctx);
+	ret = eglMakeCurrent(dpy, rw->egl_surface, rw->egl_surface, rw->ctx);
 	assert(ret == EGL_TRUE);
 
-	ret = eglSwapInterval(rd->dpy, swapinterval);
+	ret = eglSwapInterval(dpy, rw->swapinterval);
 	if (ret != EGL_TRUE) {
 		fprintf(stderr,
 			"Error: setting EGL swap interval to %d failed.\n",
-			swapinterval);
+			rw->swapinterval);
 		exit(1);
 	}
+}
 
-	return rw;
+/** Release the current EGL context of the calling thread
+ *
+ * \param rw The renderer window.
+ *
+ * Must be called in the render thread before it exits.
+ */
+void
+renderer_window_release_current(struct renderer_window *rw)
+{
+	if (rw->swapchain)
+		swapchain_release(rw->swapchain, rw->render_display);
+
+	eglMakeCurrent(rw->render_display->dpy,
+		       EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	eglReleaseThread();
 }
 
 void
@@ -234,166 +1158,785 @@ renderer_window_destroy(struct renderer_window *rw)
 	eglMakeCurrent(dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
 	eglDestroyContext(dpy, rw->ctx);
 
-	eglDestroySurface(dpy, rw->egl_surface);
-	wl_egl_window_destroy(rw->native);
+	if (rw->swapchain) {
+		free(rw->swapchain);
+	} else {
+		eglDestroySurface(dpy, rw->egl_surface);
+		wl_egl_window_destroy(rw->native);
+	}
 
 	free(rw);
 }
 
+/** Resize the window buffers
+ *
+ * \param rw The renderer window.
+ * \param width New width in pixels.
+ * \param height New height in pixels.
+ *
+ * Takes effect on the next eglSwapBuffers, or with our own buffers on
+ * the next one drawn into. Call this only from the render thread.
+ * Nothing is done if the size does not change.
+ */
 void
 renderer_window_resize(struct renderer_window *rw, int width, int height)
 {
-	wl_egl_window_resize(rw->native, width, height, 0, 0);
+	if (rw->width == width && rw->height == height)
+		return;
+
+	if (rw->native)
+		wl_egl_window_resize(rw->native, width, height, 0, 0);
+	rw->damage_count = 0;
+	rw->width = width;
+	rw->height = height;
 }
 
-static GLuint
-create_shader(struct window *window, const char *source, GLenum shader_type)
+/* Instanced drawing is core in GL ES 3, otherwise an extension. */
+static void
+init_instancing(struct renderer_state *gl)
 {
-	GLuint shader;
-	GLint status;
+	const char *version = (const char *)glGetString(GL_VERSION);
+
+	if (version && strncmp(version, "OpenGL ES 3", 11) == 0) {
+		gl->draw_arrays_instanced = (PFNGLDRAWARRAYSINSTANCEDEXTPROC)
+			eglGetProcAddress("glDrawArraysInstanced");
+		gl->vertex_attrib_divisor = (PFNGLVERTEXATTRIBDIVISOREXTPROC)
+			eglGetProcAddress("glVertexAttribDivisor");
+		gl->gen_vertex_arrays = (PFNGLGENVERTEXARRAYSOESPROC)
+			eglGetProcAddress("glGenVertexArrays");
+		gl->bind_vertex_array = (PFNGLBINDVERTEXARRAYOESPROC)
+			eglGetProcAddress("glBindVertexArray");
+	}
+
+	if (!gl->draw_arrays_instanced &&
+	    gl_has_extension("GL_EXT_instanced_arrays")) {
+		gl->draw_arrays_instanced = (PFNGLDRAWARRAYSINSTANCEDEXTPROC)
+			eglGetProcAddress("glDrawArraysInstancedEXT");
+		gl->vertex_attrib_divisor = (PFNGLVERTEXATTRIBDIVISOREXTPROC)
+			eglGetProcAddress("glVertexAttribDivisorEXT");
+	}
 
-	shader = glCreateShader(shader_type);
-	assert(shader != 0);
+	if (!gl->draw_arrays_instanced &&
+	    gl_has_extension("GL_ANGLE_instanced_arrays")) {
+		gl->draw_arrays_instanced = (PFNGLDRAWARRAYSINSTANCEDEXTPROC)
+			eglGetProcAddress("glDrawArraysInstancedANGLE");
+		gl->vertex_attrib_divisor = (PFNGLVERTEXATTRIBDIVISOREXTPROC)
+			eglGetProcAddress("glVertexAttribDivisorANGLE");
+	}
 
-	glShaderSource(shader, 1, (const char **) &source, NULL);
-	glCompileShader(shader);
+	if (!gl->draw_arrays_instanced || !gl->vertex_attrib_divisor) {
+		gl->draw_arrays_instanced = NULL;
+		gl->vertex_attrib_divisor = NULL;
+		fprintf(stderr, "Warning: no instanced drawing, "
+			"issuing one draw call per instance.\n");
+	}
 
-	glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
-	if (!status) {
-		char log[1000];
-		GLsizei len;
-		glGetShaderInfoLog(shader, 1000, &len, log);
-		fprintf(stderr, "Error: compiling %s: %*s\n",
-			shader_type == GL_VERTEX_SHADER ? "vertex" : "fragment",
-			len, log);
-		exit(1);
+	if (!gl->gen_vertex_arrays &&
+	    gl_has_extension("GL_OES_vertex_array_object")) {
+		gl->gen_vertex_arrays = (PFNGLGENVERTEXARRAYSOESPROC)
+			eglGetProcAddress("glGenVertexArraysOES");
+		gl->bind_vertex_array = (PFNGLBINDVERTEXARRAYOESPROC)
+			eglGetProcAddress("glBindVertexArrayOES");
+	}
+
+	if (!gl->gen_vertex_arrays || !gl->bind_vertex_array) {
+		gl->gen_vertex_arrays = NULL;
+		gl->bind_vertex_array = NULL;
+	}
+}
+
+static void
+set_vertex_attribs(GLuint vbo, int first)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glVertexAttribPointer(ATTRIB_POS, 2, GL_FLOAT, GL_FALSE,
+			      sizeof(struct vertex),
+			      (void *)(first * sizeof(struct vertex) +
+				       offsetof(struct vertex, pos)));
+	glVertexAttribPointer(ATTRIB_COLOR, 3, GL_FLOAT, GL_FALSE,
+			      sizeof(struct vertex),
+			      (void *)(first * sizeof(struct vertex) +
+				       offsetof(struct vertex, color)));
+	glEnableVertexAttribArray(ATTRIB_POS);
+	glEnableVertexAttribArray(ATTRIB_COLOR);
+}
+
+static void
+set_mesh_attribs(struct renderer_state *gl)
+{
+	set_vertex_attribs(gl->vbo, MESH_FIRST);
+
+	if (gl->draw_arrays_instanced) {
+		glBindBuffer(GL_ARRAY_BUFFER, gl->instance_vbo);
+		glVertexAttribPointer(ATTRIB_INSTANCE, 4, GL_FLOAT, GL_FALSE,
+				      sizeof(struct scene_instance), NULL);
+		gl->vertex_attrib_divisor(ATTRIB_INSTANCE, 1);
+		glEnableVertexAttribArray(ATTRIB_INSTANCE);
+	}
+}
+
+static void
+set_layer_attribs(struct renderer_state *gl)
+{
+	set_vertex_attribs(gl->vbo, LAYER_FIRST);
+	glDisableVertexAttribArray(ATTRIB_INSTANCE);
+}
+
+static void
+set_graph_attribs(struct renderer_state *gl)
+{
+	set_vertex_attribs(gl->graph_vbo, 0);
+	glDisableVertexAttribArray(ATTRIB_INSTANCE);
+}
+
+/* Without VAOs the attribute setup is redone for every draw. */
+static void
+bind_mesh_attribs(struct renderer_state *gl)
+{
+	if (gl->bind_vertex_array)
+		gl->bind_vertex_array(gl->mesh_vao);
+	else
+		set_mesh_attribs(gl);
+}
+
+static void
+bind_layer_attribs(struct renderer_state *gl)
+{
+	if (gl->bind_vertex_array)
+		gl->bind_vertex_array(gl->layer_vao);
+	else
+		set_layer_attribs(gl);
+}
+
+static void
+bind_graph_attribs(struct renderer_state *gl)
+{
+	if (gl->bind_vertex_array)
+		gl->bind_vertex_array(gl->graph_vao);
+	else
+		set_graph_attribs(gl);
+}
+
+/* Upload the static geometry once and record the vertex attribute setup
+ * in VAOs when possible, so that drawing does not need to touch them.
+ * Only the per-instance data is uploaded per frame.
+ */
+static void
+init_geometry(struct renderer_state *gl)
+{
+	glGenBuffers(1, &gl->vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, gl->vbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof vertices, vertices,
+		     GL_STATIC_DRAW);
+
+	glGenBuffers(1, &gl->instance_vbo);
+	glGenBuffers(1, &gl->graph_vbo);
+
+	if (!gl->gen_vertex_arrays)
+		return;
+
+	gl->gen_vertex_arrays(1, &gl->mesh_vao);
+	gl->bind_vertex_array(gl->mesh_vao);
+	set_mesh_attribs(gl);
+
+	gl->gen_vertex_arrays(1, &gl->layer_vao);
+	gl->bind_vertex_array(gl->layer_vao);
+	set_layer_attribs(gl);
+
+	gl->gen_vertex_arrays(1, &gl->graph_vao);
+	gl->bind_vertex_array(gl->graph_vao);
+	set_graph_attribs(gl);
+}
+
+/* Timestamp queries need a counter, not only elapsed time queries. */
+static void
+init_gpu_timers(struct renderer_state *gl)
+{
+	GLint bits = 0;
+	unsigned i;
+
+	if (!gl_has_extension("GL_EXT_disjoint_timer_query"))
+		return;
+
+	gl->gen_queries = (PFNGLGENQUERIESEXTPROC)
+		eglGetProcAddress("glGenQueriesEXT");
+	gl->get_queryiv = (PFNGLGETQUERYIVEXTPROC)
+		eglGetProcAddress("glGetQueryivEXT");
+	gl->query_counter = (PFNGLQUERYCOUNTEREXTPROC)
+		eglGetProcAddress("glQueryCounterEXT");
+	gl->get_query_objectiv = (PFNGLGETQUERYOBJECTIVEXTPROC)
+		eglGetProcAddress("glGetQueryObjectivEXT");
+	gl->get_query_objectui64v = (PFNGLGETQUERYOBJECTUI64VEXTPROC)
+		eglGetProcAddress("glGetQueryObjectui64vEXT");
+	gl->get_integer64v = (PFNGLGETINTEGER64VEXTPROC)
+		eglGetProcAddress("glGetInteger64vEXT");
+
+	if (gl->gen_queries && gl->get_queryiv)
+		gl->get_queryiv(GL_TIMESTAMP_EXT, GL_QUERY_COUNTER_BITS_EXT,
+				&bits);
+
+	if (bits == 0 || !gl->query_counter || !gl->get_query_objectiv ||
+	    !gl->get_query_objectui64v || !gl->get_integer64v) {
+		gl->query_counter = NULL;
+		return;
+	}
+
+	for (i = 0; i < GPU_TIMER_SLOTS; i++)
+		gl->gen_queries(2, gl->timers[i].queries);
+}
+
+static bool
+gpu_timer_begin(struct renderer_state *gl, struct oring_clock *clock)
+{
+	struct gpu_timer *t;
+	GLint64 gl_now;
+	uint64_t now;
+
+	if (!gl->query_counter || gl->timer_count == GPU_TIMER_SLOTS)
+		return false;
+
+	t = &gl->timers[(gl->timer_head + gl->timer_count) % GPU_TIMER_SLOTS];
+
+	gl->get_integer64v(GL_TIMESTAMP_EXT, &gl_now);
+	now = oring_clock_get_nsec_now(clock);
+	t->offset = (int64_t)now - gl_now;
+
+	gl->query_counter(t->queries[0], GL_TIMESTAMP_EXT);
+
+	return true;
+}
+
+static void
+gpu_timer_end(struct renderer_state *gl, struct submission *subm)
+{
+	struct gpu_timer *t;
+
+	t = &gl->timers[(gl->timer_head + gl->timer_count) % GPU_TIMER_SLOTS];
+	gl->query_counter(t->queries[1], GL_TIMESTAMP_EXT);
+	t->subm = subm;
+	gl->timer_count++;
+}
+
+/** Get the GPU timestamps of the oldest timed submission
+ *
+ * \param window The window.
+ * \param done Returns a RENDER_DONE_GPU_TIMING message.
+ * \return False if no results are available yet.
+ *
+ * Called in the render thread, never blocks. Timers complete in order.
+ */
+bool
+renderer_get_gpu_timing(struct window *window, struct render_done *done)
+{
+	struct renderer_state *gl = window->render_state;
+	struct gpu_timer *t;
+	GLint available = 0;
+	GLint disjoint = 0;
+	GLuint64 ts[2];
+
+	if (gl->timer_count == 0)
+		return false;
+
+	t = &gl->timers[gl->timer_head];
+	gl->get_query_objectiv(t->queries[1], GL_QUERY_RESULT_AVAILABLE_EXT,
+			       &available);
+	if (!available)
+		return false;
+
+	gl->get_query_objectui64v(t->queries[0], GL_QUERY_RESULT_EXT, &ts[0]);
+	gl->get_query_objectui64v(t->queries[1], GL_QUERY_RESULT_EXT, &ts[1]);
+
+	/* A disjoint operation, like a GPU frequency change, means the
+	 * timestamps cannot be trusted.
+	 */
+	glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+
+	memset(done, 0, sizeof *done);
+	done->type = RENDER_DONE_GPU_TIMING;
+	done->subm = t->subm;
+	done->fence_fd = -1;
+	if (disjoint) {
+		done->gpu_start_time = INVALID_TIME;
+		done->gpu_end_time = INVALID_TIME;
+	} else {
+		done->gpu_start_time = ts[0] + t->offset;
+		done->gpu_end_time = ts[1] + t->offset;
 	}
 
-	return shader;
+	t->subm = NULL;
+	gl->timer_head = (gl->timer_head + 1) % GPU_TIMER_SLOTS;
+	gl->timer_count--;
+
+	return true;
+}
+
+/** Check for GPU timers still running, in the render thread */
+bool
+renderer_has_gpu_timing_pending(struct window *window)
+{
+	struct renderer_state *gl = window->render_state;
+
+	return gl->timer_count > 0;
+}
+
+static void
+build_programs(struct program_cache *programs, int fragment_cost,
+	       struct renderer_state *gl)
+{
+	const struct program_source mesh = {
+		mesh_vert_shader_text, frag_shader_text,
+		fragment_cost, attrib_names,
+	};
+	const struct program_source layer = {
+		layer_vert_shader_text, frag_shader_text, 0, attrib_names,
+	};
+	const struct program_source graph = {
+		graph_vert_shader_text, frag_shader_text, 0, attrib_names,
+	};
+
+	gl->mesh_program = program_cache_get(programs, &mesh);
+	gl->layer_program = program_cache_get(programs, &layer);
+	gl->graph_program = program_cache_get(programs, &graph);
 }
 
 void
 init_gl(struct window *window)
 {
 	struct renderer_state *gl;
-	GLuint frag, vert;
-	GLuint program;
-	GLint status;
-
-	gl = xzalloc(sizeof *gl);
-
-	frag = create_shader(window, frag_shader_text, GL_FRAGMENT_SHADER);
-	vert = create_shader(window, vert_shader_text, GL_VERTEX_SHADER);
-
-	program = glCreateProgram();
-	glAttachShader(program, frag);
-	glAttachShader(program, vert);
-	glLinkProgram(program);
-
-	glGetProgramiv(program, GL_LINK_STATUS, &status);
-	if (!status) {
-		char log[1000];
-		GLsizei len;
-		glGetProgramInfoLog(program, 1000, &len, log);
-		fprintf(stderr, "Error: linking:\n%*s\n", len, log);
-		exit(1);
+
+	gl = xzalloc(sizeof *gl + window->scene->options.instances *
+				  sizeof gl->mesh_boxes[0]);
+
+	build_programs(&window->render_window->render_display->programs,
+		       window->scene->options.fragment_cost, gl);
+
+	init_instancing(gl);
+	init_geometry(gl);
+	init_gpu_timers(gl);
+
+	window->render_state = gl;
+}
+
+static void
+upload_instances(struct renderer_state *gl, struct scene *scene, int n)
+{
+	if (!gl->draw_arrays_instanced)
+		return;
+
+	/* Respecifying the whole store lets the driver orphan the
+	 * previous one instead of stalling on it. */
+	glBindBuffer(GL_ARRAY_BUFFER, gl->instance_vbo);
+	glBufferData(GL_ARRAY_BUFFER, n * sizeof scene->instances[0],
+		     scene->instances, GL_STREAM_DRAW);
+}
+
+/* Without instancing, the meshes outside of the scissor box are not
+ * drawn at all.
+ */
+static void
+draw_meshes(struct renderer_state *gl, struct scene *scene, int n,
+	    const struct box *clip)
+{
+	int i;
+
+	glUseProgram(gl->mesh_program);
+	bind_mesh_attribs(gl);
+
+	if (gl->draw_arrays_instanced) {
+		gl->draw_arrays_instanced(GL_TRIANGLES, 0, MESH_COUNT, n);
+		return;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (!box_intersects(&gl->mesh_boxes[i], clip))
+			continue;
+
+		glVertexAttrib4fv(ATTRIB_INSTANCE,
+				  (const GLfloat *)&scene->instances[i]);
+		glDrawArrays(GL_TRIANGLES, 0, MESH_COUNT);
 	}
+}
 
-	glUseProgram(program);
+static void
+draw_layers(struct renderer_state *gl, int layers)
+{
+	int i;
 
-	gl->pos = 0;
-	gl->col = 1;
+	if (layers <= 0)
+		return;
 
-	glBindAttribLocation(program, gl->pos, "pos");
-	glBindAttribLocation(program, gl->col, "color");
-	glLinkProgram(program);
+	glUseProgram(gl->layer_program);
+	bind_layer_attribs(gl);
 
-	gl->rotation_uniform = glGetUniformLocation(program, "rotation");
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
 
-	window->render_state = gl;
+	if (gl->draw_arrays_instanced) {
+		gl->draw_arrays_instanced(GL_TRIANGLE_STRIP, 0,
+					  LAYER_COUNT, layers);
+	} else {
+		for (i = 0; i < layers; i++)
+			glDrawArrays(GL_TRIANGLE_STRIP, 0, LAYER_COUNT);
+	}
+
+	glDisable(GL_BLEND);
+}
+
+static void
+graph_vertex(struct vertex *v, float x, float y, const GLfloat *color)
+{
+	v->pos[0] = x;
+	v->pos[1] = y;
+	memcpy(v->color, color, sizeof v->color);
+}
+
+/* Map a time to the graph area at the bottom quarter of the window, two
+ * refresh periods high.
+ */
+static float
+graph_y(float nsec, float period)
+{
+	float v = fabsf(nsec) / (2.0f * period);
+
+	return -1.0f + 0.5f * fminf(v, 1.0f);
+}
+
+/** Upload the frame timing history
+ *
+ * \param gl The renderer state.
+ * \param stats The statistics, history updated.
+ *
+ * All lines are uploaded once, and drawn with a single call by
+ * draw_graph().
+ */
+static void
+update_graph(struct renderer_state *gl, const struct frame_stats *stats)
+{
+	static const GLfloat colors[FRAME_STAT_COUNT][3] = {
+		[FRAME_STAT_LATENCY] = { 1.0, 1.0, 0.0 },
+		[FRAME_STAT_TARGET_ERROR] = { 1.0, 0.3, 0.3 },
+		[FRAME_STAT_RENDER_CPU] = { 0.3, 1.0, 0.3 },
+		[FRAME_STAT_RENDER_GPU] = { 0.3, 0.8, 1.0 },
+	};
+	static const GLfloat grey[3] = { 0.5, 0.5, 0.5 };
+	const struct frame_stats_sample *a, *b;
+	const float dx = 2.0f / (FRAME_STATS_HISTORY - 1);
+	struct vertex *v = gl->graph;
+	unsigned i, k;
+	float x;
+
+	gl->graph_count = 0;
+	if (stats->history_count < 2)
+		return;
+
+	/* one refresh period */
+	graph_vertex(v++, -1.0f, -0.75f, grey);
+	graph_vertex(v++, 1.0f, -0.75f, grey);
+
+	/* newest at the right edge */
+	x = 1.0f - (stats->history_count - 1) * dx;
+	for (i = 1; i < stats->history_count; i++, x += dx) {
+		a = frame_stats_get_history(stats, i - 1);
+		b = frame_stats_get_history(stats, i);
+
+		for (k = 0; k < FRAME_STAT_COUNT; k++) {
+			if (isnan(a->value[k]) || isnan(b->value[k]))
+				continue;
+
+			graph_vertex(v++, x, graph_y(a->value[k], a->period),
+				     colors[k]);
+			graph_vertex(v++, x + dx,
+				     graph_y(b->value[k], b->period),
+				     colors[k]);
+		}
+	}
+
+	gl->graph_count = v - gl->graph;
+	glBindBuffer(GL_ARRAY_BUFFER, gl->graph_vbo);
+	glBufferData(GL_ARRAY_BUFFER, gl->graph_count * sizeof *v,
+		     gl->graph, GL_STREAM_DRAW);
+}
+
+static void
+draw_graph(struct renderer_state *gl)
+{
+	if (gl->graph_count == 0)
+		return;
+
+	glUseProgram(gl->graph_program);
+	bind_graph_attribs(gl);
+	glDrawArrays(GL_LINES, 0, gl->graph_count);
+}
+
+/* Pixels covered by a mesh, from the vertices and the mesh vertex
+ * shader, with a pixel of margin for rasterization.
+ */
+static void
+mesh_box(const struct scene_instance *inst, int width, int height,
+	 struct box *box)
+{
+	float hx = 0.5f * inst->scale * fabsf(cosf(inst->angle));
+	float hy = 0.5f * inst->scale;
+
+	box->x1 = floorf((inst->x - hx + 1.0f) * 0.5f * width) - 1;
+	box->x2 = ceilf((inst->x + hx + 1.0f) * 0.5f * width) + 1;
+	box->y1 = floorf((1.0f - inst->y - hy) * 0.5f * height) - 1;
+	box->y2 = ceilf((1.0f - inst->y + hy) * 0.5f * height) + 1;
+	box_clip(box, width, height);
+}
+
+/** Find what changed in the scene since the previous frame
+ *
+ * \param rw The renderer window.
+ * \param gl The renderer state, with the previous mesh boxes.
+ * \param window The window, for the scene and options.
+ * \param n The number of instances to draw.
+ * \param layers The number of layers to draw.
+ * \param damage The damage to fill in.
+ *
+ * Each mesh damages where it was and where it is now. The layers cover
+ * the window but never change, and the graph scrolls in the bottom
+ * quarter. A new size or level of detail damages everything.
+ */
+static void
+get_scene_damage(struct renderer_window *rw, struct renderer_state *gl,
+		 struct window *window, int n, int layers,
+		 struct damage *damage)
+{
+	const struct scene *scene = window->scene;
+	struct box full = { 0, 0, rw->width, rw->height };
+	struct box graph = { 0, rw->height * 3 / 4, rw->width, rw->height };
+	struct box cur, b;
+	bool changed;
+	int i;
+
+	changed = gl->drawn_width != rw->width ||
+		  gl->drawn_height != rw->height ||
+		  gl->drawn_instances != n ||
+		  gl->drawn_layers != layers;
+
+	damage_init(damage);
+	if (changed)
+		damage_add_box(damage, &full);
+	else if (window->show_stats)
+		damage_add_box(damage, &graph);
+
+	for (i = 0; i < n; i++) {
+		mesh_box(&scene->instances[i], rw->width, rw->height, &cur);
+		if (!changed) {
+			b = cur;
+			box_union(&b, &gl->mesh_boxes[i]);
+			damage_add_box(damage, &b);
+		}
+		gl->mesh_boxes[i] = cur;
+	}
+
+	gl->drawn_width = rw->width;
+	gl->drawn_height = rw->height;
+	gl->drawn_instances = n;
+	gl->drawn_layers = layers;
+}
+
+/* Frames since the back buffer was last drawn into, 0 if unknown */
+static int
+renderer_window_get_buffer_age(struct renderer_window *rw)
+{
+	struct renderer_display *rd = rw->render_display;
+	struct dmabuf_swapchain *sc = rw->swapchain;
+	EGLint age = 0;
+
+	if (sc) {
+		if (!sc->current || sc->current->frame == 0)
+			return 0;
+
+		return sc->frame_count - sc->current->frame + 1;
+	}
+
+	if (!rd->buffer_age)
+		return 0;
+
+	if (!eglQuerySurface(rd->dpy, rw->egl_surface,
+			     EGL_BUFFER_AGE_EXT, &age))
+		return 0;
+
+	return age;
+}
+
+/** Find what needs drawing for a frame
+ *
+ * \param rw The renderer window, with the back buffer acquired.
+ * \param damage What changes in this frame.
+ * \param repaint Filled with the damage plus what the back buffer has
+ * missed since it was last drawn into.
+ *
+ * Also records the damage for the frames after this one.
+ */
+static void
+renderer_window_get_repaint(struct renderer_window *rw,
+			    const struct damage *damage,
+			    struct damage *repaint)
+{
+	struct box full = { 0, 0, rw->width, rw->height };
+	int age = renderer_window_get_buffer_age(rw);
+	int i;
+
+	*repaint = *damage;
+	if (age == 0 || age - 1 > rw->damage_count)
+		damage_add_box(repaint, &full);
+	else
+		for (i = 0; i < age - 1; i++)
+			damage_add(repaint, &rw->damage_history[i]);
+
+	memmove(&rw->damage_history[1], &rw->damage_history[0],
+		(DAMAGE_HISTORY - 1) * sizeof rw->damage_history[0]);
+	rw->damage_history[0] = *damage;
+	rw->damage_count = MIN(rw->damage_count + 1, DAMAGE_HISTORY);
+}
+
+/* Without the extension the compositor gets full damage. */
+static void
+renderer_window_swap(struct renderer_window *rw, const struct damage *damage)
+{
+	struct renderer_display *rd = rw->render_display;
+	EGLint rects[4 * DAMAGE_MAX_RECTS];
+	const struct box *b;
+	int i;
+
+	if (!rd->swap_with_damage) {
+		eglSwapBuffers(rd->dpy, rw->egl_surface);
+		return;
+	}
+
+	/* EGL rectangles have y up */
+	for (i = 0; i < damage->count; i++) {
+		b = &damage->rects[i];
+		rects[i * 4 + 0] = b->x1;
+		rects[i * 4 + 1] = rw->height - b->y2;
+		rects[i * 4 + 2] = b->x2 - b->x1;
+		rects[i * 4 + 3] = b->y2 - b->y1;
+	}
+
+	/* No rectangles would mean all of the surface. */
+	if (damage->count == 0) {
+		rects[0] = rects[1] = rects[2] = rects[3] = 0;
+		i = 1;
+	}
+
+	rd->swap_with_damage(rd->dpy, rw->egl_surface, rects, i);
 }
 
-struct submission *
-redraw(struct window *window, uint64_t target_time)
+/** Draw and commit a frame
+ *
+ * \param window The window.
+ * \param subm The submission for this frame, with target_time set.
+ * \param done The commit message to fill in gpu_timed and fence_fd.
+ *
+ * Called in the render thread. Ends with the commit in eglSwapBuffers.
+ * The drawing is bracketed by GPU timestamp queries, and a native fence
+ * is inserted before the swap, when supported.
+ */
+void
+redraw(struct window *window, struct submission *subm,
+       struct render_done *done)
 {
 	struct renderer_window *rw = window->render_window;
+	struct renderer_display *rd = rw->render_display;
+	EGLSyncKHR sync = EGL_NO_SYNC_KHR;
 	struct renderer_state *gl = window->render_state;
-	static const GLfloat verts[3][2] = {
-		{ -0.5, -0.5 },
-		{  0.5, -0.5 },
-		{  0,    0.5 }
-	};
-	static const GLfloat colors[3][3] = {
-		{ 1, 0, 0 },
-		{ 0, 1, 0 },
-		{ 0, 0, 1 }
-	};
-	GLfloat angle;
-	GLfloat rotation[4][4] = {
-		{ 1, 0, 0, 0 },
-		{ 0, 1, 0, 0 },
-		{ 0, 0, 1, 0 },
-		{ 0, 0, 0, 1 }
-	};
-	static const uint32_t speed_div = 5, benchmark_interval = 5;
+	struct render_thread *rt = window->render_thread;
+	struct scene *scene = window->scene;
+	struct scene_input input;
+	const struct frame_quality *quality = frame_quality_get(subm->level);
 	struct wl_region *region;
-	struct timeval tv;
-	struct submission *subm;
-	uint32_t time;
-
-	gettimeofday(&tv, NULL);
-	time = tv.tv_sec * 1000 + tv.tv_usec / 1000;
-	if (window->frames == 0)
-		window->benchmark_time = time;
-	if (time - window->benchmark_time > (benchmark_interval * 1000)) {
-		printf("%d frames in %d seconds: %f fps\n",
-		       window->frames,
-		       benchmark_interval,
-		       (float) window->frames / benchmark_interval);
-		window->benchmark_time = time;
-		window->frames = 0;
-	}
-
-	angle = (time / speed_div) % 360 * M_PI / 180.0;
-	rotation[0][0] =  cos(angle);
-	rotation[0][2] =  sin(angle);
-	rotation[2][0] = -sin(angle);
-	rotation[2][2] =  cos(angle);
-
-	glViewport(0, 0, window->geometry.width, window->geometry.height);
-
-	glUniformMatrix4fv(gl->rotation_uniform, 1, GL_FALSE,
-			   (GLfloat *) rotation);
-
+	struct damage damage;
+	struct damage repaint;
+	const struct box *r;
+	int instances, layers;
+	uint64_t target;
+	int i;
+
+	/* Show the scene as it will be when the frame hits the screen. */
+	target = subm->target_time;
+	if (target == 0 || target == INVALID_TIME)
+		target = oring_clock_get_nsec_now(&window->display->gfx_clock);
+
+	input.width = rt->surface_width;
+	input.height = rt->surface_height;
+	input.events = subm->input;
+	input.event_count = subm->input_count;
+	input.pointer_valid = subm->pointer_valid;
+	input.pointer_x = subm->pointer_x;
+	input.pointer_y = subm->pointer_y;
+	scene_update(scene, target, &input);
+
+	if (rw->swapchain)
+		swapchain_acquire(rw, window);
+
+	/* Lower detail draws a subset of the instances, the physics still
+	 * runs for all. */
+	instances = MAX(1, scene->options.instances >> quality->detail_shift);
+	layers = scene->options.overdraw >> quality->detail_shift;
+
+	get_scene_damage(rw, gl, window, instances, layers, &damage);
+	renderer_window_get_repaint(rw, &damage, &repaint);
+
+	done->gpu_timed = gpu_timer_begin(gl, &window->display->gfx_clock);
+
+	glViewport(0, 0, rw->width, rw->height);
 	glClearColor(0.0, 0.0, 0.0, 0.5);
-	glClear(GL_COLOR_BUFFER_BIT);
-
-	glVertexAttribPointer(gl->pos, 2, GL_FLOAT, GL_FALSE, 0, verts);
-	glVertexAttribPointer(gl->col, 3, GL_FLOAT, GL_FALSE, 0, colors);
-	glEnableVertexAttribArray(gl->pos);
-	glEnableVertexAttribArray(gl->col);
 
-	glDrawArrays(GL_TRIANGLES, 0, 3);
+	upload_instances(gl, scene, instances);
+	frame_stats_drain(&window->stats);
+	if (window->show_stats)
+		update_graph(gl, &window->stats);
+
+	/* The whole scene for each rectangle, the scissor test drops the
+	 * fragments outside of it.
+	 */
+	glEnable(GL_SCISSOR_TEST);
+	for (i = 0; i < repaint.count; i++) {
+		r = &repaint.rects[i];
+		glScissor(r->x1, rw->height - r->y2,
+			  r->x2 - r->x1, r->y2 - r->y1);
+
+		glClear(GL_COLOR_BUFFER_BIT);
+		draw_meshes(gl, scene, instances, r);
+		draw_layers(gl, layers);
+		if (window->show_stats)
+			draw_graph(gl);
+	}
+	glDisable(GL_SCISSOR_TEST);
 
-	glDisableVertexAttribArray(gl->pos);
-	glDisableVertexAttribArray(gl->col);
+	if (done->gpu_timed)
+		gpu_timer_end(gl, subm);
 
-	if (window->opaque || window->fullscreen) {
-		region = wl_compositor_create_region(window->display->compositor);
+	if (rt->opaque) {
+		region = wl_compositor_create_region(rt->compositor);
 		wl_region_add(region, 0, 0,
-			      window->geometry.width,
-			      window->geometry.height);
-		wl_surface_set_opaque_region(window->surface, region);
+			      rt->surface_width, rt->surface_height);
+		wl_surface_set_opaque_region(rt->surface, region);
 		wl_region_destroy(region);
 	} else {
-		wl_surface_set_opaque_region(window->surface, NULL);
+		wl_surface_set_opaque_region(rt->surface, NULL);
 	}
 
-	subm = submission_create(window, target_time);
-	window_add_submission(window, subm);
-	eglSwapBuffers(rw->render_display->dpy, rw->egl_surface);
-	submission_set_commit_time(subm);
-	window->frames++;
+	submission_request_feedback(subm, rt);
+
+	if (rd->create_sync)
+		sync = rd->create_sync(rd->dpy, EGL_SYNC_NATIVE_FENCE_ANDROID,
+				       NULL);
+
+	if (rw->swapchain)
+		glFlush();
+	else
+		renderer_window_swap(rw, &damage);
+
+	/* The fence FD exists only after the fence was flushed. */
+	if (sync != EGL_NO_SYNC_KHR) {
+		done->fence_fd = rd->dup_native_fence_fd(rd->dpy, sync);
+		rd->destroy_sync(rd->dpy, sync);
+	}
 
-	return subm;
+	if (rw->swapchain)
+		swapchain_commit(rw, rt, &damage, done->fence_fd);
 }
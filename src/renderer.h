@@ -25,9 +25,16 @@
 #define ORING_RENDERER_H
 
 #include "cal.h"
+#include "render-format.h"
+
+/* Most buffers a window can have with its own swapchain */
+#define RENDERER_MAX_BUFFERS 4
 
 struct renderer_display *
-renderer_display_create(struct wl_display *wdisp);
+renderer_display_create(struct wl_display *wdisp, int fragment_cost);
+
+void
+renderer_display_wait(struct renderer_display *rd);
 
 void
 renderer_display_destroy(struct renderer_display *rd);
@@ -38,8 +45,15 @@ renderer_window_create(struct renderer_display *rd,
 		       int width,
 		       int height,
 		       bool has_alpha,
-		       int buffer_bits,
-		       int swapinterval);
+		       enum render_format format,
+		       int swapinterval,
+		       int buffer_count);
+
+void
+renderer_window_make_current(struct renderer_window *rw);
+
+void
+renderer_window_release_current(struct renderer_window *rw);
 
 void
 renderer_window_resize(struct renderer_window *rw, int width, int height);
@@ -50,7 +64,16 @@ renderer_window_destroy(struct renderer_window *rw);
 void
 init_gl(struct window *window);
 
-struct submission *
-redraw(struct window *window, uint64_t target_time);
+struct render_done;
+
+void
+redraw(struct window *window, struct submission *subm,
+       struct render_done *done);
+
+bool
+renderer_get_gpu_timing(struct window *window, struct render_done *done);
+
+bool
+renderer_has_gpu_timing_pending(struct window *window);
 
 #endif /* ORING_RENDERER_H */
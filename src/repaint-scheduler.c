@@ -0,0 +1,459 @@
+/*
+ * Copyright © 2016 Pekka Paalanen <pq@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include <assert.h>
+
+#include "repaint-scheduler.h"
+#include "oring-clock.h"
+#include "helpers.h"
+
+/** Initialize a cost estimate
+ *
+ * \param ce The uninitialized estimate to overwrite.
+ */
+void
+cost_estimate_init(struct cost_estimate *ce)
+{
+	ce->valid = false;
+	ce->mean = 0.0;
+	ce->dev = 0.0;
+}
+
+/** Add a measured duration to the estimate
+ *
+ * \param ce The estimate.
+ * \param nsec The measured duration.
+ */
+void
+cost_estimate_add(struct cost_estimate *ce, double nsec)
+{
+	double err;
+
+	if (!ce->valid) {
+		ce->mean = nsec;
+		ce->dev = nsec / 2.0;
+		ce->valid = true;
+		return;
+	}
+
+	err = nsec - ce->mean;
+	ce->mean += err / 8.0;
+	ce->dev += (fabs(err) - ce->dev) / 4.0;
+}
+
+/** Get a duration that is rarely exceeded
+ *
+ * \param ce The estimate.
+ * \return The budget in nanoseconds, zero if nothing was measured yet.
+ */
+double
+cost_estimate_budget(const struct cost_estimate *ce)
+{
+	if (!ce->valid)
+		return 0.0;
+
+	return ce->mean + 4.0 * ce->dev;
+}
+
+/** Initialize a repaint offset
+ *
+ * \param ro The uninitialized offset to overwrite.
+ */
+void
+repaint_offset_init(struct repaint_offset *ro)
+{
+	ro->valid = false;
+	ro->lead = 0.0;
+	ro->miss_lead = 0.0;
+	ro->seen_lead = 0.0;
+	ro->margin = 0.0;
+}
+
+/** Learn from one presented frame
+ *
+ * \param ro The repaint offset.
+ * \param commit_time When the frame was committed.
+ * \param target_time The vblank the frame was aiming for.
+ * \param frame_time When the frame callback of the frame came, or
+ * INVALID_TIME.
+ * \param presented_time When the frame was actually presented.
+ * \param period The refresh period in nanoseconds.
+ *
+ * All times are in the same clock. The compositor repaint shows up as
+ * the time from a frame callback to its presentation. Commits are kept a
+ * margin ahead of it and of the longest lead that has missed. The margin
+ * covers how much later than planned commits come: it grows with the
+ * largest such overrun and doubles on a miss despite it. A hit lets the
+ * lead creep down towards that floor, a miss backs off by an eighth of a
+ * period. Nothing shrinks again, so once learnt the lead stays clear of
+ * the deadline instead of trading a dropped frame now and then for
+ * latency.
+ */
+void
+repaint_offset_update(struct repaint_offset *ro, uint64_t commit_time,
+		      uint64_t target_time, uint64_t frame_time,
+		      uint64_t presented_time, double period)
+{
+	double actual;
+	double floor;
+	bool planned;
+	bool hit;
+
+	if (commit_time == INVALID_TIME || period <= 0.0)
+		return;
+
+	if (!ro->valid) {
+		/* Nothing planned the first commit, so it says nothing
+		 * about how late commits come. */
+		ro->lead = period / 2.0;
+		ro->miss_lead = 0.0;
+		ro->seen_lead = 0.0;
+		ro->margin = period / 16.0;
+		ro->valid = true;
+		planned = false;
+	} else {
+		planned = true;
+	}
+
+	actual = time_subtract(target_time, commit_time);
+	hit = time_subtract(presented_time, target_time) < period / 2.0;
+
+	/* A commit later than planned, hit or not, shows how much the
+	 * margin has to absorb. */
+	if (planned && actual > 0.0 && actual < ro->lead)
+		ro->margin = fmin(fmax(ro->margin, 1.5 * (ro->lead - actual)),
+				  period / 4.0);
+
+	if (hit && frame_time != INVALID_TIME && frame_time < presented_time)
+		ro->seen_lead = fmax(ro->seen_lead,
+				     fmin(time_subtract(presented_time,
+							frame_time), period));
+
+	floor = fmax(ro->miss_lead, ro->seen_lead) + ro->margin;
+
+	if (hit) {
+		ro->lead -= period / 256.0;
+		if (ro->lead < floor)
+			ro->lead = floor;
+	} else if (actual > 0.0) {
+		/* Missing while keeping clear of a known lead means the
+		 * margin does not cover how much later than planned the
+		 * commits come. */
+		if (ro->lead >= floor && floor > ro->margin)
+			ro->margin = fmin(2.0 * ro->margin, period / 4.0);
+
+		if (actual > ro->miss_lead)
+			ro->miss_lead = actual;
+
+		ro->lead = fmax(ro->lead, actual) + period / 8.0;
+	}
+
+	if (ro->lead > period)
+		ro->lead = period;
+}
+
+/** Get the current lead
+ *
+ * \param ro The repaint offset.
+ * \param period The refresh period in nanoseconds.
+ * \return How long before the target vblank to commit, in nanoseconds.
+ *
+ * Before anything has been learnt, half a period is assumed.
+ */
+double
+repaint_offset_get(const struct repaint_offset *ro, double period)
+{
+	if (!ro->valid)
+		return period / 2.0;
+
+	return ro->lead;
+}
+
+/** Move a target to the earliest vblank that can be made
+ *
+ * \param nsec The presentation time wished for, on the vblank grid.
+ * \param now The current time.
+ * \param ahead How long before its vblank a frame must start, the render
+ * cost budget plus the compositor repaint lead.
+ * \param period The refresh period in nanoseconds.
+ * \return The presentation time to aim for.
+ *
+ * If starting now is too late for nsec, aiming at a later vblank right
+ * away is better than missing and getting shown late anyway.
+ */
+uint64_t
+repaint_target_earliest(uint64_t nsec, uint64_t now, double ahead,
+			double period)
+{
+	double late = time_subtract(now, nsec) + ahead;
+
+	if (late <= 0.0 || period <= 0.0)
+		return nsec;
+
+	return nsec + (uint64_t)(ceil(late / period) * period);
+}
+
+/** Choose when to present on a variable refresh output
+ *
+ * \param now The current time.
+ * \param ahead How long before its presentation a frame must start, the
+ * render cost budget plus the compositor repaint lead.
+ * \param last The presentation time of the previous frame, or
+ * INVALID_TIME if not known.
+ * \param min_period The shortest refresh period the output can do.
+ * \param max_period The longest refresh period, after which the output
+ * repeats the previous frame by itself.
+ * \return The presentation time to aim for.
+ *
+ * There is no vblank grid to snap to: the frame is shown as soon as it
+ * is done. It cannot come sooner than the shortest period after the
+ * previous refresh though, and that includes the refreshes the output
+ * inserts when a frame takes longer than the longest period.
+ */
+uint64_t
+repaint_target_vrr(uint64_t now, double ahead, uint64_t last,
+		   double min_period, double max_period)
+{
+	uint64_t target = now + (uint64_t)fmax(ahead, 0.0);
+	double since;
+	double phase;
+
+	if (last == INVALID_TIME || min_period <= 0.0)
+		return target;
+
+	since = time_subtract(target, last);
+	if (since < min_period)
+		return last + (uint64_t)min_period;
+
+	if (max_period <= min_period)
+		return target;
+
+	phase = fmod(since, max_period);
+	if (since > max_period && phase < min_period)
+		target += (uint64_t)(min_period - phase);
+
+	return target;
+}
+
+/* Votes needed to switch to variable refresh pacing, and the most
+ * that are kept, so switching back takes as long. */
+#define VRR_VOTES_ON 12
+#define VRR_VOTES_MAX 16
+
+/** Initialize a variable refresh detector
+ *
+ * \param vd The uninitialized detector to overwrite.
+ */
+void
+vrr_detector_init(struct vrr_detector *vd)
+{
+	vd->active = false;
+	vd->votes = 0;
+	vd->last_refresh = 0;
+}
+
+/** Learn from the refresh of one presentation
+ *
+ * \param vd The detector.
+ * \param refresh The refresh from presentation feedback, nanoseconds.
+ * \param vsync Whether the presentation was synchronized to vblank.
+ * \return True if the mode changed.
+ *
+ * A zero refresh means unknown, and without vsync that is just an
+ * unsynchronized compositor, so it does not vote. A change of over 1/64
+ * from the previous report counts as varying.
+ */
+bool
+vrr_detector_update(struct vrr_detector *vd, uint32_t refresh, bool vsync)
+{
+	bool was = vd->active;
+	bool vote;
+
+	if (refresh == 0 && !vsync)
+		return false;
+
+	if (refresh == 0)
+		vote = true;
+	else if (vd->last_refresh == 0)
+		vote = false;
+	else
+		vote = fabs((double)refresh - vd->last_refresh) >
+		       vd->last_refresh / 64.0;
+
+	if (refresh != 0)
+		vd->last_refresh = refresh;
+
+	if (vote && vd->votes < VRR_VOTES_MAX)
+		vd->votes++;
+	else if (!vote && vd->votes > 0)
+		vd->votes--;
+
+	if (vd->votes >= VRR_VOTES_ON)
+		vd->active = true;
+	else if (vd->votes == 0)
+		vd->active = false;
+
+	return vd->active != was;
+}
+
+/* Frames over the limit in a row before stepping down */
+#define PACER_OVER_FRAMES 8
+
+/* Frames with room to spare in a row before stepping up */
+#define PACER_UNDER_FRAMES 120
+
+/* Frames for the cost estimate to converge after a change */
+#define PACER_SETTLE_FRAMES 32
+
+static const struct frame_quality pacer_quality[] = {
+	{ 0, 1.0f },
+	{ 1, 1.0f },
+	{ 1, 0.75f },
+	{ 1, 0.5f },
+};
+
+/** Initialize a frame pacer
+ *
+ * \param fp The uninitialized pacer to overwrite.
+ * \param max_level The cheapest quality level allowed, zero for only
+ * ever changing the interval.
+ */
+void
+frame_pacer_init(struct frame_pacer *fp, int max_level)
+{
+	fp->interval = 1;
+	fp->level = 0;
+	fp->max_level = max_level;
+	if (fp->max_level >= (int)ARRAY_LENGTH(pacer_quality))
+		fp->max_level = ARRAY_LENGTH(pacer_quality) - 1;
+	fp->over = 0;
+	fp->under = 0;
+	fp->settle = 0;
+}
+
+/* Time a frame may take at the given interval. A frame must not take
+ * longer than its share of the pipeline, and starting right after the
+ * previous one it still has to commit before the lead.
+ */
+static double
+pacer_available(unsigned interval, double lead, double period,
+		unsigned depth)
+{
+	double share = interval * period;
+
+	return fmin(share, depth * share - lead);
+}
+
+/** Learn from the render cost of one completed frame
+ *
+ * \param fp The pacer.
+ * \param budget The render cost budget, see cost_estimate_budget().
+ * \param lead The compositor repaint lead, see repaint_offset_get().
+ * \param period The refresh period in nanoseconds.
+ * \param depth The maximum number of frames in flight.
+ * \return True if the interval or the level changed.
+ *
+ * A budget that does not fit first lowers the quality level and only
+ * then lengthens the interval. Stepping back up goes in the reverse
+ * order, and needs a clear margin since the cost of the better step is
+ * not known.
+ */
+bool
+frame_pacer_update(struct frame_pacer *fp, double budget, double lead,
+		   double period, unsigned depth)
+{
+	double avail;
+	double up;
+
+	if (budget <= 0.0 || period <= 0.0)
+		return false;
+
+	if (fp->settle > 0) {
+		fp->settle--;
+		return false;
+	}
+
+	avail = pacer_available(fp->interval, lead, period, depth);
+
+	/* A quality step roughly halves the cost, an interval step
+	 * takes away one period. */
+	if (fp->interval > 1)
+		up = 0.75 * pacer_available(fp->interval - 1, lead, period,
+					    depth);
+	else if (fp->level > 0)
+		up = 0.4 * avail;
+	else
+		up = 0.0;
+
+	if (budget > avail) {
+		fp->over++;
+		fp->under = 0;
+	} else if (budget < up) {
+		fp->under++;
+		fp->over = 0;
+	} else {
+		fp->over = 0;
+		fp->under = 0;
+	}
+
+	if (fp->over >= PACER_OVER_FRAMES) {
+		if (fp->level < fp->max_level)
+			fp->level++;
+		else if (fp->interval < FRAME_PACER_MAX_INTERVAL)
+			fp->interval++;
+		else
+			return false;
+	} else if (fp->under >= PACER_UNDER_FRAMES) {
+		if (fp->interval > 1)
+			fp->interval--;
+		else
+			fp->level--;
+	} else {
+		return false;
+	}
+
+	fp->over = 0;
+	fp->under = 0;
+	fp->settle = PACER_SETTLE_FRAMES;
+
+	return true;
+}
+
+/** Get how a quality level is drawn
+ *
+ * \param level The level, see frame_pacer::level.
+ * \return The quality, never NULL.
+ */
+const struct frame_quality *
+frame_quality_get(int level)
+{
+	assert(level >= 0 && level < (int)ARRAY_LENGTH(pacer_quality));
+
+	return &pacer_quality[level];
+}
@@ -0,0 +1,140 @@
+/*
+ * Copyright © 2016 Pekka Paalanen <pq@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef ORING_REPAINT_SCHEDULER_H
+#define ORING_REPAINT_SCHEDULER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Running estimate of a duration
+ *
+ * Smoothed mean and mean deviation in the style of TCP round-trip time
+ * estimation. The budget is the mean plus four deviations.
+ */
+struct cost_estimate {
+	bool valid;
+	double mean;
+	double dev;
+};
+
+/** Learned compositor repaint offset
+ *
+ * The lead is how long before the target vblank a commit must reach the
+ * compositor to make it. It is learnt from which commits made their
+ * target and which did not, see repaint_offset_update().
+ */
+struct repaint_offset {
+	bool valid;
+	double lead;
+	double miss_lead; /* largest lead that was too short */
+	double seen_lead; /* compositor repaint before vblank, from frame
+			   * callbacks */
+	double margin; /* kept above miss_lead and seen_lead */
+};
+
+/** Variable refresh rate detector
+ *
+ * A compositor driving an adaptive sync output reports a refresh of
+ * zero, or one that changes from frame to frame. Each presentation votes
+ * for or against, and the mode switches only after a clear majority, so
+ * that a single odd report does not flip the pacing.
+ */
+struct vrr_detector {
+	bool active;
+	int votes;
+	uint32_t last_refresh; /* nanoseconds, zero if none yet */
+};
+
+#define FRAME_PACER_MAX_INTERVAL 4
+
+/** How a quality level is drawn */
+struct frame_quality {
+	int detail_shift; /* draw 1 / 2^n of the scene */
+	float scale; /* render resolution relative to the surface size */
+};
+
+/** Refresh rate divisor and quality level chooser
+ *
+ * The interval is how many vblanks each frame is aimed to stay on
+ * screen, and the level picks a cheaper way to draw, zero being full
+ * quality. Both change only after the render cost has stayed over or
+ * under what fits for a while, so that frames are paced regularly
+ * instead of missing random vblanks.
+ */
+struct frame_pacer {
+	unsigned interval;
+	int level;
+	int max_level; /* zero disables degrading */
+
+	int over; /* consecutive frames that did not fit */
+	int under; /* consecutive frames that would fit a step up */
+	int settle; /* frames to ignore after a change */
+};
+
+void
+cost_estimate_init(struct cost_estimate *ce);
+
+void
+cost_estimate_add(struct cost_estimate *ce, double nsec);
+
+double
+cost_estimate_budget(const struct cost_estimate *ce);
+
+void
+repaint_offset_init(struct repaint_offset *ro);
+
+void
+repaint_offset_update(struct repaint_offset *ro, uint64_t commit_time,
+		      uint64_t target_time, uint64_t frame_time,
+		      uint64_t presented_time, double period);
+
+double
+repaint_offset_get(const struct repaint_offset *ro, double period);
+
+uint64_t
+repaint_target_earliest(uint64_t nsec, uint64_t now, double ahead,
+			double period);
+
+uint64_t
+repaint_target_vrr(uint64_t now, double ahead, uint64_t last,
+		   double min_period, double max_period);
+
+void
+vrr_detector_init(struct vrr_detector *vd);
+
+bool
+vrr_detector_update(struct vrr_detector *vd, uint32_t refresh, bool vsync);
+
+void
+frame_pacer_init(struct frame_pacer *fp, int max_level);
+
+bool
+frame_pacer_update(struct frame_pacer *fp, double budget, double lead,
+		   double period, unsigned depth);
+
+const struct frame_quality *
+frame_quality_get(int level);
+
+#endif /* ORING_REPAINT_SCHEDULER_H */
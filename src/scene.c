@@ -0,0 +1,205 @@
+/*
+ * Copyright © 2016 Pekka Paalanen <pq@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <math.h>
+
+#include <linux/input.h>
+
+#include "scene.h"
+#include "physics.h"
+#include "xalloc.h"
+
+/* Simulation rate, 250 Hz */
+#define SCENE_STEP_NSEC 4000000
+
+/* Spin rate of the first instance, 200 degrees per second */
+#define SCENE_OMEGA (200.0 * M_PI / 180.0)
+
+/* Velocity given to the bodies per unit of pointer motion */
+#define SCENE_PUSH_GAIN 8.0f
+#define SCENE_PUSH_RADIUS 0.3f
+
+/* Repulsion of the pointer */
+#define SCENE_FIELD_STRENGTH 0.5f
+
+/* Limits of the spin rate multiplier */
+#define SCENE_SPIN_MIN 0.1f
+#define SCENE_SPIN_MAX 10.0f
+
+/** Create a scene
+ *
+ * \param options The scene parameters, instances must be at least 1.
+ * \return A new scene.
+ *
+ * The instances are laid out on a square grid filling the window, each
+ * spinning at its own rate. A single instance covers the whole window
+ * like the original triangle did.
+ */
+struct scene *
+scene_create(const struct scene_options *options)
+{
+	struct scene *scene;
+	struct scene_instance *inst;
+	struct physics_bodies *b;
+	float spin;
+	int side;
+	int i;
+
+	scene = xzalloc(sizeof *scene);
+	scene->options = *options;
+	scene->spin_scale = 1.0f;
+	scene->instances = xzalloc(options->instances *
+				   sizeof scene->instances[0]);
+	scene->physics = physics_create(options->instances, SCENE_STEP_NSEC);
+	b = &scene->physics->b;
+
+	side = ceil(sqrt(options->instances));
+
+	for (i = 0; i < options->instances; i++) {
+		inst = &scene->instances[i];
+		inst->scale = 1.0 / side;
+
+		b->rest_x[i] = -1.0 + (2.0 * (i % side) + 1.0) / side;
+		b->rest_y[i] = 1.0 - (2.0 * (i / side) + 1.0) / side;
+		b->x[i] = b->rest_x[i];
+		b->y[i] = b->rest_y[i];
+
+		/* golden ratio steps spread the rates, the first is 1 */
+		spin = 0.5 + fmod(0.5 + i * 0.618034, 1.0);
+		b->omega[i] = SCENE_OMEGA * spin;
+
+		/* a kick in a different direction for each, dying out */
+		b->vx[i] = inst->scale * 0.5 * cos(i * 2.4);
+		b->vy[i] = inst->scale * 0.5 * sin(i * 2.4);
+	}
+
+	return scene;
+}
+
+void
+scene_destroy(struct scene *scene)
+{
+	physics_destroy(scene->physics);
+	free(scene->instances);
+	free(scene);
+}
+
+static void
+scene_to_clip(const struct scene_input *input, float x, float y,
+	      float *cx, float *cy)
+{
+	*cx = 2.0f * x / input->width - 1.0f;
+	*cy = 1.0f - 2.0f * y / input->height;
+}
+
+static void
+scene_apply_event(struct scene *scene, const struct scene_input *input,
+		  const struct timed_input *ev)
+{
+	float x, y, factor;
+
+	switch (ev->type) {
+	case INPUT_EVENT_MOTION:
+		scene_to_clip(input, ev->x, ev->y, &x, &y);
+		physics_push(scene->physics, x, y,
+			     SCENE_PUSH_GAIN * 2.0f * ev->dx / input->width,
+			     SCENE_PUSH_GAIN * -2.0f * ev->dy / input->height,
+			     SCENE_PUSH_RADIUS);
+		break;
+	case INPUT_EVENT_AXIS:
+		if (ev->code != 0)
+			break;
+
+		factor = expf(-ev->value / 100.0f);
+		factor = fminf(fmaxf(scene->spin_scale * factor,
+				     SCENE_SPIN_MIN), SCENE_SPIN_MAX) /
+			 scene->spin_scale;
+		scene->spin_scale *= factor;
+		physics_scale_spin(scene->physics, factor);
+		break;
+	case INPUT_EVENT_BUTTON:
+		if (ev->code == BTN_RIGHT && ev->state)
+			physics_scale_spin(scene->physics, -1.0f);
+		break;
+	case INPUT_EVENT_KEY:
+		if (ev->code == KEY_SPACE && ev->state)
+			physics_scale_spin(scene->physics, -1.0f);
+		break;
+	}
+}
+
+/** Advance the scene to a presentation time
+ *
+ * \param scene The scene.
+ * \param target_time The gfx_clock time the frame is predicted to be
+ * shown at.
+ * \param input Input received since the previous update.
+ *
+ * Steps the simulation through the input events at their timestamps,
+ * then up to target_time with the pointer where it is predicted to be,
+ * and samples every body at target_time into scene::instances.
+ *
+ * Pointer motion pushes the meshes, the pointer repels them, scrolling
+ * changes the spin rate, and the right button or space reverses it.
+ */
+void
+scene_update(struct scene *scene, uint64_t target_time,
+	     const struct scene_input *input)
+{
+	struct physics *phys = scene->physics;
+	const struct physics_bodies *b = &phys->b;
+	struct scene_instance *inst;
+	float alpha, back;
+	unsigned j;
+	int i;
+
+	for (j = 0; j < input->event_count; j++) {
+		physics_advance(phys, input->events[j].time);
+		scene_apply_event(scene, input, &input->events[j]);
+	}
+
+	if (input->pointer_valid) {
+		scene_to_clip(input, input->pointer_x, input->pointer_y,
+			      &phys->field_x, &phys->field_y);
+		phys->field_strength = SCENE_FIELD_STRENGTH;
+	} else {
+		phys->field_strength = 0.0f;
+	}
+
+	physics_advance(phys, target_time);
+	alpha = physics_get_alpha(phys, target_time);
+
+	/* the spin is constant, so go back from the current state */
+	back = (1.0f - alpha) * phys->step_nsec * 1e-9f;
+
+	for (i = 0; i < scene->options.instances; i++) {
+		inst = &scene->instances[i];
+		inst->x = b->prev_x[i] + (b->x[i] - b->prev_x[i]) * alpha;
+		inst->y = b->prev_y[i] + (b->y[i] - b->prev_y[i]) * alpha;
+		inst->angle = b->angle[i] - b->omega[i] * back;
+	}
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright © 2016 Pekka Paalanen <pq@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef ORING_SCENE_H
+#define ORING_SCENE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "input-queue.h"
+
+/** Knobs for how heavy the rendered scene is */
+struct scene_options {
+	int instances; /* number of meshes, drawn instanced */
+	int fragment_cost; /* extra shader iterations per fragment */
+	int overdraw; /* full-window blended layers on top */
+};
+
+/** Per-instance data, uploaded once per frame */
+struct scene_instance {
+	float x, y; /* position in clip space */
+	float scale;
+	float angle; /* rotation about the vertical axis, radians */
+};
+
+/** Input for one scene update, see struct submission */
+struct scene_input {
+	int width, height; /* surface size the coordinates are in */
+
+	const struct timed_input *events; /* in timestamp order */
+	unsigned event_count;
+
+	bool pointer_valid;
+	float pointer_x, pointer_y; /* predicted for the target time */
+};
+
+struct physics;
+
+struct scene {
+	struct scene_options options;
+
+	struct scene_instance *instances;
+	struct physics *physics; /* one body per instance */
+	float spin_scale; /* set by scrolling */
+};
+
+struct scene *
+scene_create(const struct scene_options *options);
+
+void
+scene_destroy(struct scene *scene);
+
+void
+scene_update(struct scene *scene, uint64_t target_time,
+	     const struct scene_input *input);
+
+#endif /* ORING_SCENE_H */
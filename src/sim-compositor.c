@@ -0,0 +1,190 @@
+/*
+ * Copyright © 2016 Pekka Paalanen <pq@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+
+#include "sim-compositor.h"
+#include "timespec-util.h"
+
+/* Virtual time zero, far enough from the clock epoch to look real */
+#define SIM_EPOCH_SEC 1000
+
+/** Get a uniform random number
+ *
+ * \param state The generator state, never zero.
+ * \return A number in [0, 1).
+ *
+ * xorshift64*, so that runs with the same seed are repeatable on any
+ * libc.
+ */
+double
+sim_random(uint64_t *state)
+{
+	uint64_t x = *state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+
+	return ((x * 0x2545f4914f6cdd1dULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/** Get a standard normally distributed random number
+ *
+ * \param state The generator state, never zero.
+ * \return A number with mean zero and standard deviation one.
+ */
+double
+sim_random_normal(uint64_t *state)
+{
+	double u = 1.0 - sim_random(state);
+	double v = sim_random(state);
+
+	return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+/** Initialize a simulated compositor
+ *
+ * \param sim The uninitialized compositor to overwrite.
+ * \param options The behaviour, copied.
+ * \param seed Seed for the random numbers.
+ */
+void
+sim_compositor_init(struct sim_compositor *sim,
+		    const struct sim_options *options, uint64_t seed)
+{
+	sim->options = *options;
+	sim->rng = seed ? seed : 1;
+	sim->epoch_sec = SIM_EPOCH_SEC;
+	sim->last_vblank = 0;
+	sim->seq = 0;
+}
+
+/** Get the clock instant of virtual time zero
+ *
+ * \param sim The compositor.
+ * \param epoch Returns the instant.
+ */
+void
+sim_compositor_get_epoch(const struct sim_compositor *sim,
+			 struct timespec *epoch)
+{
+	epoch->tv_sec = sim->epoch_sec;
+	epoch->tv_nsec = 0;
+}
+
+static uint64_t
+sim_to_virtual(const struct sim_compositor *sim, const struct timespec *ts)
+{
+	struct timespec epoch;
+	struct timespec delta;
+
+	sim_compositor_get_epoch(sim, &epoch);
+	timespec_sub(&delta, ts, &epoch);
+
+	return timespec_to_nsec(&delta);
+}
+
+/* The first fixed rate vblank whose repaint deadline is at or after t */
+static uint64_t
+sim_next_fixed_vblank(struct sim_compositor *sim, uint64_t t)
+{
+	double period = sim->options.period;
+	double n;
+
+	n = ceil(((double)t + sim->options.lead - sim->last_vblank) / period);
+	if (n < 1.0)
+		n = 1.0;
+
+	sim->seq += (uint64_t)n;
+
+	return sim->last_vblank + (uint64_t)llround(n * period);
+}
+
+/* The refresh a VRR display does for a frame ready at t */
+static uint64_t
+sim_next_vrr_vblank(struct sim_compositor *sim, uint64_t t)
+{
+	const struct sim_options *o = &sim->options;
+	double ready = (double)t + o->lead;
+	double last = sim->last_vblank;
+
+	/* Idle refreshes repeating the previous frame */
+	while (ready - last > o->vrr_max) {
+		last += o->vrr_max;
+		sim->seq++;
+	}
+
+	sim->seq++;
+
+	return (uint64_t)llround(fmax(ready, last + o->vrr_min));
+}
+
+/** Commit a frame
+ *
+ * \param sim The compositor.
+ * \param commit When the commit reaches the compositor, not before the
+ * previous commit.
+ * \param feedback Returns what presentation feedback would say.
+ *
+ * A discarded frame still takes its vblank, as if a newer frame from
+ * another client had won the repaint.
+ */
+void
+sim_compositor_commit(struct sim_compositor *sim,
+		      const struct timespec *commit,
+		      struct sim_feedback *feedback)
+{
+	const struct sim_options *o = &sim->options;
+	struct timespec epoch;
+	uint64_t t = sim_to_virtual(sim, commit);
+	uint64_t vblank;
+	double noise;
+
+	if (o->vrr_max > 0.0)
+		vblank = sim_next_vrr_vblank(sim, t);
+	else
+		vblank = sim_next_fixed_vblank(sim, t);
+
+	sim->last_vblank = vblank;
+
+	feedback->presented = sim_random(&sim->rng) >= o->drop_rate;
+	feedback->refresh = o->vrr_max > 0.0 ? 0 : (uint32_t)llround(o->period);
+	feedback->seq = sim->seq;
+
+	noise = o->jitter * sim_random_normal(&sim->rng);
+	if (noise < -(double)vblank)
+		noise = 0.0;
+
+	sim_compositor_get_epoch(sim, &epoch);
+	timespec_add_nsec(&feedback->time, &epoch,
+			  (int64_t)vblank + (int64_t)llround(noise));
+	timespec_add_nsec(&feedback->frame_time, &epoch,
+			  (int64_t)llround(fmax((double)vblank - o->lead, t)));
+}
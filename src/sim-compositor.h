@@ -0,0 +1,85 @@
+/*
+ * Copyright © 2016 Pekka Paalanen <pq@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef ORING_SIM_COMPOSITOR_H
+#define ORING_SIM_COMPOSITOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+/** Behaviour of the simulated compositor, times in nanoseconds */
+struct sim_options {
+	double period; /* nominal refresh period */
+	double jitter; /* standard deviation of the reported timestamps */
+	double vrr_min, vrr_max; /* VRR period range, vrr_max 0 if fixed */
+	double drop_rate; /* probability of discarding a frame */
+	double lead; /* compositor repaint deadline before the vblank */
+};
+
+/** Presentation feedback for one commit, as the protocol would send it */
+struct sim_feedback {
+	bool presented; /* false: discarded */
+	struct timespec time; /* presentation time */
+	struct timespec frame_time; /* frame callback, at the repaint */
+	uint32_t refresh; /* nsec, 0 if not constant */
+	uint64_t seq;
+};
+
+/** Discrete-event model of a compositor and a display
+ *
+ * Time is virtual and advances only by the commits. Each commit is shown
+ * on the first vblank whose repaint deadline it makes. With VRR, the
+ * display refreshes as soon as a frame is ready, but not faster than
+ * vrr_min, and repeats the old frame after vrr_max.
+ */
+struct sim_compositor {
+	struct sim_options options;
+	uint64_t rng;
+	uint64_t epoch_sec; /* where virtual time zero is on the clock */
+
+	uint64_t last_vblank; /* virtual time of the latest refresh */
+	uint64_t seq;
+};
+
+void
+sim_compositor_init(struct sim_compositor *sim,
+		    const struct sim_options *options, uint64_t seed);
+
+void
+sim_compositor_get_epoch(const struct sim_compositor *sim,
+			 struct timespec *epoch);
+
+void
+sim_compositor_commit(struct sim_compositor *sim,
+		      const struct timespec *commit,
+		      struct sim_feedback *feedback);
+
+double
+sim_random(uint64_t *state);
+
+double
+sim_random_normal(uint64_t *state);
+
+#endif /* ORING_SIM_COMPOSITOR_H */
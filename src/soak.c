@@ -0,0 +1,136 @@
+/*
+ * Copyright © 2016 Pekka Paalanen <pq@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <inttypes.h>
+#include <math.h>
+
+#include "soak.h"
+#include "oring-clock.h"
+#include "xalloc.h"
+
+struct soak_stats *
+soak_stats_create(void)
+{
+	struct soak_stats *soak;
+
+	soak = xzalloc(sizeof *soak);
+	histogram_init(&soak->target_error);
+	histogram_init(&soak->latency);
+	histogram_init(&soak->interval);
+	histogram_init(&soak->missed);
+
+	return soak;
+}
+
+void
+soak_stats_destroy(struct soak_stats *soak)
+{
+	if (!soak)
+		return;
+
+	histogram_release(&soak->target_error);
+	histogram_release(&soak->latency);
+	histogram_release(&soak->interval);
+	histogram_release(&soak->missed);
+	free(soak);
+}
+
+/** Count a presented frame
+ *
+ * \param soak The statistics.
+ * \param target_error Presentation time minus the target time.
+ * \param interval Time since the previous presentation, or INVALID_TIME
+ * for the first one.
+ * \param period The refresh period the target was chosen with.
+ *
+ * A frame shown half a period or more after its target is counted as
+ * having missed the vblanks in between, rounded.
+ */
+void
+soak_stats_record_presented(struct soak_stats *soak, int64_t target_error,
+			    uint64_t interval, double period)
+{
+	int64_t missed = 0;
+
+	soak->presented++;
+	histogram_record(&soak->target_error, target_error);
+
+	if (interval != INVALID_TIME)
+		histogram_record(&soak->interval, interval);
+
+	if (period > 0.0 && target_error >= period / 2.0)
+		missed = lround(target_error / period);
+
+	histogram_record(&soak->missed, missed);
+	if (missed > 0) {
+		soak->missed_frames++;
+		soak->missed_vblanks += missed;
+	}
+}
+
+void
+soak_stats_record_discarded(struct soak_stats *soak)
+{
+	soak->discarded++;
+}
+
+/** Count the commit to presentation latency of a presented frame
+ *
+ * \param soak The statistics.
+ * \param latency Presentation time minus the commit time.
+ *
+ * This is separate, because the commit time may arrive from the render
+ * thread only after the presentation feedback.
+ */
+void
+soak_stats_record_latency(struct soak_stats *soak, int64_t latency)
+{
+	histogram_record(&soak->latency, latency);
+}
+
+/** Write the statistics as a JSON object
+ *
+ * \param soak The statistics.
+ * \param fp The stream to write to.
+ */
+void
+soak_stats_write_json(const struct soak_stats *soak, FILE *fp)
+{
+	fprintf(fp, "{\"presented\":%" PRIu64 ",\"discarded\":%" PRIu64
+		",\"missed_frames\":%" PRIu64 ",\"missed_vblanks\":%" PRIu64,
+		soak->presented, soak->discarded, soak->missed_frames,
+		soak->missed_vblanks);
+
+	fprintf(fp, ",\n\t\t\"target_error_ns\":");
+	histogram_write_json(&soak->target_error, fp);
+	fprintf(fp, ",\n\t\t\"commit_to_present_ns\":");
+	histogram_write_json(&soak->latency, fp);
+	fprintf(fp, ",\n\t\t\"frame_interval_ns\":");
+	histogram_write_json(&soak->interval, fp);
+	fprintf(fp, ",\n\t\t\"missed_vblanks_per_frame\":");
+	histogram_write_json(&soak->missed, fp);
+	fprintf(fp, "}");
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright © 2016 Pekka Paalanen <pq@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef ORING_SOAK_H
+#define ORING_SOAK_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "histogram.h"
+
+/** Timing distributions of one window over a soak run (--bench)
+ *
+ * Unlike struct frame_stats, this keeps the whole distribution of every
+ * frame of the run, so that the tails can be compared between runs.
+ * All times are in nanoseconds.
+ */
+struct soak_stats {
+	struct histogram target_error; /* presentation minus target */
+	struct histogram latency; /* commit to presentation */
+	struct histogram interval; /* between consecutive presentations */
+	struct histogram missed; /* vblanks past the target, per frame */
+
+	uint64_t presented;
+	uint64_t discarded;
+	uint64_t missed_frames; /* presented a vblank or more late */
+	uint64_t missed_vblanks; /* the sum over all frames */
+};
+
+struct soak_stats *
+soak_stats_create(void);
+
+void
+soak_stats_destroy(struct soak_stats *soak);
+
+void
+soak_stats_record_presented(struct soak_stats *soak, int64_t target_error,
+			    uint64_t interval, double period);
+
+void
+soak_stats_record_discarded(struct soak_stats *soak);
+
+void
+soak_stats_record_latency(struct soak_stats *soak, int64_t latency);
+
+void
+soak_stats_write_json(const struct soak_stats *soak, FILE *fp);
+
+#endif /* ORING_SOAK_H */
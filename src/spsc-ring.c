@@ -0,0 +1,130 @@
+/*
+ * Copyright © 2016 Pekka Paalanen <pq@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include "spsc-ring.h"
+#include "xalloc.h"
+
+/** Initialize a ring buffer
+ *
+ * \param ring The uninitialized ring to overwrite.
+ * \param elem_size Size of one element in bytes.
+ * \param capacity Maximum number of elements, must be a power of two.
+ */
+void
+spsc_ring_init(struct spsc_ring *ring, size_t elem_size, unsigned capacity)
+{
+	assert(capacity > 0 && (capacity & (capacity - 1)) == 0);
+
+	ring->data = xzalloc(elem_size * capacity);
+	ring->elem_size = elem_size;
+	ring->mask = capacity - 1;
+	ring->head = 0;
+	ring->tail = 0;
+}
+
+/** Release a ring buffer
+ *
+ * \param ring The ring.
+ *
+ * Any elements still in the ring are lost. Neither the producer nor
+ * the consumer may use the ring anymore.
+ */
+void
+spsc_ring_release(struct spsc_ring *ring)
+{
+	free(ring->data);
+	ring->data = NULL;
+}
+
+/** Add an element to the ring
+ *
+ * \param ring The ring.
+ * \param elem Pointer to the element to copy in.
+ * \return True on success, false if the ring is full.
+ *
+ * Only the producer thread may call this.
+ */
+bool
+spsc_ring_push(struct spsc_ring *ring, const void *elem)
+{
+	unsigned tail = ring->tail;
+	unsigned head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+	if (tail - head > ring->mask)
+		return false;
+
+	memcpy(ring->data + (tail & ring->mask) * ring->elem_size,
+	       elem, ring->elem_size);
+
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+/** Take the oldest element from the ring
+ *
+ * \param ring The ring.
+ * \param elem Pointer to where to copy the element out.
+ * \return True on success, false if the ring is empty.
+ *
+ * Only the consumer thread may call this.
+ */
+bool
+spsc_ring_pop(struct spsc_ring *ring, void *elem)
+{
+	unsigned head = ring->head;
+	unsigned tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+	if (head == tail)
+		return false;
+
+	memcpy(elem, ring->data + (head & ring->mask) * ring->elem_size,
+	       ring->elem_size);
+
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+/** Get the number of elements in the ring
+ *
+ * \param ring The ring.
+ * \return Number of elements waiting to be popped.
+ *
+ * Either thread may call this, but the result is only a snapshot.
+ */
+unsigned
+spsc_ring_count(const struct spsc_ring *ring)
+{
+	unsigned head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	unsigned tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+	return tail - head;
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright © 2016 Pekka Paalanen <pq@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef ORING_SPSC_RING_H
+#define ORING_SPSC_RING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/** Lock-free single-producer single-consumer ring buffer
+ *
+ * Holds up to capacity fixed-size elements. Exactly one thread may push
+ * and exactly one thread may pop; they may be different threads.
+ */
+struct spsc_ring {
+	char *data;
+	size_t elem_size;
+	unsigned mask; /* capacity - 1 */
+
+	unsigned head; /* next to pop, written by the consumer */
+	unsigned tail; /* next to push, written by the producer */
+};
+
+void
+spsc_ring_init(struct spsc_ring *ring, size_t elem_size, unsigned capacity);
+
+void
+spsc_ring_release(struct spsc_ring *ring);
+
+bool
+spsc_ring_push(struct spsc_ring *ring, const void *elem);
+
+bool
+spsc_ring_pop(struct spsc_ring *ring, void *elem);
+
+unsigned
+spsc_ring_count(const struct spsc_ring *ring);
+
+#endif /* ORING_SPSC_RING_H */
@@ -49,6 +49,27 @@ timespec_sub(struct timespec *r,
 	}
 }
 
+/* Add a nanosecond value to a timespec
+ *
+ * \param r[out] result: a + b
+ * \param a[in] base operand as timespec
+ * \param b[in] operand in nanoseconds
+ */
+static inline void
+timespec_add_nsec(struct timespec *r, const struct timespec *a, int64_t b)
+{
+	r->tv_sec = a->tv_sec + (b / NSEC_PER_SEC);
+	r->tv_nsec = a->tv_nsec + (b % NSEC_PER_SEC);
+
+	if (r->tv_nsec >= NSEC_PER_SEC) {
+		r->tv_sec++;
+		r->tv_nsec -= NSEC_PER_SEC;
+	} else if (r->tv_nsec < 0) {
+		r->tv_sec--;
+		r->tv_nsec += NSEC_PER_SEC;
+	}
+}
+
 /* Convert timespec to nanoseconds
  *
  * \param a timespec
@@ -87,4 +108,22 @@ timespec_from_proto(struct timespec *tm, uint32_t tv_sec_hi,
 	tm->tv_nsec = tv_nsec;
 }
 
+/* Convert timespec to Wayland protocol values
+ *
+ * \param a The timespec, must not be negative.
+ * \param tv_sec_hi See Presentation extension.
+ * \param tv_sec_lo See Presentation extension.
+ * \param tv_nsec See Presentation extension.
+ */
+static inline void
+timespec_to_proto(const struct timespec *a, uint32_t *tv_sec_hi,
+		  uint32_t *tv_sec_lo, uint32_t *tv_nsec)
+{
+	uint64_t sec = a->tv_sec;
+
+	*tv_sec_hi = sec >> 32;
+	*tv_sec_lo = sec & 0xffffffff;
+	*tv_nsec = a->tv_nsec;
+}
+
 #endif /* TIMESPEC_UTIL_H */
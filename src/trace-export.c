@@ -0,0 +1,181 @@
+/*
+ * Copyright © 2016 Pekka Paalanen <pq@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include "trace.h"
+#include "helpers.h"
+
+/* Pseudo thread ids for the timelines that are not recording threads */
+#define EXPORT_TID_GPU 100
+#define EXPORT_TID_DISPLAY 101
+
+static const char * const event_names[] = {
+	[TRACE_THREAD_NAME] = "thread_name",
+	[TRACE_REPAINT] = "repaint",
+	[TRACE_RENDER_BEGIN] = "render",
+	[TRACE_RENDER_END] = "render",
+	[TRACE_GPU_BEGIN] = "gpu",
+	[TRACE_GPU_END] = "gpu",
+	[TRACE_FENCE] = "fence",
+	[TRACE_FRAME_CALLBACK] = "frame callback",
+	[TRACE_PRESENTED] = "presented",
+	[TRACE_DISCARDED] = "discarded",
+	[TRACE_PACING] = "pacing",
+};
+
+static bool first = true;
+
+static void
+begin_event(const char *ph, const char *name, unsigned tid, uint64_t time)
+{
+	printf("%s\n{\"ph\":\"%s\",\"name\":\"%s\",\"pid\":1,\"tid\":%u,"
+	       "\"ts\":%.3f", first ? "" : ",", ph, name, tid, time * 1e-3);
+	first = false;
+}
+
+static void
+thread_name(unsigned tid, const char *name)
+{
+	printf("%s\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,"
+	       "\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+	       first ? "" : ",", tid, name);
+	first = false;
+}
+
+static void
+export_record(const struct trace_record *rec)
+{
+	const char *name = event_names[rec->event];
+	char str[9] = {};
+
+	switch (rec->event) {
+	case TRACE_THREAD_NAME:
+		memcpy(str, &rec->value, 8);
+		thread_name(rec->thread, str);
+		return;
+	case TRACE_RENDER_BEGIN:
+		begin_event("B", name, rec->thread, rec->time);
+		break;
+	case TRACE_RENDER_END:
+		begin_event("E", name, rec->thread, rec->time);
+		break;
+	case TRACE_GPU_BEGIN:
+		begin_event("B", name, EXPORT_TID_GPU, rec->time);
+		break;
+	case TRACE_GPU_END:
+		begin_event("E", name, EXPORT_TID_GPU, rec->time);
+		break;
+	case TRACE_PRESENTED:
+	case TRACE_DISCARDED:
+		begin_event("i", name, EXPORT_TID_DISPLAY, rec->time);
+		printf(",\"s\":\"t\"");
+		break;
+	default:
+		begin_event("i", name, rec->thread, rec->time);
+		printf(",\"s\":\"t\"");
+		break;
+	}
+
+	printf(",\"args\":{\"subm\":%" PRIu64 ",\"output\":%" PRIu32,
+	       rec->subm, rec->output);
+
+	switch (rec->event) {
+	case TRACE_REPAINT:
+		printf(",\"target_us\":%.3f", rec->value * 1e-3);
+		break;
+	case TRACE_PRESENTED:
+		printf(",\"refresh_ns\":%" PRIu64, rec->value);
+		break;
+	case TRACE_PACING:
+		printf(",\"interval\":%" PRIu64 ",\"level\":%" PRIu64,
+		       rec->value >> 8, rec->value & 0xff);
+		break;
+	default:
+		break;
+	}
+
+	printf("}}");
+}
+
+/** Convert an oring-cal binary trace into Chrome trace event JSON
+ *
+ * The output loads in chrome://tracing and in the Perfetto UI.
+ */
+int
+main(int argc, char *argv[])
+{
+	struct trace_file_header header;
+	struct trace_record rec;
+	uint64_t count = 0;
+	FILE *fp;
+
+	if (argc != 2) {
+		fprintf(stderr, "Usage: oring-trace-export TRACEFILE > out.json\n");
+		return EXIT_FAILURE;
+	}
+
+	fp = fopen(argv[1], "rb");
+	if (!fp) {
+		perror("Error opening trace file");
+		return EXIT_FAILURE;
+	}
+
+	if (fread(&header, sizeof header, 1, fp) != 1 ||
+	    memcmp(header.magic, TRACE_FILE_MAGIC,
+		   sizeof TRACE_FILE_MAGIC) != 0 ||
+	    header.version != TRACE_FILE_VERSION ||
+	    header.record_size != sizeof rec) {
+		fprintf(stderr, "Error: '%s' is not a supported trace file.\n",
+			argv[1]);
+		fclose(fp);
+		return EXIT_FAILURE;
+	}
+
+	printf("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+	thread_name(EXPORT_TID_GPU, "GPU");
+	thread_name(EXPORT_TID_DISPLAY, "display");
+
+	while (fread(&rec, sizeof rec, 1, fp) == 1) {
+		if (rec.event >= ARRAY_LENGTH(event_names))
+			continue;
+
+		export_record(&rec);
+		count++;
+	}
+
+	printf("\n]}\n");
+	fclose(fp);
+
+	fprintf(stderr, "%" PRIu64 " events exported, clock id %d\n",
+		count, header.clock_id);
+
+	return EXIT_SUCCESS;
+}
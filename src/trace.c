@@ -0,0 +1,308 @@
+/*
+ * Copyright © 2016 Pekka Paalanen <pq@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "trace.h"
+#include "helpers.h"
+#include "timespec-util.h"
+#include "xalloc.h"
+
+/* Records per recording thread between writer wakeups */
+#define TRACE_RING_CAPACITY 4096
+
+/* How often the writer drains the buffers, milliseconds */
+#define TRACE_WRITE_MSEC 10
+
+/* Size of the file window mapped at a time */
+#define TRACE_MAP_SIZE (4 << 20)
+
+static void
+trace_fail(struct trace *trace, const char *msg)
+{
+	fprintf(stderr, "Error writing trace: %s: %s\n", msg, strerror(errno));
+	trace->failed = true;
+}
+
+/* Grow the file and map the next window of it. */
+static void
+trace_map_next(struct trace *trace)
+{
+	void *map;
+
+	if (trace->map) {
+		munmap(trace->map, TRACE_MAP_SIZE);
+		trace->map = NULL;
+		trace->map_offset += TRACE_MAP_SIZE;
+	}
+
+	if (ftruncate(trace->fd, trace->map_offset + TRACE_MAP_SIZE) < 0) {
+		trace_fail(trace, "ftruncate");
+		return;
+	}
+
+	map = mmap(NULL, TRACE_MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+		   trace->fd, trace->map_offset);
+	if (map == MAP_FAILED) {
+		trace_fail(trace, "mmap");
+		return;
+	}
+
+	trace->map = map;
+	trace->map_used = 0;
+}
+
+static void
+trace_write(struct trace *trace, const void *data, size_t size)
+{
+	/* Records never straddle a window, the sizes divide it. */
+	if (!trace->failed && trace->map_used == TRACE_MAP_SIZE)
+		trace_map_next(trace);
+
+	if (trace->failed)
+		return;
+
+	memcpy(trace->map + trace->map_used, data, size);
+	trace->map_used += size;
+}
+
+/* Move everything recorded so far into the file. */
+static void
+trace_drain(struct trace *trace, unsigned buffer_count)
+{
+	struct trace_record rec;
+	unsigned i;
+
+	for (i = 0; i < buffer_count; i++) {
+		while (spsc_ring_pop(&trace->buffers[i]->ring, &rec)) {
+			trace_write(trace, &rec, sizeof rec);
+			trace->written++;
+		}
+	}
+}
+
+static void *
+trace_thread_main(void *data)
+{
+	struct trace *trace = data;
+	struct timespec deadline;
+	unsigned count;
+	bool quit;
+
+	pthread_mutex_lock(&trace->mutex);
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	do {
+		timespec_add_nsec(&deadline, &deadline,
+				  TRACE_WRITE_MSEC * 1000000LL);
+		while (!trace->quit &&
+		       pthread_cond_timedwait(&trace->cond, &trace->mutex,
+					      &deadline) != ETIMEDOUT)
+			;
+
+		quit = trace->quit;
+		count = trace->buffer_count;
+
+		pthread_mutex_unlock(&trace->mutex);
+		trace_drain(trace, count);
+		pthread_mutex_lock(&trace->mutex);
+	} while (!quit);
+	pthread_mutex_unlock(&trace->mutex);
+
+	return NULL;
+}
+
+/** Start recording a trace
+ *
+ * \param path The file to write, truncated if it exists.
+ * \param clock_id The clock the recorded times are in.
+ * \return A new trace recorder.
+ *
+ * Exits the program on failure.
+ */
+struct trace *
+trace_create(const char *path, clockid_t clock_id)
+{
+	struct trace_file_header header = {
+		.magic = TRACE_FILE_MAGIC,
+		.version = TRACE_FILE_VERSION,
+		.record_size = sizeof(struct trace_record),
+		.clock_id = clock_id,
+	};
+	struct trace *trace;
+	pthread_condattr_t attr;
+	int ret;
+
+	trace = xzalloc(sizeof *trace);
+
+	trace->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (trace->fd < 0) {
+		fprintf(stderr, "Error opening trace file '%s': %s\n",
+			path, strerror(errno));
+		exit(1);
+	}
+
+	trace_map_next(trace);
+	if (trace->failed)
+		exit(1);
+
+	trace_write(trace, &header, sizeof header);
+
+	pthread_mutex_init(&trace->mutex, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&trace->cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	ret = pthread_create(&trace->thread, NULL, trace_thread_main, trace);
+	if (ret != 0) {
+		fprintf(stderr, "Error creating trace thread: %s\n",
+			strerror(ret));
+		exit(1);
+	}
+
+	return trace;
+}
+
+/** Stop recording and close the trace file
+ *
+ * \param trace The trace recorder, may be NULL.
+ *
+ * No thread may record anymore. Everything recorded is written out, and
+ * the buffers are freed.
+ */
+void
+trace_destroy(struct trace *trace)
+{
+	uint64_t dropped = 0;
+	unsigned i;
+
+	if (!trace)
+		return;
+
+	pthread_mutex_lock(&trace->mutex);
+	trace->quit = true;
+	pthread_cond_signal(&trace->cond);
+	pthread_mutex_unlock(&trace->mutex);
+
+	pthread_join(trace->thread, NULL);
+
+	for (i = 0; i < trace->buffer_count; i++) {
+		dropped += trace->buffers[i]->dropped;
+		spsc_ring_release(&trace->buffers[i]->ring);
+		free(trace->buffers[i]);
+	}
+
+	if (trace->map)
+		munmap(trace->map, TRACE_MAP_SIZE);
+	if (ftruncate(trace->fd, trace->map_offset + trace->map_used) < 0)
+		perror("Error truncating trace file");
+	close(trace->fd);
+
+	printf("trace: %" PRIu64 " records written, %" PRIu64 " dropped\n",
+	       trace->written, dropped);
+
+	pthread_cond_destroy(&trace->cond);
+	pthread_mutex_destroy(&trace->mutex);
+	free(trace);
+}
+
+/** Create the buffer for one recording thread
+ *
+ * \param trace The trace recorder, may be NULL.
+ * \param name The thread name for the trace, at most 8 characters are kept.
+ * \param time The current time, for the thread name record.
+ * \return The buffer, or NULL if trace was NULL.
+ *
+ * Only the thread that will use the buffer should record into it from
+ * then on. The buffer is owned by the trace.
+ */
+struct trace_buffer *
+trace_buffer_create(struct trace *trace, const char *name, uint64_t time)
+{
+	struct trace_buffer *buf;
+	uint64_t packed = 0;
+
+	if (!trace)
+		return NULL;
+
+	buf = xzalloc(sizeof *buf);
+	buf->trace = trace;
+	spsc_ring_init(&buf->ring, sizeof(struct trace_record),
+		       TRACE_RING_CAPACITY);
+
+	pthread_mutex_lock(&trace->mutex);
+	if (trace->buffer_count == TRACE_MAX_THREADS) {
+		fprintf(stderr, "Error: too many trace threads.\n");
+		exit(1);
+	}
+	buf->thread = trace->buffer_count;
+	trace->buffers[trace->buffer_count++] = buf;
+	pthread_mutex_unlock(&trace->mutex);
+
+	memcpy(&packed, name, MIN(strlen(name), sizeof packed));
+	trace_emit(buf, TRACE_THREAD_NAME, time, 0, 0, packed);
+
+	return buf;
+}
+
+/** Record an event
+ *
+ * \param buf The buffer of the calling thread, may be NULL.
+ * \param event What happened.
+ * \param time When it happened, display::gfx_clock nanoseconds.
+ * \param subm The submission::id it concerns, 0 if none.
+ * \param output The output::name it concerns, 0 if none.
+ * \param value Event specific, see enum trace_event.
+ *
+ * Never blocks. If the writer has fallen behind, the record is dropped
+ * and counted.
+ */
+void
+trace_emit(struct trace_buffer *buf, enum trace_event event, uint64_t time,
+	   uint64_t subm, uint32_t output, uint64_t value)
+{
+	struct trace_record rec;
+
+	if (!buf)
+		return;
+
+	rec.event = event;
+	rec.thread = buf->thread;
+	rec.output = output;
+	rec.time = time;
+	rec.subm = subm;
+	rec.value = value;
+
+	if (!spsc_ring_push(&buf->ring, &rec))
+		buf->dropped++;
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright © 2016 Pekka Paalanen <pq@iki.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef ORING_TRACE_H
+#define ORING_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "spsc-ring.h"
+
+enum trace_event {
+	TRACE_THREAD_NAME, /* value: up to 8 characters of the name */
+	TRACE_REPAINT, /* submission created, value: target time */
+	TRACE_RENDER_BEGIN,
+	TRACE_RENDER_END, /* committed */
+	TRACE_GPU_BEGIN,
+	TRACE_GPU_END,
+	TRACE_FENCE, /* native fence seen signalled */
+	TRACE_FRAME_CALLBACK,
+	TRACE_PRESENTED, /* value: refresh period */
+	TRACE_DISCARDED,
+	TRACE_PACING, /* value: interval << 8 | quality level */
+	TRACE_EVENT_COUNT
+};
+
+/** One trace record as written to the file */
+struct trace_record {
+	uint16_t event; /* enum trace_event */
+	uint16_t thread; /* index of the recording trace_buffer */
+	uint32_t output; /* output::name, 0 if none */
+	uint64_t time; /* display::gfx_clock nanoseconds */
+	uint64_t subm; /* submission::id, 0 if none */
+	uint64_t value; /* depends on the event */
+};
+
+#define TRACE_FILE_MAGIC "ORTRACE"
+#define TRACE_FILE_VERSION 1
+
+/** The start of a trace file, followed by struct trace_record until EOF */
+struct trace_file_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+	int32_t clock_id; /* of display::gfx_clock */
+	uint32_t reserved[3];
+};
+
+struct trace;
+
+/** Lock-free buffer of one recording thread */
+struct trace_buffer {
+	struct trace *trace;
+	uint16_t thread;
+	struct spsc_ring ring; /* struct trace_record */
+	uint64_t dropped; /* written by the recording thread only */
+};
+
+#define TRACE_MAX_THREADS 16
+
+/** Binary trace recorder
+ *
+ * Each recording thread has its own trace_buffer. A writer thread
+ * drains them periodically into a memory-mapped file, so recording
+ * costs the measured threads only a ring push.
+ */
+struct trace {
+	int fd;
+	char *map; /* current window of the file */
+	uint64_t map_offset; /* file offset of the window */
+	size_t map_used;
+	bool failed; /* stop writing after an error */
+	uint64_t written;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	bool quit; /* protected by mutex */
+	struct trace_buffer *buffers[TRACE_MAX_THREADS]; /* by mutex */
+	unsigned buffer_count;
+	pthread_t thread;
+};
+
+struct trace *
+trace_create(const char *path, clockid_t clock_id);
+
+void
+trace_destroy(struct trace *trace);
+
+struct trace_buffer *
+trace_buffer_create(struct trace *trace, const char *name, uint64_t time);
+
+void
+trace_emit(struct trace_buffer *buf, enum trace_event event, uint64_t time,
+	   uint64_t subm, uint32_t output, uint64_t value);
+
+#endif /* ORING_TRACE_H */